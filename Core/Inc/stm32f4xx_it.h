@@ -56,6 +56,9 @@ void DebugMon_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
 /* USER CODE BEGIN EFP */
+void UART5_IRQHandler(void);
+void DMA1_Stream0_IRQHandler(void);
+void FLASH_IRQHandler(void);
 
 /* USER CODE END EFP */
 
@@ -26,6 +26,13 @@
 #include "boot.h"
 #include "proto.h"
 #include "crc32.h"
+#include "serial.h"
+#include "flash_job.h"
+#include "clock.h"
+#include "handoff.h"
+#include "timeline.h"
+#include "prof.h"
+#include "log.h"
 #include "SEGGER_RTT.h"
 /* USER CODE END Includes */
 
@@ -36,6 +43,10 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+/* Packets buffered between the receiver and the flash programming */
+#define BOOT_PACKET_BUFFERS 2
+/* Bytes programmed before checking the link for the next packet */
+#define BOOT_PROGRAM_STEP 256
 
 /* USER CODE END PD */
 
@@ -46,6 +57,15 @@
 /* Private variables ---------------------------------------------------------*/
 
 /* USER CODE BEGIN PV */
+/* CONF flags of the application being downloaded */
+static uint32_t app_flags = 0;
+/* set when the download can not be applied, its data is dropped */
+static bool app_rejected = false;
+/* temp slot the application is downloaded to */
+static uint8_t app_slotno = BOOT_TEMPSLOT1;
+/* the application asked for the bootloader mode before its reset */
+static bool app_requested = false;
+
 void normal_boot(void);
 void bootloader_mode(void);
 /* USER CODE END PV */
@@ -68,6 +88,8 @@ void SystemClock_Config(void);
 int main(void)
 {
   /* USER CODE BEGIN 1 */
+  // before anything else, the time origin of the boot timeline
+  timeline_init();
 
   /* USER CODE END 1 */
 
@@ -77,6 +99,9 @@ int main(void)
   HAL_Init();
 
   /* USER CODE BEGIN Init */
+  handoff_init();
+  app_requested = (handoff_take_request() == HANDOFF_REQUEST_BOOTLOADER);
+  timeline_mark(TIMELINE_HAL_INIT);
 
   /* USER CODE END Init */
 
@@ -84,6 +109,14 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
+  timeline_mark(TIMELINE_SYSCLK);
+  log_init();
+
+  // the peripherals below take their rates from the profile clock
+  if (clock_apply(BOOT_CLOCK_PROFILE) != 0) {
+    SEGGER_RTT_printf(0, "clock profile %d failed, running from the HSI\r\n", BOOT_CLOCK_PROFILE);
+  }
+  timeline_mark(TIMELINE_CLOCK_PROFILE);
 
   /* USER CODE END SysInit */
 
@@ -91,6 +124,14 @@ int main(void)
   MX_GPIO_Init();
   MX_UART5_Init();
   /* USER CODE BEGIN 2 */
+  prof_init();
+
+  if (serial_init() != 0) {
+    Error_Handler();
+  }
+  flash_job_init();
+  handoff_phase(HANDOFF_PHASE_INIT);
+  timeline_mark(TIMELINE_PERIPHERALS);
 
   /* USER CODE END 2 */
 
@@ -107,9 +148,14 @@ int main(void)
     SEGGER_RTT_printf(0, "boot_init: wrong partition \r\n");
     while (1);
   }
+  timeline_mark(TIMELINE_BOOT_INIT);
 
   HAL_GPIO_WritePin(GPIOG, GPIO_PIN_14, GPIO_PIN_SET);
-  // Logic to switch to bootloader mode
+  // Logic to switch to bootloader mode, the request of the application
+  // needs no waiting, the button is read at least once
+  if (app_requested) {
+    SEGGER_RTT_printf(0, "bootloader mode requested by the application\r\n");
+  }
   start_time = HAL_GetTick();
   do {
 
@@ -117,10 +163,12 @@ int main(void)
       is_pressed = true;
     }
 
-  } while ((HAL_GetTick() - start_time < 3000) && !is_pressed);
+  } while ((HAL_GetTick() - start_time < BOOT_BUTTON_WINDOW_MS) && !is_pressed && !app_requested);
+  handoff_phase(HANDOFF_PHASE_WAIT);
+  timeline_mark(TIMELINE_BUTTON);
 
   // Perform normal boot.
-  if (!is_pressed) {
+  if (!is_pressed && !app_requested) {
     normal_boot();
   }
 
@@ -184,13 +232,24 @@ void normal_boot(void)
   int ret = 0;
 
   SEGGER_RTT_printf(0, "normal boot: perform normal application boot\r\n");
-  ret = boot_validate_appslot_bin();
+  PROF_BEGIN(PROF_IMAGE_VALIDATE);
+  ret = boot_validate_appslot_fast();
+  PROF_END(PROF_IMAGE_VALIDATE);
+
+  // with XIP the previous image is still in the other slot
+  if (ret == -1 && boot_rollback_appslot() == 0) {
+    SEGGER_RTT_printf(0, "normal boot: appslot validation failed, rolled back\r\n");
+    ret = 0;
+  }
 
+  // no application left to request an update, wait for one instead
   if (ret == -1) {
-    SEGGER_RTT_printf(0, "normal boot: appslot validation failed\r\n");
-    while (1); // unlimited wait
+    SEGGER_RTT_printf(0, "normal boot: appslot validation failed, entering bootloader mode\r\n");
+    return;
   }
   SEGGER_RTT_printf(0, "normal boot: validation successful\r\n");
+  handoff_phase(HANDOFF_PHASE_VALIDATE);
+  timeline_mark(TIMELINE_VALIDATE);
 
   // jump to application address
   boot_goto_app();
@@ -200,22 +259,37 @@ void boot_newapp(void)
 {
   int ret = 0;
 
-  // validate the application binary
-  ret = boot_validate_tempslot_bin(BOOT_TEMPSLOT1);
+  // program the trailing bytes of the application binary
+  ret = boot_flush_tempslot();
   if (ret == -1) {
-    SEGGER_RTT_printf(0, "bootloader mode: validation failed, bootloader halt...!\r\n");
+    SEGGER_RTT_printf(0, "bootloader mode: flash failed, bootloader halt...!\r\n");
     while(1); // unlimited wait
   }
 
-  boot_load_bin_to_appslot(BOOT_TEMPSLOT1);
+  // validate the application binary digest streamed during the download
+  ret = boot_validate_tempslot_digest();
+  if (ret == -1) {
+    SEGGER_RTT_printf(0, "bootloader mode: validation failed, bootloader halt...!\r\n");
+    while(1); // unlimited wait
+  }
 
-  ret = boot_validate_appslot_bin();
+  // copy to the appslot, verified against the config crc on the way,
+  // with XIP the image already is where it runs
+  ret = boot_install_tempslot(app_slotno);
   if (ret == -1) {
     SEGGER_RTT_printf(0, "bootloader mode: failed to load application, bootloader halt...!");
     while (1); // unlimited wait
   }
 
+  // installed, an interrupted copy would still find the download complete
+  boot_finish_progress();
+
+  // the copy was verified, let the next boots take the fast path
+  boot_mark_appslot_valid();
+
   SEGGER_RTT_printf(0, "bootloader mode: validation successful\r\n");
+  handoff_phase(HANDOFF_PHASE_INSTALL);
+  timeline_mark(TIMELINE_INSTALL);
   // jump to application slot
   boot_goto_app();
 }
@@ -223,6 +297,7 @@ void boot_newapp(void)
 void write_app_config(sbp_handle_t *sbp_handle)
 {
   uint8_t version[8] = {0};
+  uint32_t offset = 0;
 
   memcpy(version, (uint8_t*)&sbp_handle->config.version, 4);
   SEGGER_RTT_printf(0, "bootloader mode: application version: ");
@@ -232,45 +307,180 @@ void write_app_config(sbp_handle_t *sbp_handle)
   SEGGER_RTT_printf(0, "\r\n");
   SEGGER_RTT_printf(0, "bootloader mode: application size: %ld\r\n", sbp_handle->config.size);
 
-  boot_write_config_version(sbp_handle->config.version);
-  boot_write_config_size(sbp_handle->config.size);
-  boot_write_config_crc(sbp_handle->config.crc);
-  boot_write_config_slotno(BOOT_TEMPSLOT1);
+  app_flags = sbp_handle->config.flags;
+  app_rejected = false;
+
+  // the slot already holds the start of this image and its config is
+  // written, carry on from where the download stopped
+  if (app_flags & SBP_CONF_FLAG_RESUME) {
+    if ((app_flags & ~SBP_CONF_FLAG_RESUME) != 0 ||
+        boot_resume_tempslot(app_slotno, sbp_handle->config.size, sbp_handle->config.crc, &offset) != 0) {
+      SEGGER_RTT_printf(0, "bootloader mode: nothing to resume, dropping data\r\n");
+      app_rejected = true;
+      return;
+    }
+    SEGGER_RTT_printf(0, "bootloader mode: resuming at %ld\r\n", offset);
+    proto_window_seek(offset);
+    return;
+  }
+
+  if (boot_start_download(app_slotno, sbp_handle->config.size) != 0) {
+    SEGGER_RTT_printf(0, "bootloader mode: wrong image size, dropping data\r\n");
+    app_rejected = true;
+  }
+
+  // the patch base is the installed image, check it before its
+  // config is overwritten by the new one
+  if (app_flags & SBP_CONF_FLAG_DELTA) {
+    SEGGER_RTT_printf(0, "bootloader mode: delta transfer\r\n");
+    if (!app_rejected && boot_start_delta(sbp_handle->config.base_crc) != 0) {
+      SEGGER_RTT_printf(0, "bootloader mode: delta base mismatch, dropping data\r\n");
+      app_rejected = true;
+    }
+  }
+
+  // a refused image leaves the config of the installed one, which still
+  // boots after the reset
+  if (!app_rejected) {
+    boot_write_config(sbp_handle->config.version, sbp_handle->config.size,
+                      sbp_handle->config.crc, app_slotno);
+  }
+
+  // an uncompressed download can be resumed if it gets interrupted
+  if (!app_rejected &&
+      boot_start_progress(app_slotno, sbp_handle->config.size, sbp_handle->config.crc, app_flags) != 0) {
+    SEGGER_RTT_printf(0, "bootloader mode: progress not recorded\r\n");
+  }
+
+  // erase only once the size is known, the erase time follows the image.
+  // It runs in the background after the config and progress writes, the
+  // data packets are received meanwhile and queue up behind it
+  SEGGER_RTT_printf(0, "bootloader mode: erasing tempslot %d \r\n", app_slotno + 1);
+  if (!app_rejected && boot_erase_tempslot(app_slotno, sbp_handle->config.size) != 0) {
+    SEGGER_RTT_printf(0, "bootloader mode: erase failed, dropping data\r\n");
+    app_rejected = true;
+  }
+
+  if (app_flags & SBP_CONF_FLAG_COMPRESSED) {
+    SEGGER_RTT_printf(0, "bootloader mode: compressed transfer\r\n");
+  }
 }
 
-void write_app_bin(sbp_handle_t *sbp_handle)
+void query_app_progress(void)
 {
-  boot_write_bin_to_tempslot(BOOT_TEMPSLOT1, sbp_handle->data.bytes, sbp_handle->data.size);
+  uint32_t size = 0;
+  uint32_t crc = 0;
+  uint32_t offset = 0;
+
+  if (boot_query_progress(app_slotno, &size, &crc, &offset) != 0) {
+    size = 0;
+    crc = 0;
+    offset = 0;
+  }
+
+  SEGGER_RTT_printf(0, "bootloader mode: resumable at %ld of %ld\r\n", offset, size);
+  proto_transmit_packet_prog(size, crc, offset);
+}
+
+void send_boot_timeline(uint32_t count)
+{
+  static uint8_t timeline[SBP_DATA_MAX_SIZE];
+  uint16_t size = 0;
+
+  // more than the ring holds is all of it
+  if (count > 0xFF) {
+    count = 0;
+  }
+
+  size = timeline_export(timeline, sizeof(timeline), count);
+  SEGGER_RTT_printf(0, "bootloader mode: boot timeline, %d boots\r\n", timeline[0]);
+  proto_transmit_packet_tline(timeline, size);
+}
+
+bool write_app_bin(sbp_handle_t *sbp_handle, uint16_t *written)
+{
+  uint16_t size = sbp_handle->data.size - *written;
+
+  if (size > BOOT_PROGRAM_STEP)
+    size = BOOT_PROGRAM_STEP;
+
+  if (app_rejected) {
+    // nothing is programmed, the digest check fails at STOP
+  } else if (app_flags & SBP_CONF_FLAG_COMPRESSED) {
+    boot_write_compressed_to_tempslot(app_slotno, sbp_handle->data.bytes + *written, size);
+  } else if (app_flags & SBP_CONF_FLAG_DELTA) {
+    boot_write_delta_to_tempslot(app_slotno, sbp_handle->data.bytes + *written, size);
+  } else {
+    boot_write_bin_to_tempslot(app_slotno, sbp_handle->data.bytes + *written, size);
+  }
+  *written += size;
+
+  // true once the whole packet is programmed
+  return *written == sbp_handle->data.size;
 }
 
 void bootloader_mode(void)
 {
-  sbp_handle_t sbp_handle;
+  // ring of packet buffers, DATA packets wait here to be programmed
+  // while the next ones are received and acknowledged
+  static sbp_handle_t sbp_handle[BOOT_PACKET_BUFFERS];
+  sbp_handle_t *handle;
+  uint8_t head = 0;
+  uint8_t queued = 0;
+  uint16_t written = 0;
 
   // Enter into the bootloader mode
   SEGGER_RTT_printf(0, "bootloader mode: entering bootloader mode\r\n");
-  SEGGER_RTT_printf(0, "bootloader mode: erasing tempslot %d \r\n", BOOT_TEMPSLOT1 + 1);
-  boot_erase_tempslot(BOOT_TEMPSLOT1);
+  app_slotno = boot_get_download_slot();
 
   while (1) {
-    proto_receive_packet(&sbp_handle);
-
-    switch (sbp_handle.state) {
-
-      case STATE_RESET:
-        break;
-      case STATE_DOWNLOAD_START:
-        break;
-      case STATE_DOWNLOAD_COMPLETE:
-        boot_newapp();
-        break;
-      case STATE_CONF_PACKET_RECEIVED:
-        write_app_config(&sbp_handle);
-        break;
-      case STATE_DATA_PACKET_RECEIVED:
-        write_app_bin(&sbp_handle);
-        break;
 
+    // receive whenever a whole packet is waiting and a buffer is free
+    if (queued < BOOT_PACKET_BUFFERS && proto_packet_pending()) {
+      handle = &sbp_handle[(head + queued) % BOOT_PACKET_BUFFERS];
+      proto_receive_packet(handle);
+
+      switch (handle->state) {
+
+        case STATE_RESET:
+          break;
+        case STATE_DOWNLOAD_START:
+          break;
+        case STATE_DOWNLOAD_COMPLETE:
+          handoff_phase(HANDOFF_PHASE_DOWNLOAD);
+          timeline_mark(TIMELINE_DOWNLOAD);
+          // program what is still buffered before the validation
+          while (queued > 0) {
+            if (write_app_bin(&sbp_handle[head], &written)) {
+              head = (head + 1) % BOOT_PACKET_BUFFERS;
+              queued--;
+              written = 0;
+            }
+          }
+          boot_newapp();
+          break;
+        case STATE_CONF_PACKET_RECEIVED:
+          write_app_config(handle);
+          break;
+        case STATE_DATA_PACKET_RECEIVED:
+          queued++;
+          break;
+        case STATE_QUERY_RECEIVED:
+          query_app_progress();
+          break;
+        case STATE_TIMELINE_RECEIVED:
+          send_boot_timeline(handle->config.size);
+          break;
+
+      }
+      continue;
+    }
+
+    // otherwise program the oldest buffered packet, one step at a time
+    if (queued > 0 && write_app_bin(&sbp_handle[head], &written)) {
+      head = (head + 1) % BOOT_PACKET_BUFFERS;
+      queued--;
+      written = 0;
     }
   }
 }
@@ -1,11 +1,38 @@
 #include "boot.h"
 #include "partition.h"
-#include "SEGGER_RTT.h"
+#include "log.h"
 
 #include "crc32.h"
+#include "flash.h"
+#include "flash_job.h"
+#include "lzss.h"
+#include "delta.h"
+#include "config.h"
+#include "prof.h"
+#include "progress.h"
+#include "clock.h"
+#include "handoff.h"
+#include "timeline.h"
+#include "serial.h"
 
 typedef void (*func_ptr_t) (void);
 
+/* Fast boot record, appended to the fast boot area after every full
+ * validation of the appslot */
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;           // validated image crc
+    uint32_t size;          // validated image size
+    uint32_t counter;       // monotonic, bumped on every full validation
+    uint32_t sample_crc;    // digest of the sampled image blocks
+    uint32_t tally;         // one bit cleared per fast boot
+    uint32_t addr;          // flash address the image runs from
+    uint32_t reserved;
+} boot_fastboot_record_t;
+
+#define BOOT_FASTBOOT_MAGIC 0x46425254 // "FBRT"
+#define BOOT_FASTBOOT_RECORDS (FASTBOOT_FLASH_SIZE / sizeof(boot_fastboot_record_t))
+
 /* Number of the bootloader slots available */
 static uint32_t boot_slots_addr[] = {
 SLOT1_FLASH_ADDR,
@@ -15,10 +42,52 @@ SLOT2_FLASH_ADDR
 /* Tracks the application bytes written into slot address */
 static uint32_t boot_recv_inc_global = 0;
 
+/* Queues the application bytes to the flash interrupt in blocks */
+static flash_job_stream_t boot_tempslot_stream;
+
+/* Application bytes the queue has programmed, updated from the interrupt */
+static volatile uint32_t boot_tempslot_programmed = 0;
+
+/* Digest of the application bytes received so far */
+static crc32_ctx_t boot_tempslot_crc;
+
+/* Decodes the compressed transfer into the temp slot */
+static lzss_decoder_t boot_lzss_decoder;
+static uint8_t boot_lzss_slotno;
+
+/* Rebuilds the image from the appslot and the streamed patch */
+static delta_patch_t boot_delta_patch;
+static bool boot_delta_enabled = false;
+
+/* Progress of an uncompressed download is recorded, the decoder state of
+ * the other streams is lost with the RAM, they can't resume */
+static bool boot_progress_enabled = false;
+
+#if BOOT_XIP
+/* Image chosen by a rollback, overrides the config for this boot */
+static uint32_t boot_rollback_addr = 0;
+#endif
+
+/* Flash address of the image to boot, in place from its slot with XIP */
+static uint32_t boot_image_addr(void)
+{
+#if BOOT_XIP
+    if (boot_rollback_addr != 0)
+        return boot_rollback_addr;
+
+    if (boot_read_config_slotno() == BOOT_TEMPSLOT2 + 1)
+        return SLOT2_FLASH_ADDR;
+
+    return SLOT1_FLASH_ADDR;
+#else
+    return APP_FLASH_ADDR;
+#endif
+}
+
 static bool boot_validate_config_flash_address(void)
 {
     if ((CONFIG_FLASH_ADDR >= FLASH_BASE) &&
-        (CONFIG_FLASH_ADDR + CONFIG_FLASH_SIZE <= FLASH_END))
+        (CONFIG2_FLASH_ADDR + CONFIG_FLASH_SIZE <= FLASH_END))
         return true;
 
     return false;
@@ -57,35 +126,253 @@ int boot_init(void)
         !boot_validate_appslot_flash_address()    ||
         !boot_validate_tempslot1_flash_address()  ||
         !boot_validate_tempslot2_flash_address()) {
-        SEGGER_RTT_printf(0, "boot_init: failed \r\n");
+        LOG_ERROR("boot_init: failed");
         return -1;
     }
 
-    return 0;
+    return config_init();
+}
+
+uint8_t boot_get_download_slot(void)
+{
+#if BOOT_XIP
+    progress_image_t image;
+    uint32_t offset;
+
+    // the config already points at the slot of an interrupted download,
+    // keep writing there, the other slot holds the rollback
+    if (progress_query(&image, &offset) == 0 &&
+        (image.slotno == BOOT_TEMPSLOT1 || image.slotno == BOOT_TEMPSLOT2))
+        return image.slotno;
+
+    // never overwrite the active image, it is the rollback
+    if (boot_image_addr() == SLOT1_FLASH_ADDR)
+        return BOOT_TEMPSLOT2;
+#endif
+    return BOOT_TEMPSLOT1;
 }
 
 int boot_validate_appslot_bin(void)
 {
-    uint32_t app_addr = APP_FLASH_ADDR;
+    uint32_t app_addr = boot_image_addr();
     uint32_t app_size = boot_read_config_size();
     uint32_t app_crc = boot_read_config_crc();
     uint32_t crc = 0;
 
     if (app_size == 0 || app_size > APP_FLASH_SIZE) {
-        SEGGER_RTT_printf(0, "boot_validate_appslot_bin: size = %ld\r\n", app_size);
+        LOG_ERROR("boot_validate_appslot_bin: size = %ld", app_size);
         return -1;
     }
 
     // Calculate the CRC
     crc = crc32_calculate_from_flash(app_addr, app_size);
     if (crc != app_crc) {
-        SEGGER_RTT_printf(0, "boot_validate_appslot_bin: crc = %x, calc_crc = %x\r\n", app_crc, crc);
+        LOG_ERROR("boot_validate_appslot_bin: crc = %x, calc_crc = %x", app_crc, crc);
         return -1;
     }
 
     return 0;
 }
 
+static bool boot_check_app_vectors(uint32_t addr, uint32_t size)
+{
+    uint32_t msp = *((volatile uint32_t *) addr);
+    uint32_t reset = *((volatile uint32_t *) (addr + 4));
+
+    if (msp < SRAM1_BASE || msp > SRAM1_BASE + 192 * 1024)
+        return false;
+
+    // thumb entry inside the validated image
+    if ((reset & 1) == 0 || reset < addr || reset >= addr + size)
+        return false;
+
+    return true;
+}
+
+static uint32_t boot_sample_appslot(uint32_t addr, uint32_t size)
+{
+    uint32_t sample = (size < BOOT_FASTBOOT_SAMPLE_SIZE) ? size : BOOT_FASTBOOT_SAMPLE_SIZE;
+    uint32_t offset;
+    crc32_ctx_t crc;
+
+    crc32_init(&crc);
+
+    for (int i = 0; i < BOOT_FASTBOOT_SAMPLES; i++) {
+        offset = (size - sample) / (BOOT_FASTBOOT_SAMPLES - 1) * i;
+        crc32_update(&crc, (const uint8_t *) (addr + offset), sample);
+    }
+
+    return crc32_final(&crc);
+}
+
+static volatile boot_fastboot_record_t *boot_find_fastboot_record(int *free_index)
+{
+    volatile boot_fastboot_record_t *records = (volatile boot_fastboot_record_t *) FASTBOOT_FLASH_ADDR;
+    int i;
+
+    // records are appended, the last programmed one is the latest
+    for (i = 0; i < BOOT_FASTBOOT_RECORDS; i++) {
+        if (records[i].magic != BOOT_FASTBOOT_MAGIC)
+            break;
+    }
+
+    *free_index = i;
+    return (i == 0) ? NULL : &records[i - 1];
+}
+
+static int boot_program_fastboot_record(uint32_t addr, const boot_fastboot_record_t *record)
+{
+    // magic is the first word, a torn record is never taken as valid
+    if (flash_program(addr + 4, (const uint8_t *) record + 4, sizeof(*record) - 4) != 0 ||
+        flash_program(addr, (const uint8_t *) record, 4) != 0)
+        return -1;
+
+    return 0;
+}
+
+int boot_mark_appslot_valid(void)
+{
+    volatile boot_fastboot_record_t *last;
+    boot_fastboot_record_t record = {0};
+    boot_fastboot_record_t other = {0};
+    uint32_t counter;
+    uint32_t addr;
+    int index;
+
+    last = boot_find_fastboot_record(&index);
+    counter = (last == NULL) ? 1 : last->counter + 1;
+    addr = FASTBOOT_FLASH_ADDR + index * sizeof(boot_fastboot_record_t);
+
+    // full or a torn record in the way, start the area over, it has a
+    // 16 KB sector of its own
+    if (index == BOOT_FASTBOOT_RECORDS || !flash_is_blank(addr, sizeof(record))) {
+#if BOOT_XIP
+        volatile boot_fastboot_record_t *records = (volatile boot_fastboot_record_t *) FASTBOOT_FLASH_ADDR;
+
+        // the rollback finds the other slot by its record, keep the latest
+        for (int i = index - 1; i >= 0; i--) {
+            if ((records[i].addr == SLOT1_FLASH_ADDR || records[i].addr == SLOT2_FLASH_ADDR) &&
+                records[i].addr != boot_image_addr()) {
+                memcpy(&other, (const void *) &records[i], sizeof(other));
+                break;
+            }
+        }
+#endif
+
+        if (flash_erase_range(FASTBOOT_FLASH_ADDR, FASTBOOT_FLASH_SIZE) != 0) {
+            LOG_ERROR("boot_mark_appslot_valid: erase failed");
+            return -1;
+        }
+        addr = FASTBOOT_FLASH_ADDR;
+
+        if (other.magic == BOOT_FASTBOOT_MAGIC) {
+            if (boot_program_fastboot_record(addr, &other) != 0)
+                LOG_ERROR("boot_mark_appslot_valid: other slot record lost");
+            else
+                addr += sizeof(boot_fastboot_record_t);
+        }
+    }
+
+    record.magic = BOOT_FASTBOOT_MAGIC;
+    record.crc = boot_read_config_crc();
+    record.size = boot_read_config_size();
+    record.counter = counter;
+    record.addr = boot_image_addr();
+    record.sample_crc = boot_sample_appslot(record.addr, record.size);
+    record.tally = 0xFFFFFFFF;
+    record.reserved = 0xFFFFFFFF;
+
+    if (boot_program_fastboot_record(addr, &record) != 0) {
+        LOG_ERROR("boot_mark_appslot_valid: flash failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+int boot_validate_appslot_fast(void)
+{
+#if BOOT_FASTBOOT
+    volatile boot_fastboot_record_t *record;
+    uint32_t app_addr = boot_image_addr();
+    uint32_t app_size = boot_read_config_size();
+    uint32_t app_crc = boot_read_config_crc();
+    uint32_t tally;
+    int index;
+
+    record = boot_find_fastboot_record(&index);
+
+    if (record != NULL &&
+        record->crc == app_crc &&
+        record->size == app_size &&
+        record->addr == app_addr &&
+        record->tally > (0xFFFFFFFF << BOOT_FASTBOOT_INTERVAL) &&
+        app_size > 0 && app_size <= APP_FLASH_SIZE &&
+        boot_check_app_vectors(app_addr, app_size) &&
+        boot_sample_appslot(app_addr, app_size) == record->sample_crc) {
+
+        // clear one more tally bit, once the interval is used up the
+        // next boot runs the full validation again
+        tally = record->tally << 1;
+        if (flash_program((uint32_t)(uintptr_t) &record->tally, (const uint8_t *) &tally, 4) != 0)
+            LOG_ERROR("boot_validate_appslot_fast: tally update failed");
+
+        handoff_add_flags(HANDOFF_FLAG_FASTBOOT);
+        return 0;
+    }
+
+    if (boot_validate_appslot_bin() != 0)
+        return -1;
+
+    handoff_add_flags(HANDOFF_FLAG_CRC_CHECKED);
+    boot_mark_appslot_valid();
+    return 0;
+#else
+    if (boot_validate_appslot_bin() != 0)
+        return -1;
+
+    handoff_add_flags(HANDOFF_FLAG_CRC_CHECKED);
+    return 0;
+#endif
+}
+
+int boot_rollback_appslot(void)
+{
+#if BOOT_XIP
+    volatile boot_fastboot_record_t *records = (volatile boot_fastboot_record_t *) FASTBOOT_FLASH_ADDR;
+    uint32_t active = boot_image_addr();
+    int index;
+
+    boot_find_fastboot_record(&index);
+
+    // the latest image validated in the other slot, downloads never
+    // erase the active slot so it is still there unless replaced since
+    while (index-- > 0) {
+        if ((records[index].addr != SLOT1_FLASH_ADDR && records[index].addr != SLOT2_FLASH_ADDR) ||
+            records[index].addr == active)
+            continue;
+
+        if (records[index].size == 0 || records[index].size > SLOT1_FLASH_SIZE ||
+            !boot_check_app_vectors(records[index].addr, records[index].size) ||
+            crc32_calculate_from_flash(records[index].addr, records[index].size) != records[index].crc)
+            break;
+
+        LOG_WARN("boot_rollback_appslot: booting image at %x", records[index].addr);
+        boot_rollback_addr = records[index].addr;
+
+        // the config still describes the failed image, its version is lost
+        handoff_set_reason(HANDOFF_REASON_ROLLBACK);
+        handoff_add_flags(HANDOFF_FLAG_CRC_CHECKED);
+        handoff_set_image(records[index].addr, 0, records[index].size, records[index].crc,
+                          records[index].addr == SLOT2_FLASH_ADDR ? BOOT_TEMPSLOT2 + 1 : BOOT_TEMPSLOT1 + 1);
+        return 0;
+    }
+#endif
+
+    LOG_ERROR("boot_rollback_appslot: no image to roll back to");
+    return -1;
+}
+
 int boot_validate_tempslot_bin(uint8_t slotno)
 {
     uint32_t slot_addr = boot_slots_addr[slotno];
@@ -94,14 +381,34 @@ int boot_validate_tempslot_bin(uint8_t slotno)
     uint32_t crc;
 
     if (slot_size == 0 || slot_size > SLOT1_FLASH_SIZE) {
-        SEGGER_RTT_printf(0, "boot_validate_tempslot_bin: size = %ld\r\n", slot_size);
+        LOG_ERROR("boot_validate_tempslot_bin: size = %ld", slot_size);
         return -1;
     }
 
     // Calculate the CRC
     crc = crc32_calculate_from_flash(slot_addr, slot_size);
     if (crc != slot_crc) {
-        SEGGER_RTT_printf(0, "boot_validate_tempslot_bin: crc = %ld, calc_crc = %ld\r\n", slot_crc, crc);
+        LOG_ERROR("boot_validate_tempslot_bin: crc = %ld, calc_crc = %ld", slot_crc, crc);
+        return -1;
+    }
+
+    return 0;
+}
+
+int boot_validate_tempslot_digest(void)
+{
+    uint32_t slot_size = boot_read_config_size();
+    uint32_t slot_crc = boot_read_config_crc();
+    uint32_t crc = crc32_final(&boot_tempslot_crc);
+
+    if (boot_recv_inc_global != slot_size) {
+        LOG_ERROR("boot_validate_tempslot_digest: size = %ld, recv_size = %ld",
+                  slot_size, boot_recv_inc_global);
+        return -1;
+    }
+
+    if (crc != slot_crc) {
+        LOG_ERROR("boot_validate_tempslot_digest: crc = %x, calc_crc = %x", slot_crc, crc);
         return -1;
     }
 
@@ -110,201 +417,409 @@ int boot_validate_tempslot_bin(uint8_t slotno)
 
 void boot_goto_app(void)
 {
+    uint32_t app_addr = boot_image_addr();
     func_ptr_t reset_handler;
 
-    SEGGER_RTT_printf(0, "boot_goto_app: Jumping to appslot...! \r\n");
-
-    reset_handler = (void *) *((volatile uint32_t *) (APP_FLASH_ADDR + 4));
-    __set_MSP(*((volatile uint32_t *)APP_FLASH_ADDR));
+    PROF_BEGIN(PROF_JUMP);
+    LOG_INFO("boot_goto_app: Jumping to appslot...!");
+
+    reset_handler = (void *) *((volatile uint32_t *) (app_addr + 4));
+
+    // no flash or UART interrupt may reach the vector table of the
+    // application, nor the receive DMA its RAM
+    flash_job_drain();
+    HAL_NVIC_DisableIRQ(FLASH_IRQn);
+    serial_deinit();
+
+    // the image may run from a slot, its vector table goes with it
+    SCB->VTOR = app_addr;
+    __DSB();
+    __ISB();
+    PROF_END(PROF_JUMP);
+
+    // the stack of an image linked for all of the RAM grows over the handoff
+    // block, which the application then can't read
+    if (*((volatile uint32_t *) app_addr) > HANDOFF_ADDR)
+        LOG_WARN("boot_goto_app: initial stack %x above the handoff block at %x",
+                 *((volatile uint32_t *) app_addr), HANDOFF_ADDR);
+
+    // gaps in the log the host would otherwise not notice
+    if (log_dropped_records() != 0)
+        LOG_WARN("boot_goto_app: %d log records dropped", log_dropped_records());
+
+    // last chance to read the profile, the application owns the RAM next
+    prof_dump();
+    timeline_mark(TIMELINE_JUMP);
+    timeline_dump();
+
+    // the application starts from the clock documented in clock.h, with
+    // the core on the HSI even if the restore fails half way
+    clock_apply(CLOCK_PROFILE_RESET);
+
+#if BOOT_XIP
+    handoff_add_flags(HANDOFF_FLAG_XIP);
+
+    // a rollback already described the image it picked
+    if (boot_rollback_addr == 0)
+        handoff_set_image(app_addr, boot_read_config_version(), boot_read_config_size(),
+                          boot_read_config_crc(), boot_read_config_slotno());
+#else
+    handoff_set_image(app_addr, boot_read_config_version(), boot_read_config_size(),
+                      boot_read_config_crc(), boot_read_config_slotno());
+#endif
+    handoff_seal();
+
+    __set_MSP(*((volatile uint32_t *)app_addr));
     reset_handler();
 }
 
 uint32_t boot_read_config_version(void)
 {
-    return (uint32_t) *((volatile uint32_t *) CONFIG_FLASH_ADDR);
+    return config_read()->version;
 }
 
-int boot_write_config_version(uint32_t version)
+uint32_t boot_read_config_size(void)
 {
-    HAL_StatusTypeDef ret;
+    return config_read()->size;
+}
 
-    HAL_FLASH_Unlock();
-    ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD,
-                            CONFIG_FLASH_ADDR,
-                            version);
-    HAL_FLASH_Lock();
+uint32_t boot_read_config_crc(void)
+{
+    return config_read()->crc;
+}
+
+uint32_t boot_read_config_slotno(void)
+{
+    return config_read()->slotno;
+}
+
+int boot_write_config(uint32_t version, uint32_t size, uint32_t crc, uint32_t slotno)
+{
+    config_t config;
+
+    config.version = version;
+    config.size = size;
+    config.crc = crc;
+    config.slotno = slotno + 1;
 
-    if (ret != HAL_OK) {
-        SEGGER_RTT_printf(0, "boot_write_config_version: flash failed \r\n");
+    // one record, the config never is half written
+    if (config_write(&config) != 0) {
+        LOG_ERROR("boot_write_config: flash failed");
         return -1;
     }
     return 0;
 }
 
-uint32_t boot_read_config_size(void)
+int boot_start_download(uint8_t slotno, uint32_t size)
 {
-    return (uint32_t) *((volatile uint32_t *) (CONFIG_FLASH_ADDR + 4));
-}
+    boot_recv_inc_global = 0;
+    lzss_init(&boot_lzss_decoder);
+    boot_delta_enabled = false;
+    boot_progress_enabled = false;
 
-int boot_write_config_size(uint32_t size)
-{
-    HAL_StatusTypeDef ret;
+    // a failure left by an abandoned download is stale
+    flash_job_wait();
 
-    HAL_FLASH_Unlock();
-    ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD,
-                            CONFIG_FLASH_ADDR + 4,
-                            size);
-    HAL_FLASH_Lock();
+    if (slotno != BOOT_TEMPSLOT1 && slotno != BOOT_TEMPSLOT2) {
+        LOG_ERROR("boot_start_download : wrong slotno");
+        return -1;
+    }
 
-    if (ret != HAL_OK) {
-        SEGGER_RTT_printf(0, "boot_write_config_size: flash failed \r\n");
+    // the recorded progress is gone with the slot contents
+    if (progress_close() != 0)
+        return -1;
+
+    if (size == 0 || size > SLOT1_FLASH_SIZE) {
+        LOG_ERROR("boot_start_download : size = %ld", size);
         return -1;
     }
+
     return 0;
 }
 
-uint32_t boot_read_config_crc(void)
+int boot_erase_tempslot(uint8_t slotno, uint32_t size)
 {
-    return (uint32_t) *((volatile uint32_t *) (CONFIG_FLASH_ADDR + 8));
+    // only the sectors the image is going to occupy, the erase runs in
+    // the background and the first write queues up behind it
+    return flash_job_erase_range(boot_slots_addr[slotno], size, NULL);
 }
 
-int boot_write_config_crc(uint32_t crc)
+static void boot_tempslot_done(const flash_job_t *job, int status)
 {
-    HAL_StatusTypeDef ret;
+    if (status == 0)
+        boot_tempslot_programmed += job->size;
+}
 
-    HAL_FLASH_Unlock();
-    ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD,
-                            CONFIG_FLASH_ADDR + 8,
-                            crc);
-    HAL_FLASH_Lock();
+static void boot_tempslot_open(uint32_t addr, uint32_t size)
+{
+    flash_reset_program_ops();
+    flash_job_stream_init(&boot_tempslot_stream, addr, size, boot_tempslot_done);
+    boot_tempslot_programmed = 0;
+    crc32_init(&boot_tempslot_crc);
+}
 
-    if (ret != HAL_OK) {
-        SEGGER_RTT_printf(0, "boot_write_config_crc: flash failed \r\n");
+int boot_write_bin_to_tempslot(uint8_t slotno, uint8_t *data, uint16_t size)
+{
+    if (boot_recv_inc_global == 0)
+        boot_tempslot_open(boot_slots_addr[slotno], SLOT1_FLASH_SIZE);
+
+    if (flash_job_stream_write(&boot_tempslot_stream, data, size) != 0) {
+        LOG_ERROR("boot_write_bin_to_tempslot : flash failed");
         return -1;
     }
+    crc32_update(&boot_tempslot_crc, data, size);
+    boot_recv_inc_global += size;
+
+    // only the chunks handed to the queue, their mark is programmed after them
+    if (boot_progress_enabled)
+        progress_mark(flash_job_stream_queued(&boot_tempslot_stream) - boot_slots_addr[slotno]);
+
     return 0;
 }
 
-uint32_t boot_read_config_slotno(void)
+int boot_start_progress(uint8_t slotno, uint32_t size, uint32_t crc, uint32_t flags)
 {
-    return (uint32_t) *((volatile uint32_t *) (CONFIG_FLASH_ADDR + 12));
+    progress_image_t image = {size, crc, flags, slotno};
+
+    if (progress_start(&image) != 0)
+        return -1;
+
+    boot_progress_enabled = (flags == 0);
+    return 0;
 }
 
-int boot_write_config_slotno(uint32_t slotno)
+int boot_query_progress(uint8_t slotno, uint32_t *size, uint32_t *crc, uint32_t *offset)
 {
-    HAL_StatusTypeDef ret;
+    progress_image_t image;
+
+    if (progress_query(&image, offset) != 0 || image.flags != 0 || image.slotno != slotno)
+        return -1;
 
-    HAL_FLASH_Unlock();
-    ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD,
-                            CONFIG_FLASH_ADDR + 12,
-                            slotno + 1);
-    HAL_FLASH_Lock();
+    *size = image.size;
+    *crc = image.crc;
+    return 0;
+}
 
-    if (ret != HAL_OK) {
-        SEGGER_RTT_printf(0, "boot_write_config_slotno: flash failed \r\n");
+int boot_resume_tempslot(uint8_t slotno, uint32_t size, uint32_t crc, uint32_t *offset)
+{
+    uint32_t slot_addr = boot_slots_addr[slotno];
+    uint32_t recorded_size;
+    uint32_t recorded_crc;
+
+    lzss_init(&boot_lzss_decoder);
+    boot_delta_enabled = false;
+    boot_progress_enabled = false;
+
+    // the jobs of the interrupted download land first, a failure among
+    // them leaves the slot short of what the progress may claim. Either
+    // way the flag must not fail the programming of the resume
+    if (flash_job_wait() != 0) {
+        LOG_ERROR("boot_resume_tempslot : flash failed before the resume");
+        return -1;
+    }
+
+    if (boot_query_progress(slotno, &recorded_size, &recorded_crc, offset) != 0 ||
+        recorded_size != size || recorded_crc != crc) {
+        LOG_ERROR("boot_resume_tempslot : no download of this image to resume");
         return -1;
     }
+
+    boot_tempslot_open(slot_addr + *offset, SLOT1_FLASH_SIZE - *offset);
+    crc32_update(&boot_tempslot_crc, (const uint8_t *) slot_addr, *offset);
+    boot_recv_inc_global = *offset;
+    boot_progress_enabled = true;
+
+    LOG_INFO("boot_resume_tempslot : resuming at %d of %d", *offset, size);
     return 0;
 }
 
-static int boot_erase(uint32_t sectors, uint8_t no_of_sectors)
+int boot_finish_progress(void)
 {
-    FLASH_EraseInitTypeDef erase_struct = {0};
-    uint32_t erase_status;
-    uint16_t ret;
+    boot_progress_enabled = false;
+    return progress_close();
+}
+
+static int boot_delta_sink(const uint8_t *data, uint16_t size)
+{
+    return boot_write_bin_to_tempslot(boot_lzss_slotno, (uint8_t *) data, size);
+}
 
-    erase_struct.TypeErase = FLASH_TYPEERASE_SECTORS;
-    erase_struct.Sector = sectors;
-    erase_struct.NbSectors = no_of_sectors;
-    erase_struct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+int boot_start_delta(uint32_t base_crc)
+{
+    uint32_t app_addr = boot_image_addr();
+    uint32_t app_size = boot_read_config_size();
 
-    HAL_FLASH_Unlock();
+    // the patch reads the installed image, it has to be the one the
+    // patch was made against
+    if (app_size == 0 || app_size > APP_FLASH_SIZE ||
+        crc32_calculate_from_flash(app_addr, app_size) != base_crc) {
+        LOG_ERROR("boot_start_delta : base image mismatch");
+        return -1;
+    }
 
-    ret = HAL_FLASHEx_Erase(&erase_struct, &erase_status);
+    delta_init(&boot_delta_patch, (const uint8_t *) app_addr, app_size);
+    boot_delta_enabled = true;
+    return 0;
+}
 
-    HAL_FLASH_Lock();
+int boot_write_delta_to_tempslot(uint8_t slotno, uint8_t *data, uint16_t size)
+{
+    boot_lzss_slotno = slotno;
 
-    if (ret != HAL_OK) {
-        SEGGER_RTT_printf(0, "boot_erase : erase failed \r\n");
+    if (!boot_delta_enabled ||
+        delta_apply(&boot_delta_patch, data, size, boot_delta_sink) != 0) {
+        LOG_ERROR("boot_write_delta_to_tempslot : patch failed");
         return -1;
     }
+
     return 0;
 }
 
-int boot_erase_tempslot(uint8_t slotno)
+static int boot_lzss_sink(const uint8_t *data, uint16_t size)
 {
-    uint32_t sector = 0;
+    // a compressed patch goes through the patch applier
+    if (boot_delta_enabled)
+        return boot_write_delta_to_tempslot(boot_lzss_slotno, (uint8_t *) data, size);
 
-    boot_recv_inc_global = 0;
+    return boot_write_bin_to_tempslot(boot_lzss_slotno, (uint8_t *) data, size);
+}
 
-    if (slotno != BOOT_TEMPSLOT1 && slotno != BOOT_TEMPSLOT2) {
-        SEGGER_RTT_printf(0, "boot_erase_tempslot : wrong slotno \r\n");
+int boot_write_compressed_to_tempslot(uint8_t slotno, uint8_t *data, uint16_t size)
+{
+    boot_lzss_slotno = slotno;
+
+    if (lzss_decode(&boot_lzss_decoder, data, size, boot_lzss_sink) != 0) {
+        LOG_ERROR("boot_write_compressed_to_tempslot : decode failed");
         return -1;
     }
 
-    if (slotno == BOOT_TEMPSLOT1)
-        sector = FLASH_SECTOR_17;
-    else if (slotno == BOOT_TEMPSLOT2)
-        sector = FLASH_SECTOR_19;
+    return 0;
+}
+
+int boot_flush_tempslot(void)
+{
+    // the image is only complete once the queue has drained
+    if (flash_job_stream_flush(&boot_tempslot_stream) != 0 || flash_job_wait() != 0) {
+        LOG_ERROR("boot_flush_tempslot : flash failed");
+        return -1;
+    }
 
-    return boot_erase(sector, 2);
+    LOG_INFO("boot_flush_tempslot : %d bytes, %d programmed, %d program ops",
+             boot_recv_inc_global, boot_tempslot_programmed, flash_get_program_ops());
+    return 0;
 }
 
-int boot_write_bin_to_tempslot(uint8_t slotno, uint8_t *data, uint16_t size)
+static int boot_copy_to_appslot(uint32_t app_addr, uint32_t slot_addr, uint32_t size, crc32_ctx_t *crc)
 {
-    HAL_StatusTypeDef ret;
-    uint32_t slot_addr = boot_slots_addr[slotno];
+    uint32_t verified = app_addr;
+    uint32_t chunk;
+    flash_writer_t writer;
 
-    HAL_FLASH_Unlock();
+    flash_writer_init(&writer, app_addr, size);
 
-    for (int i = 0; i < size; i++) {
+    // copy in chunks and digest what landed in the appslot right behind
+    // the writer, so the copy is verified without a second pass
+    for (uint32_t offset = 0; offset < size; offset += chunk) {
+        chunk = (size - offset < BOOT_COPY_CHUNK_SIZE) ? size - offset : BOOT_COPY_CHUNK_SIZE;
 
-        if (boot_recv_inc_global > SLOT1_FLASH_SIZE) {
-            SEGGER_RTT_printf(0, "boot_write_bin_to_tempslot : beyond the flash size\r\n");
+        if (flash_writer_write(&writer, (const uint8_t *) (slot_addr + offset), chunk) != 0 ||
+            (offset + chunk == size && flash_writer_flush(&writer) != 0)) {
+            LOG_ERROR("boot_copy_to_appslot : flash failed");
             return -1;
         }
 
-        ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE,
-                                slot_addr + boot_recv_inc_global,
-                                data[i]);
-        if (ret != HAL_OK) {
-            HAL_FLASH_Lock();
-            SEGGER_RTT_printf(0, "boot_write_bin_to_tempslot : flash failed\r\n");
-            return -1;
-        }
-        boot_recv_inc_global += 1;
+        crc32_update(crc, (const uint8_t *) verified, writer.addr - verified);
+        verified = writer.addr;
     }
 
-    HAL_FLASH_Lock();
     return 0;
 }
 
 int boot_load_bin_to_appslot(uint8_t slotno)
 {
-    HAL_StatusTypeDef ret;
     uint32_t app_addr = APP_FLASH_ADDR;
     uint32_t slot_addr = boot_slots_addr[slotno];
     uint32_t size = boot_read_config_size();
-
-    if (boot_erase(FLASH_SECTOR_5, 2) == -1) {
-        SEGGER_RTT_printf(0, "boot_load_bin_to_appslot : erase failed \r\n");
+    uint32_t app_crc = boot_read_config_crc();
+    const flash_sector_t *sector;
+    uint32_t copied = 0;
+    uint32_t unchanged = 0;
+    uint32_t span;
+    crc32_ctx_t crc;
+
+    if (size == 0 || size > APP_FLASH_SIZE) {
+        LOG_ERROR("boot_load_bin_to_appslot : size = %ld", size);
         return -1;
     }
 
-    HAL_FLASH_Unlock();
+    PROF_BEGIN(PROF_IMAGE_COPY);
+    crc32_init(&crc);
+
+    // sector by sector, the part of the image each appslot sector holds
+    for (uint32_t offset = 0; offset < size; offset += span) {
+        sector = flash_find_sector(app_addr + offset);
+        if (sector == NULL) {
+            LOG_ERROR("boot_load_bin_to_appslot : no sector at %x", app_addr + offset);
+            return -1;
+        }
+
+        span = sector->addr + sector->size - (app_addr + offset);
+        if (span > size - offset)
+            span = size - offset;
 
-    for (int i = 0; i < size; i++) {
-        ret = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE,
-                                app_addr + i,
-                                *((volatile uint32_t *)(slot_addr+i)));
-        if (ret != HAL_OK) {
-            HAL_FLASH_Lock();
-            SEGGER_RTT_printf(0, "boot_load_bin_to_appslot : flash failed \r\n");
+#if BOOT_COPY_DIFF
+        // unchanged sectors keep their flash, only the digest covers them
+        if (memcmp((const void *) (app_addr + offset), (const void *) (slot_addr + offset), span) == 0) {
+            crc32_update(&crc, (const uint8_t *) (app_addr + offset), span);
+            unchanged++;
+            continue;
+        }
+#endif
+
+        if (flash_erase_range(sector->addr, sector->size) != 0 ||
+            boot_copy_to_appslot(app_addr + offset, slot_addr + offset, span, &crc) != 0) {
+            LOG_ERROR("boot_load_bin_to_appslot : flash failed");
             return -1;
         }
+        copied++;
+    }
+
+    PROF_END(PROF_IMAGE_COPY);
+    LOG_INFO("boot_load_bin_to_appslot : %d sectors copied, %d unchanged",
+             copied, unchanged);
+
+    if (crc32_final(&crc) != app_crc) {
+        LOG_ERROR("boot_load_bin_to_appslot : crc = %x, calc_crc = %x",
+                  app_crc, crc32_final(&crc));
+        return -1;
     }
 
-    HAL_FLASH_Lock();
+    return 0;
+}
+
+int boot_install_tempslot(uint8_t slotno)
+{
+#if BOOT_XIP
+    uint32_t size = boot_read_config_size();
+
+    // runs in place, the image has to be linked for its slot
+    if (!boot_check_app_vectors(boot_slots_addr[slotno], size)) {
+        LOG_ERROR("boot_install_tempslot : image not linked for %x",
+                  boot_slots_addr[slotno]);
+        return -1;
+    }
+
+    // the digest was taken from the received packets, nothing has read
+    // the image back from flash yet and fast boot is about to trust it
+    if (boot_validate_tempslot_bin(slotno) != 0)
+        return -1;
+#else
+    if (boot_load_bin_to_appslot(slotno) != 0)
+        return -1;
+#endif
 
+    // the digest of the download, and the copy, matched the config crc
+    handoff_set_reason(HANDOFF_REASON_UPDATE);
+    handoff_add_flags(HANDOFF_FLAG_CRC_CHECKED);
     return 0;
 }
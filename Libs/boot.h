@@ -6,31 +6,113 @@
 #define BOOT_TEMPSLOT1 0
 #define BOOT_TEMPSLOT2 1
 
+/* Execute in place, images are linked for and booted from their temp
+ * slot, a download goes to the inactive slot and nothing is copied */
+#ifndef BOOT_XIP
+#define BOOT_XIP 0
+#endif
+
+/* Copies only the appslot sectors whose contents differ from the temp slot */
+#ifndef BOOT_COPY_DIFF
+#define BOOT_COPY_DIFF 1
+#endif
+
+/* How long the user button is polled for the bootloader mode (ms). The
+ * application enters it with HANDOFF_REQUEST_BOOTLOADER (see handoff.h),
+ * with 0 the button only counts when it is held at reset */
+#ifndef BOOT_BUTTON_WINDOW_MS
+#define BOOT_BUTTON_WINDOW_MS 0
+#endif
+
+/* Bytes copied and verified per step when loading the appslot */
+#define BOOT_COPY_CHUNK_SIZE 1024
+
+/* Fast boot policy, trusts the last full validation of the appslot and
+ * only checks the vector table and a sampled digest on normal boots */
+#ifndef BOOT_FASTBOOT
+#define BOOT_FASTBOOT 1
+#endif
+/* Boots between two full CRC validations (max 31) */
+#define BOOT_FASTBOOT_INTERVAL 16
+/* Sampled digest, blocks spread evenly across the image */
+#define BOOT_FASTBOOT_SAMPLES 8
+#define BOOT_FASTBOOT_SAMPLE_SIZE 256
+
 /* initialize and validates binary in specific flash address */
 int boot_init(void);
 void boot_goto_app(void);
 int boot_validate_appslot_bin(void);
 int boot_validate_tempslot_bin(uint8_t slotno);
 
+/* temp slot a download is written to */
+uint8_t boot_get_download_slot(void);
+
+/* validates the appslot using the fast boot record, falls back to the full crc */
+int boot_validate_appslot_fast(void);
+
+/* records a successful full validation of the appslot for the fast boot */
+int boot_mark_appslot_valid(void);
+
+/* with XIP, selects the last validated image of the other slot for this boot */
+int boot_rollback_appslot(void);
+
+/* validates the digest streamed while the temp slot was written */
+int boot_validate_tempslot_digest(void);
+
 /* read application header sections */
 uint32_t boot_read_config_version(void);
 uint32_t boot_read_config_size(void);
 uint32_t boot_read_config_crc(void);
 uint32_t boot_read_config_slotno(void);
 
-/* erase the slot sections */
-int boot_erase_tempslot(uint8_t slotno);
+/* resets the download state for an image of the given size */
+int boot_start_download(uint8_t slotno, uint32_t size);
 
-/* write application header sections */
-int boot_write_config_version(uint32_t version);
-int boot_write_config_size(uint32_t size);
-int boot_write_config_crc(uint32_t crc);
-int boot_write_config_slotno(uint32_t slotno);
+/* queue the erase of the slot sections the image of the given size
+ * occupies, the temp slot writes wait for it */
+int boot_erase_tempslot(uint8_t slotno, uint32_t size);
+
+/* write the application header as one config record */
+int boot_write_config(uint32_t version, uint32_t size, uint32_t crc, uint32_t slotno);
+
+/* starts the progress record of a new download, only an uncompressed
+ * stream (flags 0) is tracked and can be resumed */
+int boot_start_progress(uint8_t slotno, uint32_t size, uint32_t crc, uint32_t flags);
+
+/* interrupted uncompressed download to the given slot, its identity and
+ * the offset to resume at, -1 when there is none */
+int boot_query_progress(uint8_t slotno, uint32_t *size, uint32_t *crc, uint32_t *offset);
+
+/* continues the interrupted download of the image, the digest is rebuilt
+ * from the part already in the slot and the writes go on at offset */
+int boot_resume_tempslot(uint8_t slotno, uint32_t size, uint32_t crc, uint32_t *offset);
+
+/* the download is installed, nothing left to resume */
+int boot_finish_progress(void);
 
 /* write the application binary to respective temp slots */
 int boot_write_bin_to_tempslot(uint8_t slotno, uint8_t *data, uint16_t size);
 
-/* copy the application binary from the given temp slots to the application flash address */
+/* decompress a piece of the compressed stream into the respective temp slot */
+int boot_write_compressed_to_tempslot(uint8_t slotno, uint8_t *data, uint16_t size);
+
+/* checks the installed image against the base crc of a delta transfer,
+ * must run before the config of the new image is written */
+int boot_start_delta(uint32_t base_crc);
+
+/* apply a piece of the patch stream into the respective temp slot */
+int boot_write_delta_to_tempslot(uint8_t slotno, uint8_t *data, uint16_t size);
+
+/* program the bytes still staged by the temp slot writes and wait for
+ * the queued ones */
+int boot_flush_tempslot(void);
+
+/* copy the application binary from the given temp slots to the application flash address,
+ * the copy is checked against the config crc while it is programmed */
 int boot_load_bin_to_appslot(uint8_t slotno);
 
+/* makes the downloaded temp slot the one to boot, copies it to the appslot
+ * or, with XIP, only checks it is linked for its slot */
+int boot_install_tempslot(uint8_t slotno);
+
 #endif // BOOT_H_
@@ -0,0 +1,228 @@
+#include "clock.h"
+#include "log.h"
+
+#if (HSE_VALUE % 1000000) != 0
+#error "the HSE profile divides HSE_VALUE down to a 1 MHz PLL input"
+#endif
+
+/* PLL input at 2 MHz from the HSI and 1 MHz from the HSE, the VCO at
+ * 360 MHz in both, SYSCLK 180 MHz, APB1 45 MHz and APB2 90 MHz */
+static const clock_profile_t clock_profiles[CLOCK_PROFILES] = {
+    [CLOCK_PROFILE_RESET] = {
+        .name = "reset",
+        .pll = false,
+        .voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE3,
+        .overdrive = false,
+        .apb1_divider = RCC_HCLK_DIV1,
+        .apb2_divider = RCC_HCLK_DIV1,
+        .latency = FLASH_LATENCY_0,
+        .prefetch = true,
+        .icache = true,
+        .dcache = true,
+    },
+    [CLOCK_PROFILE_HSI_180] = {
+        .name = "hsi-180",
+        .pll = true,
+        .pll_source = RCC_PLLSOURCE_HSI,
+        .pll_m = 8,
+        .pll_n = 180,
+        .pll_p = RCC_PLLP_DIV2,
+        .pll_q = 8,
+        .voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE1,
+        .overdrive = true,
+        .apb1_divider = RCC_HCLK_DIV4,
+        .apb2_divider = RCC_HCLK_DIV2,
+        .latency = FLASH_LATENCY_5,
+        .prefetch = true,
+        .icache = true,
+        .dcache = true,
+    },
+    [CLOCK_PROFILE_HSE_180] = {
+        .name = "hse-180",
+        .pll = true,
+        .pll_source = RCC_PLLSOURCE_HSE,
+        .pll_m = HSE_VALUE / 1000000,
+        .pll_n = 360,
+        .pll_p = RCC_PLLP_DIV2,
+        .pll_q = 8,
+        .voltage_scale = PWR_REGULATOR_VOLTAGE_SCALE1,
+        .overdrive = true,
+        .apb1_divider = RCC_HCLK_DIV4,
+        .apb2_divider = RCC_HCLK_DIV2,
+        .latency = FLASH_LATENCY_5,
+        .prefetch = true,
+        .icache = true,
+        .dcache = true,
+    },
+};
+
+/* SystemClock_Config() leaves the core on the reset profile */
+static clock_profile_id_t clock_current_id = CLOCK_PROFILE_RESET;
+
+const clock_profile_t *clock_get_profile(clock_profile_id_t id)
+{
+    if (id >= CLOCK_PROFILES)
+        return NULL;
+
+    return &clock_profiles[id];
+}
+
+static uint32_t clock_apb_divider(uint32_t divider)
+{
+    switch (divider) {
+        case RCC_HCLK_DIV1: return 1;
+        case RCC_HCLK_DIV2: return 2;
+        case RCC_HCLK_DIV4: return 4;
+    }
+    return 0;
+}
+
+uint32_t clock_sysclk_hz(const clock_profile_t *profile)
+{
+    uint32_t input;
+
+    if (!profile->pll)
+        return HSI_VALUE;
+
+    if (profile->pll_m == 0 || profile->pll_p == 0)
+        return 0;
+
+    input = (profile->pll_source == RCC_PLLSOURCE_HSE) ? HSE_VALUE : HSI_VALUE;
+    return (uint32_t) ((uint64_t) input / profile->pll_m * profile->pll_n / profile->pll_p);
+}
+
+uint32_t clock_pclk1_hz(const clock_profile_t *profile)
+{
+    uint32_t divider = clock_apb_divider(profile->apb1_divider);
+
+    return divider != 0 ? clock_sysclk_hz(profile) / divider : 0;
+}
+
+uint32_t clock_pclk2_hz(const clock_profile_t *profile)
+{
+    uint32_t divider = clock_apb_divider(profile->apb2_divider);
+
+    return divider != 0 ? clock_sysclk_hz(profile) / divider : 0;
+}
+
+uint32_t clock_sysclk_max_hz(uint32_t voltage_scale, bool overdrive)
+{
+    switch (voltage_scale) {
+        case PWR_REGULATOR_VOLTAGE_SCALE1: return overdrive ? 180000000 : 168000000;
+        case PWR_REGULATOR_VOLTAGE_SCALE2: return overdrive ? 168000000 : 144000000;
+        case PWR_REGULATOR_VOLTAGE_SCALE3: return 120000000;
+    }
+    return 0;
+}
+
+uint32_t clock_min_latency(uint32_t hclk)
+{
+    return (hclk - 1) / CLOCK_HCLK_PER_WAIT_STATE;
+}
+
+static void clock_set_art(const clock_profile_t *profile)
+{
+    if (profile->prefetch)
+        __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+    else
+        __HAL_FLASH_PREFETCH_BUFFER_DISABLE();
+
+    // the caches can only be reset while disabled, stale lines of the
+    // flash programmed since they were enabled go with the reset
+    __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+    if (profile->icache)
+        __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    if (profile->dcache)
+        __HAL_FLASH_DATA_CACHE_ENABLE();
+}
+
+int clock_apply(clock_profile_id_t id)
+{
+    const clock_profile_t *profile = clock_get_profile(id);
+    RCC_OscInitTypeDef osc = {0};
+    RCC_ClkInitTypeDef clk = {0};
+
+    if (profile == NULL)
+        return -1;
+
+    // onto the HSI first, the PLL, the HSE and the regulator can only be
+    // changed while they don't clock the core. The HAL orders the wait
+    // states around the switch
+    clk.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+    clk.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+    clk.AHBCLKDivider = RCC_SYSCLK_DIV1;
+    clk.APB1CLKDivider = RCC_HCLK_DIV1;
+    clk.APB2CLKDivider = RCC_HCLK_DIV1;
+    if (HAL_RCC_ClockConfig(&clk, FLASH_LATENCY_0) != HAL_OK) {
+        LOG_ERROR("clock_apply: switch to the HSI failed");
+        return -1;
+    }
+    clock_current_id = CLOCK_PROFILE_RESET;
+
+    // also after a switch that failed half way, with the over-drive off
+    // it returns right away
+    HAL_PWREx_DisableOverDrive();
+
+    // the HAL sets the HSE before the PLL, the PLL has to stop in a call of
+    // its own while the HSE may still feed it
+    osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    osc.PLL.PLLState = RCC_PLL_OFF;
+    if (HAL_RCC_OscConfig(&osc) != HAL_OK) {
+        LOG_ERROR("clock_apply: %d pll stop failed", id);
+        return -1;
+    }
+
+    osc.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+    osc.HSEState = (profile->pll && profile->pll_source == RCC_PLLSOURCE_HSE) ? RCC_HSE_ON : RCC_HSE_OFF;
+    osc.PLL.PLLState = RCC_PLL_NONE;
+    if (HAL_RCC_OscConfig(&osc) != HAL_OK) {
+        LOG_ERROR("clock_apply: %d hse failed", id);
+        return -1;
+    }
+
+    __HAL_RCC_PWR_CLK_ENABLE();
+    __HAL_PWR_VOLTAGESCALING_CONFIG(profile->voltage_scale);
+
+    if (profile->pll) {
+        osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+        osc.PLL.PLLState = RCC_PLL_ON;
+        osc.PLL.PLLSource = profile->pll_source;
+        osc.PLL.PLLM = profile->pll_m;
+        osc.PLL.PLLN = profile->pll_n;
+        osc.PLL.PLLP = profile->pll_p;
+        osc.PLL.PLLQ = profile->pll_q;
+        if (HAL_RCC_OscConfig(&osc) != HAL_OK) {
+            LOG_ERROR("clock_apply: %d pll failed", id);
+            return -1;
+        }
+
+        // over-drive needs the PLL running and scale 1
+        if (profile->overdrive && HAL_PWREx_EnableOverDrive() != HAL_OK) {
+            LOG_ERROR("clock_apply: %d over-drive failed", id);
+            return -1;
+        }
+
+        clk.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+        clk.APB1CLKDivider = profile->apb1_divider;
+        clk.APB2CLKDivider = profile->apb2_divider;
+        if (HAL_RCC_ClockConfig(&clk, profile->latency) != HAL_OK) {
+            LOG_ERROR("clock_apply: %d switch to the pll failed", id);
+            return -1;
+        }
+    }
+
+    clock_set_art(profile);
+
+    clock_current_id = id;
+    LOG_INFO("clock_apply: %d, sysclk %d", id, clock_sysclk_hz(profile));
+    return 0;
+}
+
+clock_profile_id_t clock_current(void)
+{
+    return clock_current_id;
+}
@@ -0,0 +1,72 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include "main.h"
+
+/* Clock profiles. SystemClock_Config() leaves the core on the reset
+ * profile, the bootloader switches to BOOT_CLOCK_PROFILE for the update
+ * and validation work and goes back to the reset profile before the jump,
+ * so the application starts from the same state as without a bootloader:
+ *  - SYSCLK from the 16 MHz HSI, PLL and HSE off, all bus prescalers 1
+ *  - voltage scale 3, over-drive off, FLASH_LATENCY_0
+ *  - ART prefetch and I/D caches on, as HAL_Init() sets them */
+typedef enum {
+    CLOCK_PROFILE_RESET = 0,
+    CLOCK_PROFILE_HSI_180,      // PLL from the HSI, 180 MHz with over-drive
+    CLOCK_PROFILE_HSE_180,      // PLL from the HSE (HSE_VALUE), 180 MHz with over-drive
+    CLOCK_PROFILES
+} clock_profile_id_t;
+
+#ifndef BOOT_CLOCK_PROFILE
+#define BOOT_CLOCK_PROFILE CLOCK_PROFILE_HSI_180
+#endif
+
+/* Datasheet limits at 2.7 to 3.6 V */
+#define CLOCK_VCO_INPUT_MIN 1000000
+#define CLOCK_VCO_INPUT_MAX 2000000
+#define CLOCK_VCO_OUTPUT_MIN 100000000
+#define CLOCK_VCO_OUTPUT_MAX 432000000
+#define CLOCK_PCLK1_MAX 45000000
+#define CLOCK_PCLK2_MAX 90000000
+#define CLOCK_HCLK_PER_WAIT_STATE 30000000
+
+typedef struct {
+    const char *name;
+    bool pll;                   // SYSCLK from the PLL, otherwise from the HSI
+    uint32_t pll_source;        // RCC_PLLSOURCE_x
+    uint32_t pll_m;
+    uint32_t pll_n;
+    uint32_t pll_p;             // RCC_PLLP_DIVx
+    uint32_t pll_q;
+    uint32_t voltage_scale;     // PWR_REGULATOR_VOLTAGE_SCALEx
+    bool overdrive;
+    uint32_t apb1_divider;      // RCC_HCLK_DIVx, AHB runs undivided
+    uint32_t apb2_divider;
+    uint32_t latency;           // FLASH_LATENCY_x
+    bool prefetch;
+    bool icache;
+    bool dcache;
+} clock_profile_t;
+
+/* NULL for an unknown profile */
+const clock_profile_t *clock_get_profile(clock_profile_id_t id);
+
+/* frequencies the profile gives, 0 for a malformed profile */
+uint32_t clock_sysclk_hz(const clock_profile_t *profile);
+uint32_t clock_pclk1_hz(const clock_profile_t *profile);
+uint32_t clock_pclk2_hz(const clock_profile_t *profile);
+
+/* highest SYSCLK the regulator setting allows */
+uint32_t clock_sysclk_max_hz(uint32_t voltage_scale, bool overdrive);
+
+/* fewest flash wait states for the HCLK */
+uint32_t clock_min_latency(uint32_t hclk);
+
+/* switches the clock tree to the profile, the core passes through the HSI.
+ * On failure the core is left on the HSI */
+int clock_apply(clock_profile_id_t id);
+
+/* profile in effect */
+clock_profile_id_t clock_current(void);
+
+#endif // CLOCK_H_
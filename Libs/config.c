@@ -0,0 +1,162 @@
+#include "config.h"
+#include "partition.h"
+#include "log.h"
+
+#include "crc32.h"
+#include "flash.h"
+
+#include <stddef.h>
+
+/* Config record, appended to the active config sector on every write */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;           // bumped on every write, the highest one is the latest
+    config_t config;
+    uint32_t reserved;
+    uint32_t crc;           // over the record up to this field
+} config_record_t;
+
+#define CONFIG_MAGIC 0x43464752 // "CFGR"
+#define CONFIG_ERASED 0xFFFFFFFF
+#define CONFIG_RECORDS (CONFIG_FLASH_SIZE / sizeof(config_record_t))
+
+/* The two sectors the records are logged to, one active at a time */
+static const uint32_t config_sectors_addr[] = {
+CONFIG_FLASH_ADDR,
+CONFIG2_FLASH_ADDR
+};
+
+/* Latest record, cached so reads never walk the flash */
+static config_t config_cache;
+static uint32_t config_seq = 0;
+
+/* Active sector and its first free record */
+static uint8_t config_sector = 0;
+static uint32_t config_head = 0;
+
+static volatile config_record_t *config_record(uint8_t sector, uint32_t index)
+{
+    return (volatile config_record_t *) (config_sectors_addr[sector] + index * sizeof(config_record_t));
+}
+
+static bool config_record_valid(volatile config_record_t *record)
+{
+    return record->magic == CONFIG_MAGIC &&
+           record->crc == crc32_calculate_from_flash((uint32_t)(uintptr_t) record,
+                                                     offsetof(config_record_t, crc));
+}
+
+static uint32_t config_find_head(uint8_t sector)
+{
+    uint32_t low = 0;
+    uint32_t high = CONFIG_RECORDS;
+    uint32_t mid;
+
+    // the magic is programmed first, used records always are a prefix
+    // of the sector and the head is found by bisection
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (config_record(sector, mid)->magic != CONFIG_ERASED)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+static bool config_find_latest(uint8_t sector, uint32_t head, config_record_t *latest)
+{
+    // a torn record fails its crc, the one before it still holds
+    while (head-- > 0) {
+        if (config_record_valid(config_record(sector, head))) {
+            memcpy(latest, (const void *) config_record(sector, head), sizeof(config_record_t));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int config_init(void)
+{
+    config_record_t latest = {0};
+    config_record_t record;
+    config_t legacy;
+    bool found = false;
+    uint32_t head;
+
+    memset(&config_cache, 0xFF, sizeof(config_cache));
+    config_seq = 0;
+    config_sector = 0;
+    config_head = config_find_head(0);
+
+    for (uint8_t sector = 0; sector < 2; sector++) {
+        head = config_find_head(sector);
+
+        if (config_find_latest(sector, head, &record) && (!found || record.seq > latest.seq)) {
+            latest = record;
+            config_sector = sector;
+            config_head = head;
+            found = true;
+        }
+    }
+
+    if (found) {
+        config_cache = latest.config;
+        config_seq = latest.seq;
+        return 0;
+    }
+
+    // carry over the config words of the older fixed offset layout
+    memcpy(&legacy, (const void *) LEGACY_CONFIG_FLASH_ADDR, sizeof(legacy));
+    if (legacy.size != CONFIG_ERASED) {
+        LOG_WARN("config_init: importing the legacy config");
+        return config_write(&legacy);
+    }
+
+    return 0;
+}
+
+const config_t *config_read(void)
+{
+    return &config_cache;
+}
+
+int config_write(const config_t *config)
+{
+    config_record_t record;
+    uint32_t addr;
+
+    record.magic = CONFIG_MAGIC;
+    record.seq = config_seq + 1;
+    record.config = *config;
+    record.reserved = CONFIG_ERASED;
+    record.crc = crc32_calculate_from_memory((uint8_t *) &record, offsetof(config_record_t, crc));
+
+    // full, continue in the other sector, the latest record stays in this
+    // one until the new record is in place
+    if (config_head == CONFIG_RECORDS) {
+        if (flash_erase_range(config_sectors_addr[!config_sector], CONFIG_FLASH_SIZE) != 0) {
+            LOG_ERROR("config_write: erase failed");
+            return -1;
+        }
+        config_sector = !config_sector;
+        config_head = 0;
+    }
+
+    addr = (uint32_t)(uintptr_t) config_record(config_sector, config_head);
+    config_head++;
+
+    // magic first, it claims the record even when the rest gets torn
+    if (flash_program(addr, (const uint8_t *) &record, 4) != 0 ||
+        flash_program(addr + 4, (const uint8_t *) &record + 4, sizeof(record) - 4) != 0 ||
+        !config_record_valid((volatile config_record_t *)(uintptr_t) addr)) {
+        LOG_ERROR("config_write: flash failed");
+        return -1;
+    }
+
+    config_cache = *config;
+    config_seq = record.seq;
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include "main.h"
+
+/* Application config, fields never written read as erased flash */
+typedef struct {
+    uint32_t version;
+    uint32_t size;
+    uint32_t crc;
+    uint32_t slotno;
+} config_t;
+
+/* locates the latest valid record, to be called before any other access */
+int config_init(void);
+
+/* latest config, served from RAM */
+const config_t *config_read(void);
+
+/* appends the config as a new record, moves to the other sector when full */
+int config_write(const config_t *config);
+
+#endif // CONFIG_H_
@@ -3,32 +3,97 @@
 // MPEG-2 CRC32 polynomial
 #define MPEG2_CRC32_POLYNOMIAL 0x04C11DB7
 
-// Function to calculate CRC32 from the flash address
-uint32_t crc32_calculate_from_flash(uint32_t addr, size_t length) {
-    uint32_t crc = 0xFFFFFFFF;
+#if CRC32_IMPL == CRC32_IMPL_SLICE8
+#define CRC32_TABLE_ROWS 8
+#elif CRC32_IMPL == CRC32_IMPL_SLICE4
+#define CRC32_TABLE_ROWS 4
+#else
+#define CRC32_TABLE_ROWS 1
+#endif
+
+#if CRC32_IMPL != CRC32_IMPL_BITWISE
+#include "crc32_table.h"
+#endif
+
+// Loads 4 bytes in transmission order, first byte in the MSB
+#define CRC32_LOAD_BE(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+                          ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
 
+static uint32_t crc32_engine(uint32_t crc, const uint8_t *data, size_t length)
+{
+#if CRC32_IMPL == CRC32_IMPL_BITWISE
     for (size_t i = 0; i < length; i++) {
-        crc ^= *((volatile uint32_t *)(addr + i)) << 24;
+        crc ^= (uint32_t)data[i] << 24;
 
         for (int j = 0; j < 8; j++) {
             crc = (crc << 1) ^ ((crc & 0x80000000) ? MPEG2_CRC32_POLYNOMIAL : 0);
         }
     }
+#else
+#if CRC32_IMPL == CRC32_IMPL_SLICE8
+    while (length >= 8) {
+        crc ^= CRC32_LOAD_BE(data);
+        crc = crc32_table[7][crc >> 24] ^
+              crc32_table[6][(crc >> 16) & 0xFF] ^
+              crc32_table[5][(crc >> 8) & 0xFF] ^
+              crc32_table[4][crc & 0xFF] ^
+              crc32_table[3][data[4]] ^
+              crc32_table[2][data[5]] ^
+              crc32_table[1][data[6]] ^
+              crc32_table[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+#elif CRC32_IMPL == CRC32_IMPL_SLICE4
+    while (length >= 4) {
+        crc ^= CRC32_LOAD_BE(data);
+        crc = crc32_table[3][crc >> 24] ^
+              crc32_table[2][(crc >> 16) & 0xFF] ^
+              crc32_table[1][(crc >> 8) & 0xFF] ^
+              crc32_table[0][crc & 0xFF];
+        data += 4;
+        length -= 4;
+    }
+#endif
+    // remaining bytes, one table lookup per byte
+    while (length--) {
+        crc = (crc << 8) ^ crc32_table[0][(crc >> 24) ^ *data++];
+    }
+#endif
 
     return crc;
 }
 
-// Function to calculate CRC32 from the memory
-uint32_t crc32_calculate_from_memory(uint8_t *data, size_t length) {
-    uint32_t crc = 0xFFFFFFFF;
+void crc32_init(crc32_ctx_t *ctx)
+{
+    ctx->crc = 0xFFFFFFFF;
+}
 
-    for (size_t i = 0; i < length; i++) {
-        crc ^= data[i] << 24;
+void crc32_update(crc32_ctx_t *ctx, const uint8_t *data, size_t length)
+{
+    ctx->crc = crc32_engine(ctx->crc, data, length);
+}
 
-        for (int j = 0; j < 8; j++) {
-            crc = (crc << 1) ^ ((crc & 0x80000000) ? MPEG2_CRC32_POLYNOMIAL : 0);
-        }
-    }
+uint32_t crc32_final(crc32_ctx_t *ctx)
+{
+    // MPEG-2 variant has no final xor
+    return ctx->crc;
+}
 
-    return crc;
+// Function to calculate CRC32 from the flash address
+uint32_t crc32_calculate_from_flash(uint32_t addr, size_t length) {
+    crc32_ctx_t ctx;
+
+    crc32_init(&ctx);
+    crc32_update(&ctx, (const uint8_t *)(uintptr_t) addr, length);
+    return crc32_final(&ctx);
+}
+
+// Function to calculate CRC32 from the memory
+uint32_t crc32_calculate_from_memory(uint8_t *data, size_t length) {
+    crc32_ctx_t ctx;
+
+    crc32_init(&ctx);
+    crc32_update(&ctx, data, length);
+    return crc32_final(&ctx);
 }
@@ -1,8 +1,30 @@
 #ifndef CRC32_H_
 #define CRC32_H_
 
-#include "main.h"
+#include <stdint.h>
+#include <stddef.h>
 
+/* CRC engine variants, selected at build time with CRC32_IMPL */
+#define CRC32_IMPL_BITWISE 0    // 8 shift/xor steps per byte, no table
+#define CRC32_IMPL_TABLE 1      // one lookup per byte, 1 KB table
+#define CRC32_IMPL_SLICE4 4     // slicing-by-4, 4 KB table
+#define CRC32_IMPL_SLICE8 8     // slicing-by-8, 8 KB table
+
+#ifndef CRC32_IMPL
+#define CRC32_IMPL CRC32_IMPL_TABLE
+#endif
+
+/* running CRC of a byte stream */
+typedef struct {
+    uint32_t crc;
+} crc32_ctx_t;
+
+/* incremental calculation, for data that arrives in pieces */
+void crc32_init(crc32_ctx_t *ctx);
+void crc32_update(crc32_ctx_t *ctx, const uint8_t *data, size_t length);
+uint32_t crc32_final(crc32_ctx_t *ctx);
+
+/* one-shot calculation */
 uint32_t crc32_calculate_from_flash(uint32_t addr, size_t length);
 uint32_t crc32_calculate_from_memory(uint8_t *data, size_t length);
 
@@ -0,0 +1,80 @@
+#include "delta.h"
+
+#include <string.h>
+
+static int delta_flush(delta_patch_t *patch, delta_sink_t sink)
+{
+    int ret = 0;
+
+    if (patch->output_len > 0)
+        ret = sink(patch->output, patch->output_len);
+
+    patch->output_len = 0;
+    return ret;
+}
+
+static int delta_emit(delta_patch_t *patch, uint8_t byte, delta_sink_t sink)
+{
+    patch->output[patch->output_len++] = byte;
+
+    if (patch->output_len == DELTA_OUTPUT_SIZE)
+        return delta_flush(patch, sink);
+
+    return 0;
+}
+
+void delta_init(delta_patch_t *patch, const uint8_t *old, uint32_t old_size)
+{
+    patch->old = old;
+    patch->old_size = old_size;
+    patch->old_pos = 0;
+    patch->diff_len = 0;
+    patch->extra_len = 0;
+    patch->seek = 0;
+    patch->control_len = 0;
+    patch->output_len = 0;
+}
+
+int delta_apply(delta_patch_t *patch, const uint8_t *data, size_t size, delta_sink_t sink)
+{
+    int64_t old_pos;
+
+    while (size > 0) {
+
+        if (patch->diff_len > 0) {
+            if (patch->old_pos >= patch->old_size)
+                return -1;
+            if (delta_emit(patch, patch->old[patch->old_pos++] + *data, sink) != 0)
+                return -1;
+            patch->diff_len--;
+        } else if (patch->extra_len > 0) {
+            if (delta_emit(patch, *data, sink) != 0)
+                return -1;
+            patch->extra_len--;
+        } else {
+            // collect the next control record
+            patch->control[patch->control_len++] = *data;
+            if (patch->control_len == DELTA_CONTROL_SIZE) {
+                memcpy(&patch->diff_len, patch->control + 0, 4);
+                memcpy(&patch->extra_len, patch->control + 4, 4);
+                memcpy(&patch->seek, patch->control + 8, 4);
+                patch->control_len = 0;
+            }
+        }
+
+        data++;
+        size--;
+
+        // the seek moves the old position once the payload is complete
+        if (patch->control_len == 0 && patch->diff_len == 0 &&
+            patch->extra_len == 0 && patch->seek != 0) {
+            old_pos = (int64_t) patch->old_pos + patch->seek;
+            if (old_pos < 0 || old_pos > patch->old_size)
+                return -1;
+            patch->old_pos = (uint32_t) old_pos;
+            patch->seek = 0;
+        }
+    }
+
+    return delta_flush(patch, sink);
+}
@@ -0,0 +1,39 @@
+#ifndef DELTA_H_
+#define DELTA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Streaming patch applier for the delta transfer. The patch is a list of
+ * bsdiff style control records, each followed by its payload:
+ *  | DIFF_LEN | EXTRA_LEN | SEEK | DIFF bytes | EXTRA bytes |
+ *  |    4     |     4     |  4   |  DIFF_LEN  |  EXTRA_LEN  |
+ * DIFF bytes are added to the old image bytes, EXTRA bytes are copied as
+ * they are, then SEEK (signed) moves the position in the old image. */
+
+#define DELTA_CONTROL_SIZE 12
+#define DELTA_OUTPUT_SIZE 256
+
+/* receives the rebuilt image bytes */
+typedef int (*delta_sink_t) (const uint8_t *data, uint16_t size);
+
+typedef struct {
+    const uint8_t *old;                 // base image, read in place
+    uint32_t old_size;
+    uint32_t old_pos;
+    uint32_t diff_len;                  // bytes left in the current record
+    uint32_t extra_len;
+    int32_t seek;
+    uint8_t control[DELTA_CONTROL_SIZE];
+    uint8_t control_len;
+    uint8_t output[DELTA_OUTPUT_SIZE];
+    uint16_t output_len;
+} delta_patch_t;
+
+void delta_init(delta_patch_t *patch, const uint8_t *old, uint32_t old_size);
+
+/* applies a piece of the patch stream, the pieces can be split at any
+ * byte, returns -1 on a corrupted patch or when the sink fails */
+int delta_apply(delta_patch_t *patch, const uint8_t *data, size_t size, delta_sink_t sink);
+
+#endif // DELTA_H_
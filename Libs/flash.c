@@ -0,0 +1,245 @@
+#include "flash.h"
+#include "flash_job.h"
+#include "log.h"
+
+#include "prof.h"
+
+/* Counts the program operations issued to the flash interface */
+static uint32_t flash_program_ops = 0;
+
+/* STM32F429 2 MB dual bank sector geometry, both banks are
+ * 4 x 16 KB, 1 x 64 KB and 7 x 128 KB */
+static const flash_sector_t flash_sectors[] = {
+    {0x08000000,  16 * 1024, FLASH_SECTOR_0},
+    {0x08004000,  16 * 1024, FLASH_SECTOR_1},
+    {0x08008000,  16 * 1024, FLASH_SECTOR_2},
+    {0x0800C000,  16 * 1024, FLASH_SECTOR_3},
+    {0x08010000,  64 * 1024, FLASH_SECTOR_4},
+    {0x08020000, 128 * 1024, FLASH_SECTOR_5},
+    {0x08040000, 128 * 1024, FLASH_SECTOR_6},
+    {0x08060000, 128 * 1024, FLASH_SECTOR_7},
+    {0x08080000, 128 * 1024, FLASH_SECTOR_8},
+    {0x080A0000, 128 * 1024, FLASH_SECTOR_9},
+    {0x080C0000, 128 * 1024, FLASH_SECTOR_10},
+    {0x080E0000, 128 * 1024, FLASH_SECTOR_11},
+    {0x08100000,  16 * 1024, FLASH_SECTOR_12},
+    {0x08104000,  16 * 1024, FLASH_SECTOR_13},
+    {0x08108000,  16 * 1024, FLASH_SECTOR_14},
+    {0x0810C000,  16 * 1024, FLASH_SECTOR_15},
+    {0x08110000,  64 * 1024, FLASH_SECTOR_16},
+    {0x08120000, 128 * 1024, FLASH_SECTOR_17},
+    {0x08140000, 128 * 1024, FLASH_SECTOR_18},
+    {0x08160000, 128 * 1024, FLASH_SECTOR_19},
+    {0x08180000, 128 * 1024, FLASH_SECTOR_20},
+    {0x081A0000, 128 * 1024, FLASH_SECTOR_21},
+    {0x081C0000, 128 * 1024, FLASH_SECTOR_22},
+    {0x081E0000, 128 * 1024, FLASH_SECTOR_23},
+};
+
+#define FLASH_SECTORS (sizeof(flash_sectors) / sizeof(flash_sectors[0]))
+
+static int flash_program_unit(uint32_t addr, uint32_t type, uint64_t value)
+{
+    HAL_StatusTypeDef ret;
+
+    PROF_BEGIN(PROF_FLASH_PROGRAM);
+    ret = HAL_FLASH_Program(type, addr, value);
+    PROF_END(PROF_FLASH_PROGRAM);
+    flash_program_ops++;
+
+    if (ret != HAL_OK) {
+        LOG_ERROR("flash_program_unit: flash failed at %x", addr);
+        return -1;
+    }
+    return 0;
+}
+
+static int flash_program_stage(flash_writer_t *writer)
+{
+    uint64_t value = 0;
+
+    memcpy(&value, writer->stage, FLASH_PROG_WIDTH);
+    if (flash_program_unit(writer->addr, FLASH_PROG_TYPE, value) != 0)
+        return -1;
+
+    writer->addr += FLASH_PROG_WIDTH;
+    writer->staged = 0;
+    return 0;
+}
+
+void flash_writer_init(flash_writer_t *writer, uint32_t addr, uint32_t size)
+{
+    writer->addr = addr;
+    writer->end = addr + size;
+    writer->staged = 0;
+}
+
+int flash_writer_write(flash_writer_t *writer, const uint8_t *data, uint32_t size)
+{
+    uint64_t value = 0;
+    int ret = 0;
+
+    if (writer->addr + writer->staged + size > writer->end) {
+        LOG_ERROR("flash_writer_write: beyond the flash region");
+        return -1;
+    }
+
+    // the flash interface runs one operation at a time
+    flash_job_drain();
+    HAL_FLASH_Unlock();
+
+    while (size > 0 && ret == 0) {
+
+        if (writer->staged == 0 && (writer->addr % FLASH_PROG_WIDTH) != 0) {
+            // unaligned head, program byte wise till the unit boundary
+            ret = flash_program_unit(writer->addr, FLASH_TYPEPROGRAM_BYTE, *data);
+            writer->addr += 1;
+            data += 1;
+            size -= 1;
+        } else if (writer->staged == 0 && size >= FLASH_PROG_WIDTH) {
+            // aligned, program directly from the source buffer
+            memcpy(&value, data, FLASH_PROG_WIDTH);
+            ret = flash_program_unit(writer->addr, FLASH_PROG_TYPE, value);
+            writer->addr += FLASH_PROG_WIDTH;
+            data += FLASH_PROG_WIDTH;
+            size -= FLASH_PROG_WIDTH;
+        } else {
+            // partial unit, stage it until the rest of the unit arrives
+            writer->stage[writer->staged++] = *data;
+            data += 1;
+            size -= 1;
+            if (writer->staged == FLASH_PROG_WIDTH)
+                ret = flash_program_stage(writer);
+        }
+    }
+
+    HAL_FLASH_Lock();
+    return ret;
+}
+
+int flash_writer_flush(flash_writer_t *writer)
+{
+    int ret = 0;
+
+    if (writer->staged == 0)
+        return 0;
+
+    flash_job_drain();
+    HAL_FLASH_Unlock();
+
+    // unaligned tail, program the staged bytes individually
+    for (int i = 0; i < writer->staged && ret == 0; i++)
+        ret = flash_program_unit(writer->addr + i, FLASH_TYPEPROGRAM_BYTE, writer->stage[i]);
+
+    HAL_FLASH_Lock();
+
+    writer->addr += writer->staged;
+    writer->staged = 0;
+    return ret;
+}
+
+const flash_sector_t *flash_find_sector(uint32_t addr)
+{
+    for (int i = 0; i < FLASH_SECTORS; i++) {
+        if (addr >= flash_sectors[i].addr && addr - flash_sectors[i].addr < flash_sectors[i].size)
+            return &flash_sectors[i];
+    }
+
+    return NULL;
+}
+
+bool flash_is_blank(uint32_t addr, uint32_t size)
+{
+    const volatile uint32_t *word = (const volatile uint32_t *) addr;
+
+    // regions are sector aligned, no partial words to care about
+    for (uint32_t i = 0; i < size / 4; i++) {
+        if (word[i] != 0xFFFFFFFF)
+            return false;
+    }
+
+    return true;
+}
+
+static int flash_erase_sector(const flash_sector_t *sector)
+{
+    FLASH_EraseInitTypeDef erase_struct = {0};
+    uint32_t erase_status;
+    HAL_StatusTypeDef ret;
+
+    erase_struct.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase_struct.Sector = sector->number;
+    erase_struct.NbSectors = 1;
+    erase_struct.VoltageRange = FLASH_PROG_VOLTAGE_RANGE;
+
+    flash_job_drain();
+
+    PROF_BEGIN(PROF_FLASH_ERASE);
+    HAL_FLASH_Unlock();
+    ret = HAL_FLASHEx_Erase(&erase_struct, &erase_status);
+    HAL_FLASH_Lock();
+    PROF_END(PROF_FLASH_ERASE);
+
+    if (ret != HAL_OK) {
+        LOG_ERROR("flash_erase_sector: erase failed at %x", sector->addr);
+        return -1;
+    }
+    return 0;
+}
+
+int flash_erase_range(uint32_t addr, uint32_t size)
+{
+    const flash_sector_t *sector;
+    uint32_t end = addr + size;
+    uint32_t erased = 0;
+    uint32_t blank = 0;
+
+    // only the sectors the region touches, a sector erase takes seconds
+    while (addr < end) {
+        sector = flash_find_sector(addr);
+        if (sector == NULL) {
+            LOG_ERROR("flash_erase_range: %x outside of the flash", addr);
+            return -1;
+        }
+
+        if (flash_is_blank(sector->addr, sector->size)) {
+            blank++;
+        } else {
+            if (flash_erase_sector(sector) != 0)
+                return -1;
+            erased++;
+        }
+
+        addr = sector->addr + sector->size;
+    }
+
+    LOG_INFO("flash_erase_range: %d sectors erased, %d already blank", erased, blank);
+    return 0;
+}
+
+int flash_program(uint32_t addr, const uint8_t *data, uint32_t size)
+{
+    flash_writer_t writer;
+
+    flash_writer_init(&writer, addr, size);
+
+    if (flash_writer_write(&writer, data, size) != 0)
+        return -1;
+
+    return flash_writer_flush(&writer);
+}
+
+uint32_t flash_get_program_ops(void)
+{
+    return flash_program_ops;
+}
+
+void flash_reset_program_ops(void)
+{
+    flash_program_ops = 0;
+}
+
+void flash_count_program_op(void)
+{
+    flash_program_ops++;
+}
@@ -0,0 +1,66 @@
+#ifndef FLASH_H_
+#define FLASH_H_
+
+#include "main.h"
+
+/* Device operating voltage range, it limits the widest parallelism the
+ * flash interface accepts for a single program operation */
+#ifndef FLASH_PROG_VOLTAGE_RANGE
+#define FLASH_PROG_VOLTAGE_RANGE FLASH_VOLTAGE_RANGE_3
+#endif
+
+#if FLASH_PROG_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_1
+#define FLASH_PROG_TYPE FLASH_TYPEPROGRAM_BYTE
+#define FLASH_PROG_WIDTH 1
+#elif FLASH_PROG_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_2
+#define FLASH_PROG_TYPE FLASH_TYPEPROGRAM_HALFWORD
+#define FLASH_PROG_WIDTH 2
+#elif FLASH_PROG_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_3
+#define FLASH_PROG_TYPE FLASH_TYPEPROGRAM_WORD
+#define FLASH_PROG_WIDTH 4
+#else
+#define FLASH_PROG_TYPE FLASH_TYPEPROGRAM_DOUBLEWORD
+#define FLASH_PROG_WIDTH 8
+#endif
+
+/* Sequential flash writer, stages the incoming bytes until a full
+ * program unit is available */
+typedef struct {
+    uint32_t addr;                      // address of the first staged byte
+    uint32_t end;                       // end of the writable region
+    uint8_t stage[FLASH_PROG_WIDTH];
+    uint8_t staged;
+} flash_writer_t;
+
+/* writer to program a region sequentially, in the widest units possible */
+void flash_writer_init(flash_writer_t *writer, uint32_t addr, uint32_t size);
+int flash_writer_write(flash_writer_t *writer, const uint8_t *data, uint32_t size);
+int flash_writer_flush(flash_writer_t *writer);
+
+/* Flash sector of the device geometry */
+typedef struct {
+    uint32_t addr;
+    uint32_t size;
+    uint32_t number;                    // FLASH_SECTOR_x
+} flash_sector_t;
+
+/* sector holding the address, NULL outside of the flash */
+const flash_sector_t *flash_find_sector(uint32_t addr);
+
+/* true when every word of the region reads erased */
+bool flash_is_blank(uint32_t addr, uint32_t size);
+
+/* erase the sectors the region touches, sectors already blank are skipped */
+int flash_erase_range(uint32_t addr, uint32_t size);
+
+/* program a buffer into the erased flash in one go */
+int flash_program(uint32_t addr, const uint8_t *data, uint32_t size);
+
+/* number of program operations issued to the flash interface */
+uint32_t flash_get_program_ops(void);
+void flash_reset_program_ops(void);
+
+/* counts an operation issued outside of this module, see flash_job.c */
+void flash_count_program_op(void);
+
+#endif // FLASH_H_
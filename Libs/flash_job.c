@@ -0,0 +1,299 @@
+#include "flash_job.h"
+#include "log.h"
+
+#include "prof.h"
+
+static flash_job_t flash_job_queue[FLASH_JOB_QUEUE_SIZE];
+
+/* Oldest job, the one running, and the number of queued jobs */
+static volatile uint32_t flash_job_head = 0;
+static volatile uint32_t flash_job_count = 0;
+
+/* Set while an operation is in progress, the flash is unlocked */
+static volatile bool flash_job_running = false;
+
+/* Bytes of the head job programmed and the width of the running operation */
+static uint32_t flash_job_pos = 0;
+static uint32_t flash_job_unit = 0;
+
+/* Outcome of the running operation, set by the HAL callbacks */
+static volatile bool flash_job_eop = false;
+static volatile bool flash_job_error = false;
+
+/* A job failed since the last flash_job_wait() */
+static volatile bool flash_job_failed = false;
+
+#if PROF_ENABLE
+static uint32_t flash_job_started;
+#endif
+
+void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue)
+{
+    (void) ReturnValue;
+    flash_job_eop = true;
+}
+
+void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue)
+{
+    (void) ReturnValue;
+    flash_job_error = true;
+}
+
+static HAL_StatusTypeDef flash_job_start(const flash_job_t *job)
+{
+    FLASH_EraseInitTypeDef erase_struct = {0};
+    uint32_t addr = job->addr + flash_job_pos;
+    uint64_t value = 0;
+
+    flash_job_eop = false;
+    flash_job_error = false;
+
+    if (job->type == FLASH_JOB_ERASE) {
+        erase_struct.TypeErase = FLASH_TYPEERASE_SECTORS;
+        erase_struct.Sector = job->sector;
+        erase_struct.NbSectors = 1;
+        erase_struct.VoltageRange = FLASH_PROG_VOLTAGE_RANGE;
+
+#if PROF_ENABLE
+        flash_job_started = prof_now();
+#endif
+        return HAL_FLASHEx_Erase_IT(&erase_struct);
+    }
+
+    // unaligned head and tail byte wise, the rest in the widest units
+    if ((addr % FLASH_PROG_WIDTH) != 0 || job->size - flash_job_pos < FLASH_PROG_WIDTH) {
+        flash_job_unit = 1;
+        return HAL_FLASH_Program_IT(FLASH_TYPEPROGRAM_BYTE, addr, job->data[flash_job_pos]);
+    }
+
+    memcpy(&value, job->data + flash_job_pos, FLASH_PROG_WIDTH);
+    flash_job_unit = FLASH_PROG_WIDTH;
+    return HAL_FLASH_Program_IT(FLASH_PROG_TYPE, addr, value);
+}
+
+static void flash_job_complete(int status)
+{
+    flash_job_t *job = &flash_job_queue[flash_job_head];
+
+    if (status != 0 && !flash_job_failed) {
+        LOG_ERROR("flash_job_complete: job %d failed at %x", job->type, job->addr + flash_job_pos);
+        flash_job_failed = true;
+    }
+
+    if (job->callback != NULL)
+        job->callback(job, status);
+
+    flash_job_pos = 0;
+    flash_job_head = (flash_job_head + 1) % FLASH_JOB_QUEUE_SIZE;
+    flash_job_count--;
+}
+
+/* starts the next operation, from the interrupt or with it masked */
+static void flash_job_run(void)
+{
+    while (flash_job_count > 0) {
+        // a failed job cancels the ones queued behind it, a progress mark
+        // must not outlive the data it stands for
+        if (flash_job_failed) {
+            flash_job_complete(-1);
+            continue;
+        }
+        if (flash_job_start(&flash_job_queue[flash_job_head]) == HAL_OK)
+            return;
+        flash_job_complete(-1);
+    }
+
+    HAL_FLASH_Lock();
+    flash_job_running = false;
+}
+
+void flash_job_init(void)
+{
+    HAL_NVIC_SetPriority(FLASH_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+static flash_job_t *flash_job_reserve(void)
+{
+    // the interrupt frees the entries, the one past the queued jobs is
+    // ours until it is submitted
+    while (flash_job_count == FLASH_JOB_QUEUE_SIZE)
+        __WFI();
+
+    return &flash_job_queue[(flash_job_head + flash_job_count) % FLASH_JOB_QUEUE_SIZE];
+}
+
+static void flash_job_submit(void)
+{
+    HAL_NVIC_DisableIRQ(FLASH_IRQn);
+
+    flash_job_count++;
+    if (!flash_job_running) {
+        flash_job_running = true;
+        HAL_FLASH_Unlock();
+        flash_job_run();
+    }
+
+    HAL_NVIC_EnableIRQ(FLASH_IRQn);
+}
+
+int flash_job_program(uint32_t addr, const uint8_t *data, uint32_t size, flash_job_callback_t callback)
+{
+    flash_job_t *job;
+
+    // once a job failed the image is lost, stop queueing more of it
+    if (flash_job_failed || size == 0 || size > FLASH_JOB_DATA_SIZE)
+        return -1;
+
+    job = flash_job_reserve();
+    job->type = FLASH_JOB_PROGRAM;
+    job->addr = addr;
+    job->size = size;
+    job->callback = callback;
+    memcpy(job->data, data, size);
+
+    flash_job_submit();
+    return 0;
+}
+
+int flash_job_erase_range(uint32_t addr, uint32_t size, flash_job_callback_t callback)
+{
+    const flash_sector_t *sector;
+    flash_job_t *job;
+    uint32_t end = addr + size;
+    uint32_t queued = 0;
+    uint32_t blank = 0;
+
+    if (flash_job_failed)
+        return -1;
+
+    while (addr < end) {
+        sector = flash_find_sector(addr);
+        if (sector == NULL) {
+            LOG_ERROR("flash_job_erase_range: %x outside of the flash", addr);
+            return -1;
+        }
+
+        if (flash_is_blank(sector->addr, sector->size)) {
+            blank++;
+        } else {
+            job = flash_job_reserve();
+            job->type = FLASH_JOB_ERASE;
+            job->addr = sector->addr;
+            job->size = sector->size;
+            job->sector = sector->number;
+            job->callback = callback;
+            flash_job_submit();
+            queued++;
+        }
+
+        addr = sector->addr + sector->size;
+    }
+
+    LOG_INFO("flash_job_erase_range: %d sectors queued, %d already blank", queued, blank);
+    return 0;
+}
+
+bool flash_job_busy(void)
+{
+    return flash_job_running;
+}
+
+void flash_job_drain(void)
+{
+    while (flash_job_running)
+        __WFI();
+}
+
+int flash_job_wait(void)
+{
+    bool failed;
+
+    flash_job_drain();
+
+    failed = flash_job_failed;
+    flash_job_failed = false;
+    return failed ? -1 : 0;
+}
+
+void flash_job_stream_init(flash_job_stream_t *stream, uint32_t addr, uint32_t size,
+                           flash_job_callback_t callback)
+{
+    stream->addr = addr;
+    stream->end = addr + size;
+    stream->fill = 0;
+    stream->callback = callback;
+}
+
+int flash_job_stream_write(flash_job_stream_t *stream, const uint8_t *data, uint32_t size)
+{
+    uint32_t chunk;
+
+    if (stream->addr + stream->fill + size > stream->end) {
+        LOG_ERROR("flash_job_stream_write: beyond the flash region");
+        return -1;
+    }
+
+    while (size > 0) {
+        chunk = FLASH_JOB_DATA_SIZE - stream->fill;
+        if (chunk > size)
+            chunk = size;
+
+        memcpy(stream->block + stream->fill, data, chunk);
+        stream->fill += chunk;
+        data += chunk;
+        size -= chunk;
+
+        if (stream->fill == FLASH_JOB_DATA_SIZE && flash_job_stream_flush(stream) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int flash_job_stream_flush(flash_job_stream_t *stream)
+{
+    if (stream->fill == 0)
+        return 0;
+
+    if (flash_job_program(stream->addr, stream->block, stream->fill, stream->callback) != 0)
+        return -1;
+
+    stream->addr += stream->fill;
+    stream->fill = 0;
+    return 0;
+}
+
+uint32_t flash_job_stream_queued(const flash_job_stream_t *stream)
+{
+    return stream->addr;
+}
+
+void flash_job_irq_handler(void)
+{
+    const flash_job_t *job;
+
+    HAL_FLASH_IRQHandler();
+
+    // the HAL releases the flash after its callbacks, the next operation
+    // can only be started from here
+    if (!flash_job_running || (!flash_job_eop && !flash_job_error))
+        return;
+
+    job = &flash_job_queue[flash_job_head];
+    if (flash_job_error) {
+        flash_job_complete(-1);
+    } else if (job->type == FLASH_JOB_ERASE) {
+#if PROF_ENABLE
+        prof_record(PROF_FLASH_ERASE, prof_now() - flash_job_started);
+#endif
+        flash_job_complete(0);
+    } else {
+        flash_count_program_op();
+        flash_job_pos += flash_job_unit;
+        if (flash_job_pos == job->size)
+            flash_job_complete(0);
+    }
+
+    flash_job_run();
+}
@@ -0,0 +1,78 @@
+#ifndef FLASH_JOB_H_
+#define FLASH_JOB_H_
+
+#include "main.h"
+#include "flash.h"
+
+/* Interrupt driven flash programming. Erase and program jobs are queued
+ * and run one after the other from the flash end of operation interrupt,
+ * the core keeps receiving and checking packets meanwhile. The synchronous
+ * functions of flash.h wait for the queue to drain first. */
+#define FLASH_JOB_QUEUE_SIZE 8
+
+/* Data of a program job, copied on submission */
+#define FLASH_JOB_DATA_SIZE 1024
+
+typedef enum {
+    FLASH_JOB_PROGRAM = 0,
+    FLASH_JOB_ERASE
+} flash_job_type_t;
+
+typedef struct flash_job flash_job_t;
+
+/* completion callback, runs in the flash interrupt, status 0 or -1 */
+typedef void (*flash_job_callback_t)(const flash_job_t *job, int status);
+
+struct flash_job {
+    flash_job_type_t type;
+    uint32_t addr;
+    uint32_t size;
+    uint32_t sector;                    // FLASH_SECTOR_x of an erase
+    flash_job_callback_t callback;      // NULL for none
+    uint8_t data[FLASH_JOB_DATA_SIZE];
+};
+
+/* Sequential writer on top of the queue, collects the data into job sized
+ * blocks, the buffer of the caller is free again on return */
+typedef struct {
+    uint32_t addr;                      // address of the block being collected
+    uint32_t end;                       // end of the writable region
+    uint32_t fill;
+    flash_job_callback_t callback;
+    uint8_t block[FLASH_JOB_DATA_SIZE];
+} flash_job_stream_t;
+
+/* enables the flash interrupt */
+void flash_job_init(void);
+
+/* queue a program of up to FLASH_JOB_DATA_SIZE bytes, waits for a free
+ * entry when the queue is full */
+int flash_job_program(uint32_t addr, const uint8_t *data, uint32_t size, flash_job_callback_t callback);
+
+/* queue the erase of the sectors the region touches, sectors already
+ * blank are skipped */
+int flash_job_erase_range(uint32_t addr, uint32_t size, flash_job_callback_t callback);
+
+/* true while jobs are queued or running */
+bool flash_job_busy(void);
+
+/* waits until the queue is empty */
+void flash_job_drain(void);
+
+/* drains the queue, -1 when a job failed since the last call */
+int flash_job_wait(void);
+
+void flash_job_stream_init(flash_job_stream_t *stream, uint32_t addr, uint32_t size,
+                           flash_job_callback_t callback);
+int flash_job_stream_write(flash_job_stream_t *stream, const uint8_t *data, uint32_t size);
+
+/* queues the block collected so far */
+int flash_job_stream_flush(flash_job_stream_t *stream);
+
+/* end of the data handed to the queue, everything below is queued */
+uint32_t flash_job_stream_queued(const flash_job_stream_t *stream);
+
+/* end of operation and error interrupt, called from FLASH_IRQHandler */
+void flash_job_irq_handler(void);
+
+#endif // FLASH_JOB_H_
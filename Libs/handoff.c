@@ -0,0 +1,94 @@
+#include "handoff.h"
+#include "main.h"
+
+#include "crc32.h"
+
+#ifdef HOST_SIM
+#include <time.h>
+#endif
+
+/* At HANDOFF_ADDR, the linker script places the section first in NOINIT */
+handoff_t handoff_block __attribute__((section(".noinit.handoff")));
+
+/* At HANDOFF_REQUEST_ADDR, the end of NOINIT */
+volatile handoff_request_t handoff_request_word __attribute__((section(".handoff_request")));
+
+/* End of the last phase */
+static uint32_t handoff_last_us = 0;
+
+static uint32_t handoff_now_us(void)
+{
+#ifdef HOST_SIM
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000000ULL + now.tv_nsec / 1000);
+#else
+    uint32_t tick;
+    uint32_t val;
+
+    // the millisecond tick and the SysTick count down within it, both
+    // follow the clock profile switches
+    do {
+        tick = HAL_GetTick();
+        val = SysTick->VAL;
+    } while (tick != HAL_GetTick());
+
+    return tick * 1000 + (SysTick->LOAD - val) * 1000 / (SysTick->LOAD + 1);
+#endif
+}
+
+void handoff_init(void)
+{
+    memset(&handoff_block, 0, sizeof(handoff_block));
+    handoff_block.reset_flags = RCC->CSR;
+    handoff_last_us = handoff_now_us();
+}
+
+uint32_t handoff_take_request(void)
+{
+    uint32_t request = handoff_request_word.request;
+
+    if (handoff_request_word.check != ~request)
+        request = HANDOFF_REQUEST_NONE;
+
+    handoff_request_word.request = HANDOFF_REQUEST_NONE;
+    handoff_request_word.check = 0;
+    return request;
+}
+
+void handoff_phase(handoff_phase_t phase)
+{
+    uint32_t now = handoff_now_us();
+
+    handoff_block.phase_us[phase] += now - handoff_last_us;
+    handoff_last_us = now;
+}
+
+void handoff_set_reason(handoff_reason_t reason)
+{
+    handoff_block.reason = reason;
+}
+
+void handoff_add_flags(uint32_t flags)
+{
+    handoff_block.flags |= flags;
+}
+
+void handoff_set_image(uint32_t addr, uint32_t version, uint32_t size, uint32_t crc, uint32_t slot)
+{
+    handoff_block.image_addr = addr;
+    handoff_block.image_version = version;
+    handoff_block.image_size = size;
+    handoff_block.image_crc = crc;
+    handoff_block.slot = slot;
+}
+
+void handoff_seal(void)
+{
+    handoff_block.magic = HANDOFF_MAGIC;
+    handoff_block.version = HANDOFF_VERSION;
+    handoff_block.size = sizeof(handoff_t);
+    handoff_block.crc = crc32_calculate_from_memory((uint8_t *) &handoff_block,
+                                                    offsetof(handoff_t, crc));
+}
@@ -0,0 +1,142 @@
+#ifndef HANDOFF_H_
+#define HANDOFF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Bootloader to application handoff. Just before the jump the bootloader
+ * fills a block at the start of the NOINIT RAM region (see
+ * STM32F429ZITx_FLASH.ld) with what it checked on this boot, so the
+ * application can skip the same work. The application has to keep
+ * HANDOFF_REGION_SIZE bytes at HANDOFF_ADDR out of its own RAM, e.g.
+ *   RAM (xrw) : ORIGIN = 0x20000000, LENGTH = 191K
+ * and reads the block with handoff_get() before anything could overwrite
+ * it. This header only needs the C library, applications can copy it. */
+#define HANDOFF_ADDR 0x2002FC00
+#define HANDOFF_REGION_SIZE 0x400
+
+#define HANDOFF_MAGIC 0x46464F48 // "HOFF"
+
+/* Bumped when fields are added, they only ever go at the end (before the
+ * crc), an application accepts any version at least as high as its own */
+#define HANDOFF_VERSION 1
+
+/* Why the image was booted */
+typedef enum {
+    HANDOFF_REASON_NORMAL = 0,      // the installed image passed validation
+    HANDOFF_REASON_UPDATE,          // a download was installed on this boot
+    HANDOFF_REASON_ROLLBACK         // XIP, the active image failed, booting the previous one
+} handoff_reason_t;
+
+/* How the image was checked on this boot */
+#define HANDOFF_FLAG_CRC_CHECKED (1U << 0)  // CRC32-MPEG2 of the whole image matched image_crc
+#define HANDOFF_FLAG_FASTBOOT (1U << 1)     // vectors and sampled digest only, see BOOT_FASTBOOT
+#define HANDOFF_FLAG_XIP (1U << 2)          // the image runs in place from its slot
+
+/* Boot phases, timed from HAL_Init() in microseconds */
+typedef enum {
+    HANDOFF_PHASE_INIT = 0,         // clock and peripheral setup
+    HANDOFF_PHASE_WAIT,             // bootloader mode button window
+    HANDOFF_PHASE_VALIDATE,         // image validation on a normal boot
+    HANDOFF_PHASE_DOWNLOAD,         // bootloader mode until the download completed
+    HANDOFF_PHASE_INSTALL,          // digest check and copy to the appslot
+    HANDOFF_PHASES
+} handoff_phase_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;               // HANDOFF_VERSION of the bootloader
+    uint16_t size;                  // bytes of the block, the crc included
+    uint32_t reason;                // handoff_reason_t
+    uint32_t flags;                 // HANDOFF_FLAG_x
+    uint32_t image_version;         // config version, major in the low byte, 0 after a rollback
+    uint32_t image_size;
+    uint32_t image_crc;             // CRC32-MPEG2 of the image
+    uint32_t image_addr;            // vector table of the image
+    uint32_t slot;                  // temp slot the image was downloaded to, 1 or 2
+    uint32_t reset_flags;           // RCC_CSR as found at reset, the flags are not cleared
+    uint32_t phase_us[HANDOFF_PHASES];  // 0 for the phases not run
+    uint32_t crc;                   // CRC32-MPEG2 of the block before it
+} handoff_t;
+
+/* the block is complete and its crc matches */
+static inline int handoff_check(const handoff_t *handoff)
+{
+    const uint8_t *data = (const uint8_t *) handoff;
+    uint32_t crc = 0xFFFFFFFF;
+
+    if (handoff->magic != HANDOFF_MAGIC || handoff->version < HANDOFF_VERSION ||
+        handoff->size < sizeof(handoff_t) || handoff->size > HANDOFF_REGION_SIZE)
+        return 0;
+
+    // bitwise, the block is small and the application may not have the
+    // table of the bootloader's engine
+    for (uint32_t i = 0; i < handoff->size - 4U; i++) {
+        crc ^= (uint32_t) data[i] << 24;
+        for (int j = 0; j < 8; j++)
+            crc = (crc << 1) ^ ((crc & 0x80000000) ? 0x04C11DB7 : 0);
+    }
+
+    return crc == *(const uint32_t *) (data + handoff->size - 4U);
+}
+
+/* the block, NULL when the bootloader didn't leave a valid one */
+static inline const handoff_t *handoff_get(void)
+{
+    const handoff_t *handoff = (const handoff_t *) HANDOFF_ADDR;
+
+    return handoff_check(handoff) ? handoff : NULL;
+}
+
+/* Application to bootloader request, the other direction. The last 8 bytes
+ * of the region hold a request and its complement, the application sets
+ * them and resets, e.g.
+ *   handoff_request(HANDOFF_REQUEST_BOOTLOADER);
+ *   NVIC_SystemReset();
+ * and the bootloader takes the request before anything else, so a normal
+ * boot doesn't have to wait for the user button. RAM keeps its content
+ * across resets, what a power up leaves fails the complement */
+#define HANDOFF_REQUEST_ADDR (HANDOFF_ADDR + HANDOFF_REGION_SIZE - 8)
+
+#define HANDOFF_REQUEST_NONE 0
+#define HANDOFF_REQUEST_BOOTLOADER 0x52444C42   // "BLDR", stay in the bootloader mode
+
+typedef struct {
+    uint32_t request;
+    uint32_t check;                 // ~request
+} handoff_request_t;
+
+static inline void handoff_request(uint32_t request)
+{
+    volatile handoff_request_t *word = (volatile handoff_request_t *) HANDOFF_REQUEST_ADDR;
+
+    word->request = request;
+    word->check = ~request;
+}
+
+/* Bootloader side */
+
+extern handoff_t handoff_block;
+
+/* clears the block left by the previous boot and starts the phase timing */
+void handoff_init(void);
+
+/* the phase ends now, it started where the previous one ended */
+void handoff_phase(handoff_phase_t phase);
+
+void handoff_set_reason(handoff_reason_t reason);
+void handoff_add_flags(uint32_t flags);
+
+/* the image about to be booted */
+void handoff_set_image(uint32_t addr, uint32_t version, uint32_t size, uint32_t crc, uint32_t slot);
+
+/* protects the block with its crc, the last step before the jump */
+void handoff_seal(void);
+
+extern volatile handoff_request_t handoff_request_word;
+
+/* the request the application left, HANDOFF_REQUEST_NONE if there is none.
+ * It is cleared, the next reset boots normally again */
+uint32_t handoff_take_request(void);
+
+#endif // HANDOFF_H_
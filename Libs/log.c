@@ -0,0 +1,39 @@
+#include "log.h"
+#include "SEGGER_RTT.h"
+
+#include <string.h>
+
+#define LOG_RECORD_HEADER_SIZE 3
+
+static uint8_t log_rtt_buffer[LOG_RTT_BUFFER_SIZE];
+
+/* Records dropped because the host didn't drain the buffer in time */
+static uint32_t log_dropped = 0;
+
+void log_init(void)
+{
+    SEGGER_RTT_ConfigUpBuffer(LOG_RTT_BUFFER, "log", log_rtt_buffer, sizeof(log_rtt_buffer),
+                              SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+}
+
+void log_write(uint8_t level, uint32_t id, const uint32_t *args, uint32_t nargs)
+{
+    uint8_t record[LOG_RECORD_HEADER_SIZE + 4 * LOG_MAX_ARGS];
+
+    if (nargs > LOG_MAX_ARGS)
+        nargs = LOG_MAX_ARGS;
+
+    record[0] = (level << 4) | nargs;
+    record[1] = id & 0xFF;
+    record[2] = (id >> 8) & 0xFF;
+    memcpy(record + LOG_RECORD_HEADER_SIZE, args, 4 * nargs);
+
+    // skip mode writes the whole record or nothing, the stream stays in step
+    if (SEGGER_RTT_Write(LOG_RTT_BUFFER, record, LOG_RECORD_HEADER_SIZE + 4 * nargs) == 0)
+        log_dropped++;
+}
+
+uint32_t log_dropped_records(void)
+{
+    return log_dropped;
+}
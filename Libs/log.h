@@ -0,0 +1,85 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdint.h>
+
+/* Binary log, a call writes the id of its format string and its raw
+ * arguments to an RTT up buffer and the host expands them. The format
+ * strings go to the log_fmt section, which the linker keeps in the ELF
+ * but not in flash, and their offset in that section is the id.
+ * Utils/log_decode.py reads them back from the ELF.
+ *
+ * Arguments are 32 bit integers, at most LOG_MAX_ARGS of them. */
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+/* Calls above this level are compiled out */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/* RTT up buffer of the log records, 1 carries the profile dumps */
+#define LOG_RTT_BUFFER 2
+#define LOG_RTT_BUFFER_SIZE 1024
+
+#define LOG_MAX_ARGS 4
+
+/* Record format, little endian
+ *  | LEVEL/NARGS | ID | ARGS      |
+ *  |      1      |  2 | 4 x NARGS |
+ *
+ *  - LEVEL/NARGS | level in the high nibble, argument count in the low one
+ *  - ID          | offset of the format string in log_fmt */
+
+#ifdef HOST_SIM
+extern const char __start_log_fmt[];
+#define LOG_FMT_BASE ((uint32_t) (uintptr_t) __start_log_fmt)
+#else
+#define LOG_FMT_BASE 0xF0000000     // log_fmt origin in the linker script
+#endif
+
+#define LOG_MSG(level, fmt, ...) do { \
+    static const char log_fmt_[] __attribute__((section("log_fmt"), used)) = fmt; \
+    const uint32_t log_args_[] = {0, ##__VA_ARGS__}; \
+    log_write(level, (uint32_t) (uintptr_t) log_fmt_ - LOG_FMT_BASE, log_args_ + 1, \
+              sizeof(log_args_) / sizeof(log_args_[0]) - 1); \
+} while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...) LOG_MSG(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...) LOG_MSG(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...) LOG_MSG(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) do { } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...) LOG_MSG(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) do { } while (0)
+#endif
+
+/* sets up the RTT up buffer */
+void log_init(void);
+
+/* writes one record, dropped whole when the buffer is full */
+void log_write(uint8_t level, uint32_t id, const uint32_t *args, uint32_t nargs);
+
+/* records dropped so far because the host didn't drain the buffer in time */
+uint32_t log_dropped_records(void);
+
+#endif // LOG_H_
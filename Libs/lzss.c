@@ -0,0 +1,113 @@
+#include "lzss.h"
+
+#include <string.h>
+
+// Bitstream
+//  LITERAL  | 1 | BYTE (8)                                       |
+//  BACKREF  | 0 | DISTANCE - 1 (WINDOW_BITS) | COUNT - 1 (LOOKAHEAD_BITS) |
+
+enum lzss_state_t {
+LZSS_STATE_TAG,
+LZSS_STATE_LITERAL,
+LZSS_STATE_INDEX,
+LZSS_STATE_COUNT
+};
+
+static int lzss_get_bits(lzss_decoder_t *decoder, uint8_t count,
+                         const uint8_t **data, size_t *size)
+{
+    int value;
+
+    while (decoder->nbits < count) {
+        if (*size == 0)
+            return -1;
+
+        decoder->bits = (decoder->bits << 8) | **data;
+        decoder->nbits += 8;
+        (*data)++;
+        (*size)--;
+    }
+
+    decoder->nbits -= count;
+    value = (decoder->bits >> decoder->nbits) & ((1 << count) - 1);
+    return value;
+}
+
+static int lzss_flush(lzss_decoder_t *decoder, lzss_sink_t sink)
+{
+    int ret = 0;
+
+    if (decoder->head > decoder->flushed)
+        ret = sink(decoder->window + decoder->flushed, decoder->head - decoder->flushed);
+
+    decoder->flushed = decoder->head;
+    return ret;
+}
+
+static int lzss_emit(lzss_decoder_t *decoder, uint8_t byte, lzss_sink_t sink)
+{
+    decoder->window[decoder->head++] = byte;
+
+    // the window doubles as the output buffer, hand it over before it wraps
+    if (decoder->head == LZSS_WINDOW_SIZE) {
+        if (lzss_flush(decoder, sink) != 0)
+            return -1;
+        decoder->head = 0;
+        decoder->flushed = 0;
+    }
+    return 0;
+}
+
+void lzss_init(lzss_decoder_t *decoder)
+{
+    memset(decoder->window, 0, sizeof(decoder->window));
+    decoder->head = 0;
+    decoder->flushed = 0;
+    decoder->bits = 0;
+    decoder->nbits = 0;
+    decoder->state = LZSS_STATE_TAG;
+    decoder->index = 0;
+}
+
+int lzss_decode(lzss_decoder_t *decoder, const uint8_t *data, size_t size, lzss_sink_t sink)
+{
+    int value;
+
+    // runs until the piece can't complete the next field
+    while (1) {
+        switch (decoder->state) {
+            case LZSS_STATE_TAG:
+                value = lzss_get_bits(decoder, 1, &data, &size);
+                if (value < 0)
+                    return lzss_flush(decoder, sink);
+                decoder->state = value ? LZSS_STATE_LITERAL : LZSS_STATE_INDEX;
+                break;
+            case LZSS_STATE_LITERAL:
+                value = lzss_get_bits(decoder, 8, &data, &size);
+                if (value < 0)
+                    return lzss_flush(decoder, sink);
+                if (lzss_emit(decoder, value, sink) != 0)
+                    return -1;
+                decoder->state = LZSS_STATE_TAG;
+                break;
+            case LZSS_STATE_INDEX:
+                value = lzss_get_bits(decoder, LZSS_WINDOW_BITS, &data, &size);
+                if (value < 0)
+                    return lzss_flush(decoder, sink);
+                decoder->index = value + 1;
+                decoder->state = LZSS_STATE_COUNT;
+                break;
+            case LZSS_STATE_COUNT:
+                value = lzss_get_bits(decoder, LZSS_LOOKAHEAD_BITS, &data, &size);
+                if (value < 0)
+                    return lzss_flush(decoder, sink);
+                for (int i = 0; i <= value; i++) {
+                    uint16_t from = (decoder->head - decoder->index) & (LZSS_WINDOW_SIZE - 1);
+                    if (lzss_emit(decoder, decoder->window[from], sink) != 0)
+                        return -1;
+                }
+                decoder->state = LZSS_STATE_TAG;
+                break;
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef LZSS_H_
+#define LZSS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Streaming LZSS decoder for the compressed transfer, the bitstream is the
+ * heatshrink one with a 2^LZSS_WINDOW_BITS byte window and back references
+ * of up to 2^LZSS_LOOKAHEAD_BITS bytes. Host and target must agree on both. */
+#define LZSS_WINDOW_BITS 10
+#define LZSS_LOOKAHEAD_BITS 5
+
+#define LZSS_WINDOW_SIZE (1 << LZSS_WINDOW_BITS)
+
+/* receives the decoded bytes, at most LZSS_WINDOW_SIZE per call */
+typedef int (*lzss_sink_t) (const uint8_t *data, uint16_t size);
+
+typedef struct {
+    uint8_t window[LZSS_WINDOW_SIZE];   // last decoded bytes
+    uint16_t head;                      // next write position in the window
+    uint16_t flushed;                   // window bytes handed to the sink
+    uint32_t bits;                      // bit accumulator, msb first
+    uint8_t nbits;
+    uint8_t state;
+    uint16_t index;                     // distance of the pending back reference
+} lzss_decoder_t;
+
+void lzss_init(lzss_decoder_t *decoder);
+
+/* decodes a piece of the compressed stream, the pieces can be split at
+ * any byte, returns -1 when the sink fails */
+int lzss_decode(lzss_decoder_t *decoder, const uint8_t *data, size_t size, lzss_sink_t sink);
+
+#endif // LZSS_H_
@@ -2,8 +2,17 @@
 #define PARTITION_H_
 
 
-#define CONFIG_FLASH_ADDR (0x08010000) // sector 4
-#define CONFIG_FLASH_SIZE (16)
+#define CONFIG_FLASH_ADDR (0x08100000) // sector 12
+#define CONFIG2_FLASH_ADDR (0x08104000) // sector 13
+#define CONFIG_FLASH_SIZE (16 * 1024)  // per sector
+
+#define PROGRESS_FLASH_ADDR (0x08108000) // sector 14
+#define PROGRESS_FLASH_SIZE (16 * 1024)
+
+#define FASTBOOT_FLASH_ADDR (0x0810C000) // sector 15
+#define FASTBOOT_FLASH_SIZE (16 * 1024)
+
+#define LEGACY_CONFIG_FLASH_ADDR (0x08010000) // sector 4, fixed offset words
 
 #define APP_FLASH_ADDR (0x08020000) // sector 5, 6
 #define APP_FLASH_SIZE (256 * 1024)
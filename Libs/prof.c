@@ -0,0 +1,99 @@
+#include "prof.h"
+#include "SEGGER_RTT.h"
+
+#include "crc32.h"
+#include "log.h"
+
+#ifdef HOST_SIM
+#include <time.h>
+#endif
+
+#define PROF_DUMP_HEADER_SIZE 12
+#define PROF_DUMP_REGION_SIZE 20
+#define PROF_DUMP_SIZE (PROF_DUMP_HEADER_SIZE + PROF_DUMP_REGION_SIZE * PROF_REGIONS + 4)
+
+static prof_stats_t prof_table[PROF_REGIONS];
+
+static uint8_t prof_rtt_buffer[PROF_RTT_BUFFER_SIZE];
+
+#ifdef HOST_SIM
+uint32_t prof_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+static uint32_t prof_frequency(void)
+{
+    return 1000000000;
+}
+#else
+static uint32_t prof_frequency(void)
+{
+    return SystemCoreClock;
+}
+#endif
+
+void prof_init(void)
+{
+    for (int i = 0; i < PROF_REGIONS; i++) {
+        prof_table[i].count = 0;
+        prof_table[i].min = 0xFFFFFFFF;
+        prof_table[i].max = 0;
+        prof_table[i].total = 0;
+    }
+
+#if PROF_ENABLE && !defined(HOST_SIM)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    SEGGER_RTT_ConfigUpBuffer(PROF_RTT_BUFFER, "prof", prof_rtt_buffer, sizeof(prof_rtt_buffer),
+                              SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+}
+
+void prof_record(prof_region_t region, uint32_t ticks)
+{
+    prof_stats_t *stats = &prof_table[region];
+
+    stats->count++;
+    stats->total += ticks;
+    if (ticks < stats->min)
+        stats->min = ticks;
+    if (ticks > stats->max)
+        stats->max = ticks;
+}
+
+void prof_dump(void)
+{
+    uint8_t dump[PROF_DUMP_SIZE] = {0};
+    uint8_t *pos = dump + PROF_DUMP_HEADER_SIZE;
+    uint32_t magic = PROF_DUMP_MAGIC;
+    uint32_t freq = prof_frequency();
+    uint32_t min;
+    uint32_t crc;
+
+    memcpy(dump, &magic, 4);
+    memcpy(dump + 4, &freq, 4);
+    dump[8] = PROF_REGIONS;
+
+    for (int i = 0; i < PROF_REGIONS; i++) {
+        // regions never entered report a zero min
+        min = prof_table[i].count ? prof_table[i].min : 0;
+
+        memcpy(pos, &prof_table[i].count, 4);
+        memcpy(pos + 4, &min, 4);
+        memcpy(pos + 8, &prof_table[i].max, 4);
+        memcpy(pos + 12, &prof_table[i].total, 8);
+        pos += PROF_DUMP_REGION_SIZE;
+    }
+
+    crc = crc32_calculate_from_memory(dump, pos - dump);
+    memcpy(pos, &crc, 4);
+
+    // skip mode writes the whole dump or nothing
+    if (SEGGER_RTT_Write(PROF_RTT_BUFFER, dump, sizeof(dump)) == 0)
+        LOG_WARN("prof_dump: rtt buffer full");
+}
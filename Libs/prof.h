@@ -0,0 +1,76 @@
+#ifndef PROF_H_
+#define PROF_H_
+
+#include "main.h"
+
+/* Cycle counter profiling of the hot paths, every region keeps its count,
+ * min, max and total in a static table that is dumped over an RTT up
+ * buffer. Disabled builds compile the region markers away. */
+#ifndef PROF_ENABLE
+#define PROF_ENABLE 1
+#endif
+
+/* RTT up buffer of the binary dumps, terminal 0 keeps the text log */
+#define PROF_RTT_BUFFER 1
+#define PROF_RTT_BUFFER_SIZE 256
+
+/* Dump format, little endian
+ *  | MAGIC | FREQ | REGIONS | RESERVED | REGION STATS ...  | CRC |
+ *  |   4   |   4  |    1    |     3    | 20 x REGIONS      |  4  |
+ *
+ *  - MAGIC  | "PRF1"
+ *  - FREQ   | counter ticks per second
+ *  - REGION | COUNT 4 | MIN 4 | MAX 4 | TOTAL 8
+ *  - CRC    | CRC32-MPEG2 of everything before it */
+#define PROF_DUMP_MAGIC 0x31465250
+
+/* Region ids, Utils/prof_decode.py names them in the same order */
+typedef enum {
+    PROF_UART_RX = 0,       // packet payload reception
+    PROF_PACKET_CRC,        // packet crc check
+    PROF_FLASH_PROGRAM,     // one program operation
+    PROF_FLASH_ERASE,       // one sector erase
+    PROF_IMAGE_VALIDATE,    // appslot validation on a normal boot
+    PROF_IMAGE_COPY,        // tempslot to appslot copy
+    PROF_JUMP,              // hand over to the application
+    PROF_REGIONS
+} prof_region_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} prof_stats_t;
+
+#if PROF_ENABLE
+
+#ifdef HOST_SIM
+/* nanoseconds of the host monotonic clock */
+uint32_t prof_now(void);
+#else
+static inline uint32_t prof_now(void)
+{
+    return DWT->CYCCNT;
+}
+#endif
+
+#define PROF_BEGIN(region) uint32_t prof_start_##region = prof_now()
+#define PROF_END(region) prof_record(region, prof_now() - prof_start_##region)
+
+#else
+
+#define PROF_BEGIN(region) do { } while (0)
+#define PROF_END(region) do { } while (0)
+
+#endif
+
+/* starts the cycle counter and sets up the RTT up buffer */
+void prof_init(void);
+
+void prof_record(prof_region_t region, uint32_t ticks);
+
+/* writes the table to the RTT up buffer, nothing if it doesn't fit */
+void prof_dump(void);
+
+#endif // PROF_H_
@@ -0,0 +1,121 @@
+#include "progress.h"
+#include "partition.h"
+#include "log.h"
+
+#include "flash.h"
+#include "flash_job.h"
+
+#define PROGRESS_MAGIC 0x474F5250 // "PROG"
+#define PROGRESS_ERASED 0xFFFFFFFF
+#define PROGRESS_CHUNKS (SLOT1_FLASH_SIZE / PROGRESS_CHUNK_SIZE)
+#define PROGRESS_WORDS (PROGRESS_CHUNKS / 32)
+
+/* Progress record at the start of the progress sector, written once per
+ * download and then only ever has bits cleared */
+typedef struct {
+    uint32_t magic;             // programmed after the identity
+    progress_image_t image;
+    uint32_t open;              // erased while the download runs, cleared when done
+    uint32_t reserved[2];
+    uint32_t done[PROGRESS_WORDS];  // bit n cleared once chunk n is programmed
+} progress_record_t;
+
+static volatile progress_record_t *const progress_record = (volatile progress_record_t *) PROGRESS_FLASH_ADDR;
+
+/* Chunks recorded so far, the marks still queued included */
+static uint32_t progress_chunks = 0;
+
+static uint32_t progress_word(uint32_t chunks, uint32_t i)
+{
+    if (chunks >= 32 * (i + 1))
+        return 0;
+    if (chunks <= 32 * i)
+        return 0xFFFFFFFF;
+    return 0xFFFFFFFF << (chunks - 32 * i);
+}
+
+static int progress_program(volatile uint32_t *word, uint32_t value)
+{
+    return flash_program((uint32_t)(uintptr_t) word, (const uint8_t *) &value, 4);
+}
+
+int progress_start(const progress_image_t *image)
+{
+    if (flash_erase_range(PROGRESS_FLASH_ADDR, sizeof(progress_record_t)) != 0 ||
+        flash_program((uint32_t)(uintptr_t) &progress_record->image, (const uint8_t *) image,
+                      sizeof(progress_image_t)) != 0 ||
+        progress_program(&progress_record->magic, PROGRESS_MAGIC) != 0) {
+        LOG_ERROR("progress_start: flash failed");
+        return -1;
+    }
+
+    progress_chunks = 0;
+    return 0;
+}
+
+int progress_mark(uint32_t offset)
+{
+    uint32_t chunks = offset / PROGRESS_CHUNK_SIZE;
+    uint32_t value;
+
+    if (chunks > PROGRESS_CHUNKS)
+        chunks = PROGRESS_CHUNKS;
+    if (chunks <= progress_chunks)
+        return 0;
+
+    // the image is programmed in order, the done chunks are the low bits.
+    // The marks go through the job queue behind the data they stand for
+    for (uint32_t i = progress_chunks / 32; i < PROGRESS_WORDS && chunks > 32 * i; i++) {
+        value = progress_word(chunks, i);
+        if (value == progress_word(progress_chunks, i))
+            continue;
+
+        if (flash_job_program((uint32_t)(uintptr_t) &progress_record->done[i],
+                              (const uint8_t *) &value, 4, NULL) != 0) {
+            LOG_ERROR("progress_mark: flash failed");
+            return -1;
+        }
+    }
+
+    progress_chunks = chunks;
+    return 0;
+}
+
+int progress_close(void)
+{
+    if (progress_record->magic != PROGRESS_MAGIC || progress_record->open != PROGRESS_ERASED)
+        return 0;
+
+    return progress_program(&progress_record->open, 0);
+}
+
+int progress_query(progress_image_t *image, uint32_t *offset)
+{
+    uint32_t chunks = 0;
+    uint32_t word;
+
+    if (progress_record->magic != PROGRESS_MAGIC || progress_record->open != PROGRESS_ERASED)
+        return -1;
+
+    memcpy(image, (const void *) &progress_record->image, sizeof(progress_image_t));
+
+    // done chunks up to the first one still set
+    for (uint32_t i = 0; i < PROGRESS_WORDS; i++) {
+        word = progress_record->done[i];
+        if (word == 0) {
+            chunks += 32;
+            continue;
+        }
+        while ((word & 1) == 0) {
+            word >>= 1;
+            chunks++;
+        }
+        break;
+    }
+
+    progress_chunks = chunks;
+    *offset = chunks * PROGRESS_CHUNK_SIZE;
+    if (*offset > image->size)
+        *offset = image->size;
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+#include "main.h"
+
+/* Download progress, persisted so an interrupted download resumes where it
+ * stopped. The record holds the identity of the image (CONF size, crc and
+ * flags) and the temp slot, followed by a bitmap of the programmed chunks. */
+#define PROGRESS_CHUNK_SIZE 1024
+
+/* identity of the download the record belongs to */
+typedef struct {
+    uint32_t size;
+    uint32_t crc;
+    uint32_t flags;
+    uint32_t slotno;
+} progress_image_t;
+
+/* erases the previous record and starts one for a new download */
+int progress_start(const progress_image_t *image);
+
+/* records that the image is programmed up to offset, queued behind the
+ * data jobs up to offset */
+int progress_mark(uint32_t offset);
+
+/* closes the record, the download completed or its slot is erased */
+int progress_close(void);
+
+/* unfinished download, -1 when there is none, otherwise its identity and
+ * the offset it is programmed up to */
+int progress_query(progress_image_t *image, uint32_t *offset);
+
+#endif // PROGRESS_H_
@@ -1,8 +1,9 @@
 #include "proto.h"
-#include "SEGGER_RTT.h"
+#include "log.h"
 
 #include "crc32.h"
-#include "usart.h"
+#include "serial.h"
+#include "prof.h"
 // Simple Bootloader Protocol
 //
 //  Packet Format
@@ -28,8 +29,15 @@
 //  CONF
 //  - To know firmware version, size & crc for the firmware
 //  that it to be downloaded.
-//  | VERSION | SIZE | CRC |
-//  |    4    |   4  |  4  |
+//  | VERSION | SIZE | CRC | FLAGS (optional) | BASE CRC (optional) |
+//  |    4    |   4  |  4  |        4         |          4          |
+//  - FLAGS
+//    - COMPRESSED | 0x01, DATA carries the LZSS stream of the image,
+//    SIZE and CRC are the ones of the decompressed image.
+//    - DELTA      | 0x02, DATA carries a patch against the installed
+//    image, whose CRC must match BASE CRC.
+//    - RESUME     | 0x04, continues the interrupted download of the same
+//    image from the offset PROG reported, nothing is erased.
 //  RESP
 //  - Reponse of the bytes received by the target.
 //  - No data field required.
@@ -38,6 +46,40 @@
 //  DATA
 //  - The max size of the data field 1024 in data packet.
 //  - Data intergrity is checked by CRC field.
+//  BAUD
+//  - Proposes a new baud rate, acknowledged at the current rate. The host
+//  repeats the packet at the new rate within SBP_BAUD_CONFIRM_TIMEOUT,
+//  otherwise the target falls back to the current rate.
+//  | BAUD |
+//  |  4   |
+//  WDATA
+//  - Data packet of the windowed transfer, the host keeps up to
+//  SBP_WINDOW_SIZE packets in flight.
+//  | SEQ | OFFSET | DATA     |
+//  |  2  |    4   | 0 - 1024 |
+//  WACK
+//  - Response to every WDATA packet, acknowledges cumulatively all the
+//  packets before NEXT_SEQ and selectively the ones set in BITMAP
+//  (bit n is packet NEXT_SEQ + 1 + n).
+//  | STATUS | RSVD | NEXT_SEQ | BITMAP |
+//  |    1   |   1  |     2    |    4   |
+//  QUERY
+//  - Asks for the download the target can resume, answered by PROG.
+//  - No data field required.
+//  PROG
+//  - Identity of the interrupted download and the offset it is
+//  programmed up to, all zero when there is none.
+//  | SIZE | CRC | OFFSET |
+//  |   4  |  4  |    4   |
+//  TQUERY
+//  - Asks for the boot timeline of the last COUNT boots, 0 for all,
+//  answered by TLINE.
+//  | COUNT |
+//  |   4   |
+//  TLINE
+//  - The boot timeline ring in the export format of Libs/timeline.h.
+//  | BOOTS | MARKS | RSVD | RECORD ...  |
+//  |   1   |   1   |   2  | 92 x BOOTS  |
 
 // HEADER SECTION INDEX
 #define SBP_HEADER_SOF_OFFSET 0
@@ -55,39 +97,79 @@
 #define SBP_TYPE_RESP 0x45
 #define SBP_TYPE_CONF 0x67
 #define SBP_TYPE_DATA 0x89
+#define SBP_TYPE_BAUD 0x3C
+#define SBP_TYPE_WDATA 0xAB
+#define SBP_TYPE_WACK 0xCD
+#define SBP_TYPE_QUERY 0x4B
+#define SBP_TYPE_PROG 0x4D
+#define SBP_TYPE_TQUERY 0x6B
+#define SBP_TYPE_TLINE 0x6D
 
 // CONF TYPE DATA INDEX
 #define SBP_CONF_VERSION_OFFSET 0
 #define SBP_CONF_SIZE_OFFSET 4
 #define SBP_CONF_CRC_OFFSET 8
+#define SBP_CONF_FLAGS_OFFSET 12
+#define SBP_CONF_BASE_CRC_OFFSET 16
+#define SBP_CONF_MAX_SIZE 32
 
 // RESPONSE TYPE DATA VALUE
 #define SBP_RESP_ACK 0x15
 #define SBP_RESP_NACK 0x16
 
+// WDATA TYPE DATA INDEX
+#define SBP_WDATA_SEQ_OFFSET 0
+#define SBP_WDATA_OFFSET_OFFSET 2
+#define SBP_WDATA_HEADER_SIZE 6
+
+// Max time (ms) for the rest of a packet once its SOF is received
+#define SBP_PACKET_TIMEOUT 1000
+
+// Max time (ms) for the host to confirm a new baud rate
+#define SBP_BAUD_CONFIRM_TIMEOUT 1000
+
+/* Packet received ahead of the expected sequence number */
+typedef struct {
+    uint8_t bytes[SBP_DATA_MAX_SIZE];
+    uint16_t size;
+    uint16_t seq;
+    uint32_t offset;
+    bool valid;
+} sbp_window_slot_t;
+
+/* Receive window of the windowed transfer */
+static struct {
+    uint16_t next_seq;          // next packet handed over in order
+    uint32_t next_offset;       // image offset of the next packet
+    sbp_window_slot_t slots[SBP_WINDOW_SIZE];
+} sbp_window;
+
+/* Tick a packet was first seen incomplete, 0 when none is */
+static uint32_t sbp_partial_since = 0;
+
 
 static int proto_receive_packet_header(uint8_t *data)
 {
-    uint16_t ret = 0;
+    int ret = 0;
     uint16_t index = 0;
 
-    ret = HAL_UART_Receive(&huart5, &data[index], 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
+    ret = serial_read(&data[index], 1, HAL_MAX_DELAY);
+    if (ret != 0)
         return -1;
 
     if (data[index] != SBP_HEADER_SOF) {
-        SEGGER_RTT_printf(0, "proto_receive_packet_header: SOF failed \r\n");
+        LOG_ERROR("proto_receive_packet_header: SOF failed");
         return -1;
     }
     index++;
 
-    ret = HAL_UART_Receive(&huart5, &data[index], 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
+    ret = serial_read(&data[index], 1, SBP_PACKET_TIMEOUT);
+    if (ret != 0)
         return -1;
     index++;
 
-    ret = HAL_UART_Receive(&huart5, &data[index], 2, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
+    ret = serial_read(&data[index], 2, SBP_PACKET_TIMEOUT);
+    if (ret != 0)
         return -1;
 
     return 0;
@@ -95,12 +177,12 @@ static int proto_receive_packet_header(uint8_t *data)
 
 static int proto_receive_packet_nodata(void)
 {
-    uint16_t ret = 0;
+    int ret = 0;
     uint8_t data[8] = {0};
 
-    ret = HAL_UART_Receive(&huart5, data, 8, HAL_MAX_DELAY);
+    ret = serial_read(data, 8, SBP_PACKET_TIMEOUT);
 
-    if (ret != HAL_OK)
+    if (ret != 0)
         return -1;
 
     return 0;
@@ -108,58 +190,135 @@ static int proto_receive_packet_nodata(void)
 
 static int proto_receive_packet_config(sbp_config_t *config, uint16_t len)
 {
-    uint16_t ret = 0;
-    uint8_t data[12] = {0};
+    int ret = 0;
+    uint8_t data[SBP_CONF_MAX_SIZE] = {0};
     uint32_t recv_crc = 0;
     uint32_t calc_crc = 0;
 
-    if (len < 12)
+    if (len < 12 || len > SBP_CONF_MAX_SIZE)
         return -1;
 
-    ret = HAL_UART_Receive(&huart5, data, 12, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
+    ret = serial_read(data, len, SBP_PACKET_TIMEOUT);
+    if (ret != 0)
         return -1;
 
-    ret = HAL_UART_Receive(&huart5, (uint8_t*)&recv_crc, 4, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
+    ret = serial_read((uint8_t*)&recv_crc, 4, SBP_PACKET_TIMEOUT);
+    if (ret != 0)
         return -1;
 
     calc_crc = crc32_calculate_from_memory(data, len);
     if (calc_crc != recv_crc) {
-        SEGGER_RTT_printf(0, "proto_receive_packet_config: crc failed\r\n");
-        SEGGER_RTT_printf(0, "proto_receive_packet_config: calc_crc = %x, recv_crc = %x \r\n", calc_crc, recv_crc);
+        LOG_ERROR("proto_receive_packet_config: crc failed");
+        LOG_ERROR("proto_receive_packet_config: calc_crc = %x, recv_crc = %x", calc_crc, recv_crc);
         return -1;
     }
 
-    memcpy(&config->version, data + 0, 4);
-    memcpy(&config->size, data + 4, 4);
-    memcpy(&config->crc, data + 8, 4);
+    memcpy(&config->version, data + SBP_CONF_VERSION_OFFSET, 4);
+    memcpy(&config->size, data + SBP_CONF_SIZE_OFFSET, 4);
+    memcpy(&config->crc, data + SBP_CONF_CRC_OFFSET, 4);
+    // optional fields stay zero when the host sends the short packet
+    memcpy(&config->flags, data + SBP_CONF_FLAGS_OFFSET, 4);
+    memcpy(&config->base_crc, data + SBP_CONF_BASE_CRC_OFFSET, 4);
     return 0;
 }
 
 static int proto_receive_packet_data(sbp_data_t *data, uint16_t len)
 {
-    uint16_t ret = 0;
+    int ret = 0;
     uint32_t calc_crc = 0;
     uint32_t recv_crc = 0;
 
-    ret = HAL_UART_Receive(&huart5, data->bytes, len, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
+    if (len > sizeof(data->bytes))
         return -1;
 
-    ret = HAL_UART_Receive(&huart5, (uint8_t*)&recv_crc, 4, HAL_MAX_DELAY);
-    if (ret != HAL_OK)
+    PROF_BEGIN(PROF_UART_RX);
+    ret = serial_read(data->bytes, len, SBP_PACKET_TIMEOUT);
+    if (ret != 0)
         return -1;
 
+    ret = serial_read((uint8_t*)&recv_crc, 4, SBP_PACKET_TIMEOUT);
+    if (ret != 0)
+        return -1;
+    PROF_END(PROF_UART_RX);
+
+    PROF_BEGIN(PROF_PACKET_CRC);
     calc_crc = crc32_calculate_from_memory(data->bytes, len);
+    PROF_END(PROF_PACKET_CRC);
     if (calc_crc != recv_crc) {
-        SEGGER_RTT_printf(0, "proto_receive_packet_data: crc failed \r\n");
+        LOG_ERROR("proto_receive_packet_data: crc failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int proto_receive_packet_baud(uint32_t *baud, uint16_t len)
+{
+    uint32_t recv_crc = 0;
+
+    if (len != 4)
+        return -1;
+
+    if (serial_read((uint8_t*)baud, 4, SBP_PACKET_TIMEOUT) != 0 ||
+        serial_read((uint8_t*)&recv_crc, 4, SBP_PACKET_TIMEOUT) != 0)
+        return -1;
+
+    if (crc32_calculate_from_memory((uint8_t*)baud, 4) != recv_crc) {
+        LOG_ERROR("proto_receive_packet_baud: crc failed");
         return -1;
     }
 
     return 0;
 }
 
+static int proto_receive_packet_tquery(uint32_t *count, uint16_t len)
+{
+    uint32_t recv_crc = 0;
+
+    if (len != 4)
+        return -1;
+
+    if (serial_read((uint8_t*)count, 4, SBP_PACKET_TIMEOUT) != 0 ||
+        serial_read((uint8_t*)&recv_crc, 4, SBP_PACKET_TIMEOUT) != 0)
+        return -1;
+
+    if (crc32_calculate_from_memory((uint8_t*)count, 4) != recv_crc) {
+        LOG_ERROR("proto_receive_packet_tquery: crc failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int proto_confirm_baud(uint32_t baud)
+{
+    uint8_t header[4] = {0};
+    uint32_t confirm = 0;
+    uint16_t len = 0;
+
+    // the host repeats the BAUD packet at the new rate
+    if (serial_read(header, 4, SBP_BAUD_CONFIRM_TIMEOUT) != 0)
+        return -1;
+
+    if (header[SBP_HEADER_SOF_OFFSET] != SBP_HEADER_SOF ||
+        header[SBP_HEADER_TYPE_OFFSET] != SBP_TYPE_BAUD)
+        return -1;
+
+    memcpy(&len, header + SBP_HEADER_LEN_OFFSET, 2);
+    if (proto_receive_packet_baud(&confirm, len) != 0 ||
+        confirm != baud)
+        return -1;
+
+    return 0;
+}
+
+static void proto_discard_packet(void)
+{
+    // the rest of a broken packet is still arriving, drop it so the
+    // next packet starts on its SOF
+    serial_discard_until_idle(SBP_PACKET_TIMEOUT);
+}
+
 static void proto_transmit_packet_resp(uint8_t resp)
 {
     uint8_t resp_pkt[12] = {0};
@@ -174,26 +333,318 @@ static void proto_transmit_packet_resp(uint8_t resp)
 
     memcpy(resp_pkt + SBP_DATA_OFFSET + 4, (uint8_t*)&crc, 4);
 
-    HAL_UART_Transmit(&huart5, resp_pkt, sizeof(resp_pkt), HAL_MAX_DELAY);
+    serial_write(resp_pkt, sizeof(resp_pkt));
+}
+
+static void proto_transmit_packet_wack(uint8_t status)
+{
+    uint8_t wack_pkt[16] = {0};
+    uint16_t next_seq = sbp_window.next_seq;
+    uint32_t bitmap = 0;
+    uint32_t crc = 0;
+    uint16_t seq;
+
+    // packets waiting in the window are safely buffered, ack them too
+    while (sbp_window.slots[next_seq % SBP_WINDOW_SIZE].valid &&
+           sbp_window.slots[next_seq % SBP_WINDOW_SIZE].seq == next_seq)
+        next_seq++;
+
+    for (int i = 0; i < SBP_WINDOW_SIZE - 1; i++) {
+        seq = next_seq + 1 + i;
+        if (sbp_window.slots[seq % SBP_WINDOW_SIZE].valid &&
+            sbp_window.slots[seq % SBP_WINDOW_SIZE].seq == seq)
+            bitmap |= (1 << i);
+    }
+
+    wack_pkt[SBP_HEADER_SOF_OFFSET] = SBP_HEADER_SOF;
+    wack_pkt[SBP_HEADER_TYPE_OFFSET] = SBP_TYPE_WACK;
+    wack_pkt[SBP_HEADER_LEN_OFFSET] = 8;
+    wack_pkt[4] = status;
+    memcpy(wack_pkt + 6, &next_seq, 2);
+    memcpy(wack_pkt + 8, &bitmap, 4);
+
+    crc = crc32_calculate_from_memory(wack_pkt + 4, 8);
+    memcpy(wack_pkt + 12, &crc, 4);
+
+    serial_write(wack_pkt, sizeof(wack_pkt));
+}
+
+void proto_transmit_packet_prog(uint32_t size, uint32_t crc, uint32_t offset)
+{
+    uint8_t prog_pkt[20] = {0};
+    uint32_t calc_crc = 0;
+
+    prog_pkt[SBP_HEADER_SOF_OFFSET] = SBP_HEADER_SOF;
+    prog_pkt[SBP_HEADER_TYPE_OFFSET] = SBP_TYPE_PROG;
+    prog_pkt[SBP_HEADER_LEN_OFFSET] = 12;
+    memcpy(prog_pkt + 4, &size, 4);
+    memcpy(prog_pkt + 8, &crc, 4);
+    memcpy(prog_pkt + 12, &offset, 4);
+
+    calc_crc = crc32_calculate_from_memory(prog_pkt + 4, 12);
+    memcpy(prog_pkt + 16, &calc_crc, 4);
+
+    serial_write(prog_pkt, sizeof(prog_pkt));
+}
+
+void proto_transmit_packet_tline(const uint8_t *data, uint16_t size)
+{
+    uint8_t header[4] = {0};
+    uint32_t crc = 0;
+
+    header[SBP_HEADER_SOF_OFFSET] = SBP_HEADER_SOF;
+    header[SBP_HEADER_TYPE_OFFSET] = SBP_TYPE_TLINE;
+    memcpy(header + SBP_HEADER_LEN_OFFSET, &size, 2);
+
+    crc = crc32_calculate_from_memory((uint8_t*)data, size);
+
+    serial_write(header, sizeof(header));
+    serial_write(data, size);
+    serial_write((uint8_t*)&crc, 4);
+}
+
+static void proto_window_reset(void)
+{
+    sbp_window.next_seq = 0;
+    sbp_window.next_offset = 0;
+
+    for (int i = 0; i < SBP_WINDOW_SIZE; i++)
+        sbp_window.slots[i].valid = false;
+}
+
+void proto_window_seek(uint32_t offset)
+{
+    sbp_window.next_offset = offset;
+}
+
+static void proto_window_hand_over(sbp_handle_t *handle, uint8_t *bytes, uint16_t size)
+{
+    if (bytes != handle->data.bytes)
+        memcpy(handle->data.bytes, bytes, size);
+
+    handle->data.size = size;
+    handle->data.offset = sbp_window.next_offset;
+    handle->state = STATE_DATA_PACKET_RECEIVED;
+
+    sbp_window.next_seq++;
+    sbp_window.next_offset += size;
+}
+
+static bool proto_window_deliver(sbp_handle_t *handle)
+{
+    sbp_window_slot_t *slot = &sbp_window.slots[sbp_window.next_seq % SBP_WINDOW_SIZE];
+
+    if (!slot->valid || slot->seq != sbp_window.next_seq)
+        return false;
+
+    slot->valid = false;
+    if (slot->offset != sbp_window.next_offset)
+        return false;
+
+    proto_window_hand_over(handle, slot->bytes, slot->size);
+    return true;
+}
+
+static sbp_window_slot_t *proto_window_buffered(uint16_t seq)
+{
+    sbp_window_slot_t *slot = &sbp_window.slots[seq % SBP_WINDOW_SIZE];
+
+    return (slot->valid && slot->seq == seq) ? slot : NULL;
+}
+
+static bool proto_window_fits(uint16_t seq, uint32_t offset, uint16_t size, int16_t distance)
+{
+    sbp_window_slot_t *prev = proto_window_buffered(seq - 1);
+    sbp_window_slot_t *next = proto_window_buffered(seq + 1);
+
+    // every missing packet in front of it holds 1 to SBP_DATA_MAX_SIZE bytes
+    if (offset < sbp_window.next_offset + distance ||
+        offset > sbp_window.next_offset + (uint32_t) distance * SBP_DATA_MAX_SIZE)
+        return false;
+
+    // and it has to join the buffered packets next to it
+    if (prev != NULL && prev->offset + prev->size != offset)
+        return false;
+    if (next != NULL && offset + size != next->offset)
+        return false;
+
+    return true;
+}
+
+static void proto_window_check_next(void)
+{
+    sbp_window_slot_t *slot = proto_window_buffered(sbp_window.next_seq);
+
+    // buffered packets now joining the stream were only acknowledged
+    // selectively, drop a run that doesn't follow on so the host resends it
+    // rather than counting it in the cumulative acknowledgement
+    if (slot == NULL || slot->offset == sbp_window.next_offset)
+        return;
+
+    LOG_WARN("proto_window_check_next: packet %d at %ld, expected %ld",
+             slot->seq, slot->offset, sbp_window.next_offset);
+    for (uint16_t seq = sbp_window.next_seq; (slot = proto_window_buffered(seq)) != NULL; seq++)
+        slot->valid = false;
+}
+
+/* Reads a WDATA packet. -1 when its framing is broken and the rest of it
+ * still has to be discarded; a packet read in full but refused (crc,
+ * offset) only gets the NACK status */
+static int proto_receive_packet_window(sbp_handle_t *handle, uint16_t len, uint8_t *status)
+{
+    uint8_t header[SBP_WDATA_HEADER_SIZE];
+    uint16_t size = len - SBP_WDATA_HEADER_SIZE;
+    uint32_t recv_crc = 0;
+    uint32_t offset;
+    uint16_t seq;
+    int16_t distance;
+    sbp_window_slot_t *slot;
+    crc32_ctx_t crc;
+
+    if (len < SBP_WDATA_HEADER_SIZE || size > SBP_DATA_MAX_SIZE)
+        return -1;
+
+    PROF_BEGIN(PROF_UART_RX);
+    if (serial_read(header, SBP_WDATA_HEADER_SIZE, SBP_PACKET_TIMEOUT) != 0 ||
+        serial_read(handle->data.bytes, size, SBP_PACKET_TIMEOUT) != 0 ||
+        serial_read((uint8_t*)&recv_crc, 4, SBP_PACKET_TIMEOUT) != 0)
+        return -1;
+    PROF_END(PROF_UART_RX);
+
+    *status = SBP_RESP_NACK;
+
+    PROF_BEGIN(PROF_PACKET_CRC);
+    crc32_init(&crc);
+    crc32_update(&crc, header, SBP_WDATA_HEADER_SIZE);
+    crc32_update(&crc, handle->data.bytes, size);
+    PROF_END(PROF_PACKET_CRC);
+    if (crc32_final(&crc) != recv_crc) {
+        LOG_ERROR("proto_receive_packet_window: crc failed");
+        return 0;
+    }
+
+    memcpy(&seq, header + SBP_WDATA_SEQ_OFFSET, 2);
+    memcpy(&offset, header + SBP_WDATA_OFFSET_OFFSET, 4);
+    distance = (int16_t)(seq - sbp_window.next_seq);
+
+    if (distance == 0) {
+        // in order, hand it over straight away
+        if (offset != sbp_window.next_offset) {
+            LOG_ERROR("proto_receive_packet_window: packet %d at %ld, expected %ld",
+                      seq, offset, sbp_window.next_offset);
+            return 0;
+        }
+        proto_window_hand_over(handle, handle->data.bytes, size);
+        proto_window_check_next();
+    } else if (distance > 0 && distance < SBP_WINDOW_SIZE) {
+        // ahead of a missing packet, keep it until the gap is filled. Once
+        // buffered it is acknowledged, it must fit where it is delivered
+        if (!proto_window_fits(seq, offset, size, distance)) {
+            LOG_ERROR("proto_receive_packet_window: packet %d at %ld doesn't fit the window",
+                      seq, offset);
+            return 0;
+        }
+        slot = &sbp_window.slots[seq % SBP_WINDOW_SIZE];
+        memcpy(slot->bytes, handle->data.bytes, size);
+        slot->size = size;
+        slot->seq = seq;
+        slot->offset = offset;
+        slot->valid = true;
+    }
+    // duplicates and packets beyond the window are only acknowledged
+
+    *status = SBP_RESP_ACK;
+    return 0;
+}
+
+bool proto_packet_pending(void)
+{
+    sbp_window_slot_t *slot = &sbp_window.slots[sbp_window.next_seq % SBP_WINDOW_SIZE];
+    uint32_t available = serial_available();
+    uint16_t len;
+
+    if (slot->valid && slot->seq == sbp_window.next_seq)
+        return true;
+
+    if (available < 4) {
+        sbp_partial_since = 0;
+        return false;
+    }
+
+    // not a packet start, let the receive path report it
+    if (serial_peek(SBP_HEADER_SOF_OFFSET) != SBP_HEADER_SOF)
+        return true;
+
+    // no legal packet is that long, it would never be complete. The
+    // receive path discards it and NACKs
+    len = serial_peek(SBP_HEADER_LEN_OFFSET) | (serial_peek(SBP_HEADER_LEN_OFFSET + 1) << 8);
+    if (len > SBP_DATA_MAX_SIZE + SBP_WDATA_HEADER_SIZE)
+        return true;
+
+    // every packet is header, LEN bytes of data and the CRC
+    if (available >= 4 + (uint32_t)len + 4) {
+        sbp_partial_since = 0;
+        return true;
+    }
+
+    // the rest of the packet got lost, the receive path times out on it
+    if (sbp_partial_since == 0) {
+        sbp_partial_since = HAL_GetTick() | 1;    // never 0
+    } else if (HAL_GetTick() - sbp_partial_since >= SBP_PACKET_TIMEOUT) {
+        LOG_WARN("proto_packet_pending: packet incomplete, %d of %d bytes", available, len + 8);
+        sbp_partial_since = 0;
+        return true;
+    }
+
+    return false;
+}
+
+static void proto_switch_baud(uint32_t baud)
+{
+    uint32_t old_baud = serial_get_baud();
+
+    if (serial_set_baud(baud) != 0)
+        return;
+
+    if (proto_confirm_baud(baud) != 0) {
+        LOG_WARN("proto_switch_baud: no confirmation, back to %d", old_baud);
+        serial_set_baud(old_baud);
+        serial_discard_until_idle(SBP_PACKET_TIMEOUT);
+        return;
+    }
+
+    LOG_INFO("proto_switch_baud: switched to %d", baud);
+    proto_transmit_packet_resp(SBP_RESP_ACK);
 }
 
 int proto_receive_packet(sbp_handle_t *handle)
 {
     uint8_t header[4] = {0};
+    uint32_t baud = 0;
+    bool over8 = false;
+    uint8_t wack_status = SBP_RESP_NACK;
 
     // clear all the config
     handle->config.version = 0;
     handle->config.size = 0;
     handle->config.crc = 0;
+    handle->config.flags = 0;
+    handle->config.base_crc = 0;
 
     // clear all the data
-    memset(handle->data.bytes, 0, 1024);
+    memset(handle->data.bytes, 0, SBP_DATA_MAX_SIZE);
     handle->data.size = 0;
+    handle->data.offset = 0;
 
     handle->state = STATE_RESET;
 
+    // packets buffered by the window go first, they were acked already
+    if (proto_window_deliver(handle))
+        return 0;
+
     if (proto_receive_packet_header(header) != 0) {
-        SEGGER_RTT_printf(0, "proto_receive_packet: header receive failed \r\n");
+        LOG_ERROR("proto_receive_packet: header receive failed");
+        proto_discard_packet();
         proto_transmit_packet_resp(SBP_RESP_NACK);
         return -1;
     }
@@ -202,41 +653,94 @@ int proto_receive_packet(sbp_handle_t *handle)
 
     switch (header[SBP_HEADER_TYPE_OFFSET]) {
         case SBP_TYPE_START:
-            SEGGER_RTT_printf(0, "proto_receive_packet: start packet type received \r\n");
+            LOG_DEBUG("proto_receive_packet: start packet type received");
             if (proto_receive_packet_nodata() != 0) {
-                SEGGER_RTT_printf(0, "proto_receive_packet: start receive failed \r\n");
+                LOG_ERROR("proto_receive_packet: start receive failed");
+                proto_discard_packet();
                 proto_transmit_packet_resp(SBP_RESP_NACK);
                 return -1;
             }
+            proto_window_reset();
             handle->state = STATE_DOWNLOAD_START;
             break;
         case SBP_TYPE_STOP:
-            SEGGER_RTT_printf(0, "proto_receive_packet: stop packet type received \r\n");
+            LOG_DEBUG("proto_receive_packet: stop packet type received");
             if (proto_receive_packet_nodata() != 0) {
-                SEGGER_RTT_printf(0, "proto_receive_packet: stop receive failed \r\n");
+                LOG_ERROR("proto_receive_packet: stop receive failed");
+                proto_discard_packet();
                 proto_transmit_packet_resp(SBP_RESP_NACK);
                 return -1;
             }
             handle->state = STATE_DOWNLOAD_COMPLETE;
             break;
         case SBP_TYPE_CONF:
-            SEGGER_RTT_printf(0, "proto_receive_packet: config packet type received \r\n");
+            LOG_DEBUG("proto_receive_packet: config packet type received");
             if (proto_receive_packet_config(&handle->config, handle->data.size) != 0) {
-                SEGGER_RTT_printf(0, "proto_receive_packet: config receive failed \r\n");
+                LOG_ERROR("proto_receive_packet: config receive failed");
+                proto_discard_packet();
                 proto_transmit_packet_resp(SBP_RESP_NACK);
                 return -1;
             }
             handle->state = STATE_CONF_PACKET_RECEIVED;
             break;
         case SBP_TYPE_DATA:
-            SEGGER_RTT_printf(0, "proto_receive_packet: data packet type received \r\n");
+            LOG_DEBUG("proto_receive_packet: data packet type received");
             if (proto_receive_packet_data(&handle->data, handle->data.size) != 0) {
-                SEGGER_RTT_printf(0, "proto_receive_packet: data receive failed \r\n");
+                LOG_ERROR("proto_receive_packet: data receive failed");
+                proto_discard_packet();
                 proto_transmit_packet_resp(SBP_RESP_NACK);
                 return -1;
             }
             handle->state = STATE_DATA_PACKET_RECEIVED;
             break;
+        case SBP_TYPE_BAUD:
+            LOG_DEBUG("proto_receive_packet: baud packet type received");
+            if (proto_receive_packet_baud(&baud, handle->data.size) != 0 ||
+                serial_compute_brr(HAL_RCC_GetPCLK1Freq(), baud, &over8) == 0) {
+                LOG_ERROR("proto_receive_packet: baud rejected");
+                proto_discard_packet();
+                proto_transmit_packet_resp(SBP_RESP_NACK);
+                return -1;
+            }
+            // acknowledge at the current rate, then switch
+            proto_transmit_packet_resp(SBP_RESP_ACK);
+            proto_switch_baud(baud);
+            return 0;
+        case SBP_TYPE_QUERY:
+            LOG_DEBUG("proto_receive_packet: query packet type received");
+            if (proto_receive_packet_nodata() != 0) {
+                LOG_ERROR("proto_receive_packet: query receive failed");
+                proto_discard_packet();
+                proto_transmit_packet_resp(SBP_RESP_NACK);
+                return -1;
+            }
+            // answered with PROG once the caller looked the progress up
+            handle->state = STATE_QUERY_RECEIVED;
+            return 0;
+        case SBP_TYPE_TQUERY:
+            LOG_DEBUG("proto_receive_packet: timeline query packet type received");
+            // the boot count goes in the config size
+            if (proto_receive_packet_tquery(&handle->config.size, handle->data.size) != 0) {
+                LOG_ERROR("proto_receive_packet: timeline query receive failed");
+                proto_discard_packet();
+                proto_transmit_packet_resp(SBP_RESP_NACK);
+                return -1;
+            }
+            // answered with TLINE by the caller
+            handle->state = STATE_TIMELINE_RECEIVED;
+            return 0;
+        case SBP_TYPE_WDATA:
+            if (proto_receive_packet_window(handle, handle->data.size, &wack_status) != 0) {
+                LOG_ERROR("proto_receive_packet: window data receive failed");
+                handle->state = STATE_RESET;
+                proto_discard_packet();
+                proto_transmit_packet_wack(SBP_RESP_NACK);
+                return -1;
+            }
+            // a corrupted packet was read in full, the packets behind it
+            // are already on the line and get their own acks
+            proto_transmit_packet_wack(wack_status);
+            return (wack_status == SBP_RESP_ACK) ? 0 : -1;
     }
 
     proto_transmit_packet_resp(SBP_RESP_ACK);
@@ -3,23 +3,39 @@
 
 #include "main.h"
 
+/* Max size of the data field of a packet */
+#define SBP_DATA_MAX_SIZE 1024
+
+/* CONF flags */
+#define SBP_CONF_FLAG_COMPRESSED 0x01
+#define SBP_CONF_FLAG_DELTA 0x02
+#define SBP_CONF_FLAG_RESUME 0x04
+
+/* Max WDATA packets in flight in the windowed transfer */
+#define SBP_WINDOW_SIZE 8
+
 enum proto_state_t {
 STATE_RESET,
 STATE_DOWNLOAD_START,
 STATE_CONF_PACKET_RECEIVED,
 STATE_DATA_PACKET_RECEIVED,
-STATE_DOWNLOAD_COMPLETE
+STATE_DOWNLOAD_COMPLETE,
+STATE_QUERY_RECEIVED,
+STATE_TIMELINE_RECEIVED
 };
 
 typedef struct {
     uint32_t version;
     uint32_t size;
     uint32_t crc;
+    uint32_t flags;
+    uint32_t base_crc;  // installed image the delta applies to
 } sbp_config_t;
 
 typedef struct {
-    uint8_t bytes[1024];
+    uint8_t bytes[SBP_DATA_MAX_SIZE];
     uint16_t size;
+    uint32_t offset;    // image offset, windowed transfer only
 } sbp_data_t;
 
 typedef struct {
@@ -31,4 +47,17 @@ typedef struct {
 /* receives command and data packets and sends response packets */
 int proto_receive_packet(sbp_handle_t *handle);
 
+/* true when a whole packet is buffered, receiving it will not block */
+bool proto_packet_pending(void);
+
+/* answers a QUERY with the download the target can resume, all zero
+ * when there is none */
+void proto_transmit_packet_prog(uint32_t size, uint32_t crc, uint32_t offset);
+
+/* answers a TQUERY with size bytes of the exported boot timeline */
+void proto_transmit_packet_tline(const uint8_t *data, uint16_t size);
+
+/* image offset the windowed transfer continues from, after a resume */
+void proto_window_seek(uint32_t offset);
+
 #endif // PROTO_H_
@@ -0,0 +1,78 @@
+#include "ring.h"
+
+#include <string.h>
+
+void ring_init(ring_t *ring, uint8_t *buf, uint32_t size)
+{
+    ring->buf = buf;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+uint32_t ring_count(const ring_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+uint32_t ring_space(const ring_t *ring)
+{
+    return ring->size - ring_count(ring);
+}
+
+uint32_t ring_put(ring_t *ring, const uint8_t *data, uint32_t len)
+{
+    uint32_t index = ring->head & (ring->size - 1);
+    uint32_t first;
+
+    if (len > ring_space(ring))
+        len = ring_space(ring);
+
+    // copy up to the end of the buffer, then wrap around
+    first = ring->size - index;
+    if (first > len)
+        first = len;
+
+    memcpy(ring->buf + index, data, first);
+    memcpy(ring->buf, data + first, len - first);
+
+    ring->head += len;
+    return len;
+}
+
+void ring_produced(ring_t *ring, uint32_t len)
+{
+    ring->head += len;
+}
+
+uint32_t ring_get(ring_t *ring, uint8_t *data, uint32_t len)
+{
+    uint32_t index = ring->tail & (ring->size - 1);
+    uint32_t first;
+
+    if (len > ring_count(ring))
+        len = ring_count(ring);
+
+    first = ring->size - index;
+    if (first > len)
+        first = len;
+
+    memcpy(data, ring->buf + index, first);
+    memcpy(data + first, ring->buf, len - first);
+
+    ring->tail += len;
+    return len;
+}
+
+uint8_t ring_peek(const ring_t *ring, uint32_t offset)
+{
+    return ring->buf[(ring->tail + offset) & (ring->size - 1)];
+}
+
+void ring_skip(ring_t *ring, uint32_t len)
+{
+    if (len > ring_count(ring))
+        len = ring_count(ring);
+
+    ring->tail += len;
+}
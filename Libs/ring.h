@@ -0,0 +1,31 @@
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Single producer, single consumer byte ring. The head and tail are free
+ * running counters, the size must be a power of two. */
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;
+    volatile uint32_t head;     // bytes written by the producer
+    volatile uint32_t tail;     // bytes read by the consumer
+} ring_t;
+
+void ring_init(ring_t *ring, uint8_t *buf, uint32_t size);
+
+/* bytes available to the consumer / free space for the producer */
+uint32_t ring_count(const ring_t *ring);
+uint32_t ring_space(const ring_t *ring);
+
+/* producer side, copy in or account for bytes written into buf directly */
+uint32_t ring_put(ring_t *ring, const uint8_t *data, uint32_t len);
+void ring_produced(ring_t *ring, uint32_t len);
+
+/* consumer side */
+uint32_t ring_get(ring_t *ring, uint8_t *data, uint32_t len);
+uint8_t ring_peek(const ring_t *ring, uint32_t offset);
+void ring_skip(ring_t *ring, uint32_t len);
+
+#endif // RING_H_
@@ -0,0 +1,232 @@
+#include "serial.h"
+#include "ring.h"
+#include "log.h"
+
+#include "usart.h"
+
+/* UART5_RX request is mapped on DMA1 stream 0, channel 4 */
+#define SERIAL_RX_DMA_STREAM DMA1_Stream0
+#define SERIAL_RX_DMA_CHANNEL DMA_CHANNEL_4
+
+static uint8_t serial_rx_buf[SERIAL_RX_BUFFER_SIZE];
+static ring_t serial_rx_ring;
+static DMA_HandleTypeDef serial_rx_dma;
+
+/* Bytes written by the DMA and accounted in the ring, free running */
+static uint32_t serial_rx_pos = 0;
+
+/* Half buffers the DMA completed, counted by its half and full transfer
+ * interrupts, a lap over unread bytes is told apart from no bytes */
+static volatile uint32_t serial_rx_halves = 0;
+
+/* Set by the idle line interrupt */
+static volatile bool serial_rx_idle = false;
+
+static void serial_rx_flush(void)
+{
+    // what is left can't be trusted, the packet in progress fails its
+    // crc or times out and gets NACKed
+    ring_skip(&serial_rx_ring, ring_count(&serial_rx_ring));
+}
+
+static void serial_rx_sync(void)
+{
+    uint32_t halves;
+    uint32_t offset;
+    uint32_t pos;
+
+    // the position within the buffer and the completed halves, read
+    // again if an interrupt came in between
+    do {
+        halves = serial_rx_halves;
+        offset = (SERIAL_RX_BUFFER_SIZE - __HAL_DMA_GET_COUNTER(&serial_rx_dma)) & (SERIAL_RX_BUFFER_SIZE - 1);
+    } while (halves != serial_rx_halves);
+
+    // a half completed but not counted yet shows as an offset past it
+    pos = halves * (SERIAL_RX_BUFFER_SIZE / 2);
+    pos += (offset - pos) & (SERIAL_RX_BUFFER_SIZE - 1);
+
+    // the DMA writes the ring buffer directly, catch the head up with
+    // the position it reached
+    ring_produced(&serial_rx_ring, pos - serial_rx_pos);
+    serial_rx_pos = pos;
+
+    // the DMA lapped the reader and overwrote unread bytes
+    if (ring_count(&serial_rx_ring) > SERIAL_RX_BUFFER_SIZE) {
+        LOG_WARN("serial_rx_sync: dma overrun, %d bytes", ring_count(&serial_rx_ring));
+        serial_rx_flush();
+    }
+
+    // a byte came in before the DMA took the previous one, reading SR
+    // then DR clears the flag
+    if (__HAL_UART_GET_FLAG(&huart5, UART_FLAG_ORE)) {
+        __HAL_UART_CLEAR_OREFLAG(&huart5);
+        LOG_WARN("serial_rx_sync: uart overrun");
+        serial_rx_flush();
+    }
+}
+
+int serial_init(void)
+{
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    ring_init(&serial_rx_ring, serial_rx_buf, SERIAL_RX_BUFFER_SIZE);
+    serial_rx_pos = 0;
+    serial_rx_halves = 0;
+
+    serial_rx_dma.Instance = SERIAL_RX_DMA_STREAM;
+    serial_rx_dma.Init.Channel = SERIAL_RX_DMA_CHANNEL;
+    serial_rx_dma.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    serial_rx_dma.Init.PeriphInc = DMA_PINC_DISABLE;
+    serial_rx_dma.Init.MemInc = DMA_MINC_ENABLE;
+    serial_rx_dma.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    serial_rx_dma.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    serial_rx_dma.Init.Mode = DMA_CIRCULAR;
+    serial_rx_dma.Init.Priority = DMA_PRIORITY_HIGH;
+    serial_rx_dma.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&serial_rx_dma) != HAL_OK) {
+        LOG_ERROR("serial_init: dma init failed");
+        return -1;
+    }
+
+    // the half and full transfer interrupts count the laps
+    __HAL_DMA_ENABLE_IT(&serial_rx_dma, DMA_IT_HT | DMA_IT_TC);
+    HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+
+    if (HAL_DMA_Start(&serial_rx_dma, (uint32_t) &huart5.Instance->DR,
+                      (uint32_t) serial_rx_buf, SERIAL_RX_BUFFER_SIZE) != HAL_OK) {
+        LOG_ERROR("serial_init: dma start failed");
+        return -1;
+    }
+
+    // hand the receive data register over to the DMA, only the idle
+    // line event interrupts the core
+    SET_BIT(huart5.Instance->CR3, USART_CR3_DMAR);
+    __HAL_UART_CLEAR_IDLEFLAG(&huart5);
+    __HAL_UART_ENABLE_IT(&huart5, UART_IT_IDLE);
+
+    HAL_NVIC_SetPriority(UART5_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(UART5_IRQn);
+
+    return 0;
+}
+
+void serial_deinit(void)
+{
+    // the DMA must not write into the RAM of the application, nor the
+    // idle line reach its vector table
+    __HAL_UART_DISABLE_IT(&huart5, UART_IT_IDLE);
+    CLEAR_BIT(huart5.Instance->CR3, USART_CR3_DMAR);
+    if (HAL_DMA_Abort(&serial_rx_dma) != HAL_OK)
+        LOG_WARN("serial_deinit: dma abort failed");
+    HAL_DMA_DeInit(&serial_rx_dma);
+    HAL_NVIC_DisableIRQ(DMA1_Stream0_IRQn);
+    HAL_NVIC_ClearPendingIRQ(DMA1_Stream0_IRQn);
+
+    HAL_NVIC_DisableIRQ(UART5_IRQn);
+    HAL_UART_DeInit(&huart5);
+    HAL_NVIC_ClearPendingIRQ(UART5_IRQn);
+}
+
+uint32_t serial_available(void)
+{
+    serial_rx_sync();
+    return ring_count(&serial_rx_ring);
+}
+
+int serial_read(uint8_t *data, uint32_t len, uint32_t timeout)
+{
+    uint32_t start_time = HAL_GetTick();
+
+    while (serial_available() < len) {
+        if (timeout != HAL_MAX_DELAY && HAL_GetTick() - start_time >= timeout)
+            return -1;
+    }
+
+    ring_get(&serial_rx_ring, data, len);
+    return 0;
+}
+
+uint8_t serial_peek(uint32_t offset)
+{
+    return ring_peek(&serial_rx_ring, offset);
+}
+
+void serial_discard_until_idle(uint32_t timeout)
+{
+    uint32_t start_time = HAL_GetTick();
+
+    serial_rx_idle = false;
+
+    do {
+        ring_skip(&serial_rx_ring, serial_available());
+    } while (!serial_rx_idle && HAL_GetTick() - start_time < timeout);
+
+    ring_skip(&serial_rx_ring, serial_available());
+}
+
+int serial_write(const uint8_t *data, uint32_t len)
+{
+    if (HAL_UART_Transmit(&huart5, (uint8_t *) data, len, HAL_MAX_DELAY) != HAL_OK)
+        return -1;
+
+    return 0;
+}
+
+int serial_set_baud(uint32_t baud)
+{
+    bool over8 = false;
+    uint32_t brr;
+
+    brr = serial_compute_brr(HAL_RCC_GetPCLK1Freq(), baud, &over8);
+    if (brr == 0) {
+        LOG_ERROR("serial_set_baud: %d not supported", baud);
+        return -1;
+    }
+
+    // let the last byte leave at the old rate
+    while (!__HAL_UART_GET_FLAG(&huart5, UART_FLAG_TC));
+
+    __HAL_UART_DISABLE(&huart5);
+
+    if (over8)
+        SET_BIT(huart5.Instance->CR1, USART_CR1_OVER8);
+    else
+        CLEAR_BIT(huart5.Instance->CR1, USART_CR1_OVER8);
+    huart5.Instance->BRR = brr;
+
+    __HAL_UART_ENABLE(&huart5);
+
+    huart5.Init.BaudRate = baud;
+    huart5.Init.OverSampling = over8 ? UART_OVERSAMPLING_8 : UART_OVERSAMPLING_16;
+    return 0;
+}
+
+uint32_t serial_get_baud(void)
+{
+    return huart5.Init.BaudRate;
+}
+
+void serial_dma_irq_handler(void)
+{
+    // both may be pending when the interrupt was held off, the half
+    // completed first
+    if (__HAL_DMA_GET_FLAG(&serial_rx_dma, __HAL_DMA_GET_HT_FLAG_INDEX(&serial_rx_dma))) {
+        __HAL_DMA_CLEAR_FLAG(&serial_rx_dma, __HAL_DMA_GET_HT_FLAG_INDEX(&serial_rx_dma));
+        serial_rx_halves++;
+    }
+
+    if (__HAL_DMA_GET_FLAG(&serial_rx_dma, __HAL_DMA_GET_TC_FLAG_INDEX(&serial_rx_dma))) {
+        __HAL_DMA_CLEAR_FLAG(&serial_rx_dma, __HAL_DMA_GET_TC_FLAG_INDEX(&serial_rx_dma));
+        serial_rx_halves++;
+    }
+}
+
+void serial_irq_handler(void)
+{
+    if (__HAL_UART_GET_FLAG(&huart5, UART_FLAG_IDLE)) {
+        __HAL_UART_CLEAR_IDLEFLAG(&huart5);
+        serial_rx_idle = true;
+    }
+}
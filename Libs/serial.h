@@ -0,0 +1,50 @@
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+#include "main.h"
+
+/* Receive ring filled by the circular DMA of UART5, power of two and
+ * larger than the biggest burst the host sends before waiting (a full
+ * window of WDATA packets) */
+#define SERIAL_RX_BUFFER_SIZE 16384
+
+/* Max deviation of the generated baud rate, in per mille */
+#define SERIAL_BAUD_TOLERANCE 20
+
+/* starts the background reception */
+int serial_init(void);
+
+/* stops the reception and releases UART5, before the jump */
+void serial_deinit(void);
+
+/* bytes received and not consumed yet */
+uint32_t serial_available(void);
+
+/* blocks until len bytes are received or timeout (ms) expires */
+int serial_read(uint8_t *data, uint32_t len, uint32_t timeout);
+
+/* look ahead without consuming */
+uint8_t serial_peek(uint32_t offset);
+
+/* drops the received bytes until the line goes idle or timeout (ms) expires */
+void serial_discard_until_idle(uint32_t timeout);
+
+/* transmits the buffer */
+int serial_write(const uint8_t *data, uint32_t len);
+
+/* baud rate register value for the peripheral clock, 0 when the rate
+ * can't be generated within SERIAL_BAUD_TOLERANCE */
+uint32_t serial_compute_brr(uint32_t pclk, uint32_t baud, bool *over8);
+
+/* switches the line to another baud rate, reception keeps running */
+int serial_set_baud(uint32_t baud);
+uint32_t serial_get_baud(void);
+
+/* idle line interrupt, called from UART5_IRQHandler */
+void serial_irq_handler(void);
+
+/* half and full transfer of the receive DMA, called from
+ * DMA1_Stream0_IRQHandler */
+void serial_dma_irq_handler(void);
+
+#endif // SERIAL_H_
@@ -0,0 +1,37 @@
+#include "serial.h"
+
+/* Baud rate register computation, apart from the UART driver so the
+ * host side clock check links it, see Utils/clock_check.c */
+uint32_t serial_compute_brr(uint32_t pclk, uint32_t baud, bool *over8)
+{
+    uint32_t div;
+    uint32_t actual;
+    uint32_t error;
+
+    if (baud == 0)
+        return 0;
+
+    // div is the clock to baud ratio, that is 16 * USARTDIV when
+    // oversampling by 16 and 8 * USARTDIV when oversampling by 8, the
+    // more noise tolerant oversampling by 16 is preferred
+    div = (pclk + baud / 2) / baud;
+    if (div < 8)
+        return 0;
+
+    actual = pclk / div;
+    error = (uint32_t)((uint64_t)(actual > baud ? actual - baud : baud - actual) * 1000 / baud);
+    if (error > SERIAL_BAUD_TOLERANCE)
+        return 0;
+
+    if (div >= 16 && div <= 0xFFFF) {
+        *over8 = false;
+        return div;
+    }
+
+    if (div >= 8 && div <= 0x7FFF) {
+        *over8 = true;
+        return ((div >> 3) << 4) | (div & 0x7);
+    }
+
+    return 0;
+}
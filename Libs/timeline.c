@@ -0,0 +1,167 @@
+#include "timeline.h"
+#include "SEGGER_RTT.h"
+
+#include "crc32.h"
+#include "log.h"
+
+#ifdef HOST_SIM
+#include <time.h>
+#endif
+
+#define TIMELINE_MAGIC 0x454E4C54 // "TLNE"
+#define TIMELINE_EXPORT_HEADER_SIZE 4
+#define TIMELINE_DUMP_SIZE (4 + TIMELINE_EXPORT_HEADER_SIZE + TIMELINE_BOOTS * sizeof(timeline_boot_t) + 4)
+
+/* The cycle counter wraps after 23 s at 180 MHz, longer phases are timed
+ * by the millisecond tick */
+#define TIMELINE_CYCLES_MAX_MS 10000
+
+typedef struct {
+    uint32_t magic;
+    uint32_t boots;             // seq of the newest record
+    uint32_t head;              // record of the current boot
+    timeline_boot_t records[TIMELINE_BOOTS];
+} timeline_ring_t;
+
+static timeline_ring_t timeline_ring __attribute__((section(".noinit.timeline")));
+
+static timeline_boot_t *timeline_current = NULL;
+
+/* Time of the last marker */
+static uint32_t timeline_last_us = 0;
+#ifdef HOST_SIM
+static uint64_t timeline_origin_us = 0;
+#else
+static uint32_t timeline_last_cycles = 0;
+static uint32_t timeline_last_tick = 0;
+#endif
+
+static uint8_t timeline_rtt_buffer[TIMELINE_RTT_BUFFER_SIZE];
+
+static uint32_t timeline_now_us(void)
+{
+#ifdef HOST_SIM
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timeline_origin_us == 0)
+        timeline_origin_us = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+    return (uint32_t) (now.tv_sec * 1000000ULL + now.tv_nsec / 1000 - timeline_origin_us);
+#else
+    uint32_t cycles = DWT->CYCCNT;
+    uint32_t tick = HAL_GetTick();
+    uint32_t us;
+
+    // cycles at the core clock of the previous marker, a clock switch
+    // is timed at the clock it started from
+    us = (cycles - timeline_last_cycles) / (SystemCoreClock / 1000000);
+    if (tick - timeline_last_tick > TIMELINE_CYCLES_MAX_MS)
+        us = (tick - timeline_last_tick) * 1000;
+
+    timeline_last_cycles = cycles;
+    timeline_last_tick = tick;
+    return timeline_last_us + us;
+#endif
+}
+
+static bool timeline_ring_valid(void)
+{
+    if (timeline_ring.magic != TIMELINE_MAGIC || timeline_ring.head >= TIMELINE_BOOTS)
+        return false;
+
+    for (int i = 0; i < TIMELINE_BOOTS; i++) {
+        if (timeline_ring.records[i].count > TIMELINE_MARKS)
+            return false;
+    }
+
+    return true;
+}
+
+void timeline_init(void)
+{
+#ifndef HOST_SIM
+    // prof_init() enables it too, neither resets it
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    timeline_last_cycles = DWT->CYCCNT;
+    timeline_last_tick = HAL_GetTick();
+#endif
+    timeline_last_us = 0;
+
+    // a power up leaves noise, start over
+    if (!timeline_ring_valid()) {
+        memset(&timeline_ring, 0, sizeof(timeline_ring));
+        timeline_ring.magic = TIMELINE_MAGIC;
+        timeline_ring.head = TIMELINE_BOOTS - 1;
+    }
+
+    timeline_ring.head = (timeline_ring.head + 1) % TIMELINE_BOOTS;
+    timeline_ring.boots++;
+
+    timeline_current = &timeline_ring.records[timeline_ring.head];
+    memset(timeline_current, 0, sizeof(timeline_boot_t));
+    timeline_current->seq = timeline_ring.boots;
+    timeline_current->reset_flags = RCC->CSR;
+
+    timeline_mark(TIMELINE_MAIN);
+
+    SEGGER_RTT_ConfigUpBuffer(TIMELINE_RTT_BUFFER, "timeline", timeline_rtt_buffer,
+                              sizeof(timeline_rtt_buffer), SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+}
+
+void timeline_mark(timeline_phase_t phase)
+{
+    uint32_t now = timeline_now_us();
+
+    timeline_last_us = now;
+    if (timeline_current == NULL || timeline_current->count == TIMELINE_MARKS)
+        return;
+
+    timeline_current->phase[timeline_current->count] = phase;
+    timeline_current->us[timeline_current->count] = now;
+    timeline_current->count++;
+}
+
+uint16_t timeline_export(uint8_t *data, uint16_t size, uint8_t count)
+{
+    uint32_t boots = timeline_ring.boots < TIMELINE_BOOTS ? timeline_ring.boots : TIMELINE_BOOTS;
+    uint32_t index;
+    uint8_t *pos = data + TIMELINE_EXPORT_HEADER_SIZE;
+
+    if (count == 0 || count > boots)
+        count = boots;
+
+    if (size < TIMELINE_EXPORT_HEADER_SIZE + count * sizeof(timeline_boot_t))
+        return 0;
+
+    data[0] = count;
+    data[1] = TIMELINE_MARKS;
+    data[2] = 0;
+    data[3] = 0;
+
+    // oldest first, the current boot last
+    for (uint32_t i = 0; i < count; i++) {
+        index = (timeline_ring.head + TIMELINE_BOOTS - count + 1 + i) % TIMELINE_BOOTS;
+        memcpy(pos, &timeline_ring.records[index], sizeof(timeline_boot_t));
+        pos += sizeof(timeline_boot_t);
+    }
+
+    return pos - data;
+}
+
+void timeline_dump(void)
+{
+    uint8_t dump[TIMELINE_DUMP_SIZE];
+    uint32_t magic = TIMELINE_DUMP_MAGIC;
+    uint16_t size;
+    uint32_t crc;
+
+    memcpy(dump, &magic, 4);
+    size = 4 + timeline_export(dump + 4, sizeof(dump) - 8, 0);
+    crc = crc32_calculate_from_memory(dump, size);
+    memcpy(dump + size, &crc, 4);
+
+    // skip mode writes the whole dump or nothing
+    if (SEGGER_RTT_Write(TIMELINE_RTT_BUFFER, dump, size + 4) == 0)
+        LOG_WARN("timeline_dump: rtt buffer full");
+}
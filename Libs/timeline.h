@@ -0,0 +1,70 @@
+#ifndef TIMELINE_H_
+#define TIMELINE_H_
+
+#include "main.h"
+
+/* Boot timeline, the time every boot reaches each phase marker. The last
+ * TIMELINE_BOOTS boots are kept in a ring in the NOINIT RAM region, which
+ * warm resets leave alone, a power up starts an empty ring. SBP TQUERY
+ * reads the ring back and it is written to an RTT up buffer before the
+ * jump, Utils/timeline_report.py renders both. */
+#define TIMELINE_BOOTS 8
+#define TIMELINE_MARKS 16
+
+/* RTT up buffer of the dump */
+#define TIMELINE_RTT_BUFFER 3
+#define TIMELINE_RTT_BUFFER_SIZE 1024
+
+/* Ring as exported, little endian
+ *  | BOOTS | MARKS | RESERVED | RECORD ...        |
+ *  |   1   |   1   |     2    | 92 x BOOTS        |
+ *
+ *  - RECORD | SEQ 4 | RESET FLAGS 4 | COUNT 1 | RESERVED 3 |
+ *             PHASE 1 x MARKS | TIME US 4 x MARKS |
+ *    oldest first, the current boot last, COUNT markers valid
+ *
+ * The RTT dump wraps it as | MAGIC "TLN1" | RING | CRC |, CRC32-MPEG2 of
+ * everything before it */
+#define TIMELINE_DUMP_MAGIC 0x314E4C54
+
+/* Phase markers, the phase ends at its marker. Utils/timeline_report.py
+ * names them in the same order */
+typedef enum {
+    TIMELINE_MAIN = 0,          // main() entered, the time origin
+    TIMELINE_HAL_INIT,          // HAL_Init()
+    TIMELINE_SYSCLK,            // SystemClock_Config()
+    TIMELINE_CLOCK_PROFILE,     // switch to BOOT_CLOCK_PROFILE
+    TIMELINE_PERIPHERALS,       // GPIO, UART, serial and flash queue setup
+    TIMELINE_BOOT_INIT,         // boot_init()
+    TIMELINE_BUTTON,            // bootloader mode button window
+    TIMELINE_VALIDATE,          // image validation on a normal boot
+    TIMELINE_DOWNLOAD,          // bootloader mode until the download completed
+    TIMELINE_INSTALL,           // digest check and copy to the appslot
+    TIMELINE_JUMP,              // hand over to the application
+    TIMELINE_PHASES
+} timeline_phase_t;
+
+typedef struct {
+    uint32_t seq;               // boot number since the ring was cleared
+    uint32_t reset_flags;       // RCC_CSR at reset
+    uint8_t count;
+    uint8_t reserved[3];
+    uint8_t phase[TIMELINE_MARKS];
+    uint32_t us[TIMELINE_MARKS];
+} timeline_boot_t;
+
+/* first thing in main(), opens the record of this boot and starts the
+ * cycle counter */
+void timeline_init(void);
+
+/* this boot reached the phase marker */
+void timeline_mark(timeline_phase_t phase);
+
+/* copies the newest count boots (0 for all) in the export format, the
+ * bytes written or 0 when size is too small */
+uint16_t timeline_export(uint8_t *data, uint16_t size, uint8_t count);
+
+/* writes the ring to the RTT up buffer, nothing if it doesn't fit */
+void timeline_dump(void);
+
+#endif // TIMELINE_H_
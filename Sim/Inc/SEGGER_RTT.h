@@ -0,0 +1,16 @@
+#ifndef SEGGER_RTT_H
+#define SEGGER_RTT_H
+
+/* Host simulator stand-in for SEGGER RTT, terminal 0 goes to stderr and
+ * the binary up buffers to files in the --rtt directory */
+
+#include <stdarg.h>
+
+#define SEGGER_RTT_MODE_NO_BLOCK_SKIP (0)
+
+int SEGGER_RTT_printf(unsigned BufferIndex, const char *sFormat, ...);
+int SEGGER_RTT_ConfigUpBuffer(unsigned BufferIndex, const char *sName, void *pBuffer,
+                              unsigned BufferSize, unsigned Flags);
+unsigned SEGGER_RTT_Write(unsigned BufferIndex, const void *pBuffer, unsigned NumBytes);
+
+#endif // SEGGER_RTT_H
@@ -0,0 +1,54 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Simulator settings, set from the command line */
+typedef struct {
+    const char *flash_path;     // flash image file, kept between runs
+    double flash_time;          // scale of the F429 program/erase times, 0 is instant
+    const char *link_path;      // symlink created to the UART pseudo terminal
+    bool ideal_link;            // no line rate, bytes move as fast as the pty does
+    bool button;                // user button held, enters the bootloader mode
+    bool request;               // the application left HANDOFF_REQUEST_BOOTLOADER
+    uint32_t timeout;           // seconds before the simulator gives up, 0 never
+    const char *stats_path;     // counters written as JSON on exit
+    const char *rtt_path;       // directory of the RTT up buffer 1 and above files
+} sim_options_t;
+
+/* Counters of the simulated peripherals, reported on exit */
+typedef struct {
+    uint32_t flash_program_ops;
+    uint32_t flash_program_bytes;
+    uint32_t flash_erase_ops;
+    uint64_t flash_busy_ns;
+    uint64_t uart_rx_bytes;
+    uint64_t uart_tx_bytes;
+    uint64_t uart_rx_wire_ns;   // line time of the received bytes
+    uint64_t uart_tx_wire_ns;   // line time of the sent bytes
+    uint64_t crc_bytes;
+    uint64_t crc_ns;            // host time spent in the crc engine
+    bool jumped;                // ended by the jump to the application
+} sim_stats_t;
+
+extern sim_options_t sim_options;
+extern sim_stats_t sim_stats;
+
+/* monotonic time since the simulator started */
+uint64_t sim_time_ns(void);
+
+/* busy time of the simulated peripherals */
+void sim_wait_ns(uint64_t ns);
+
+/* flash array mapped at FLASH_BASE */
+int sim_flash_init(const char *path);
+
+/* completion time of the interrupt driven flash operation, 0 for none */
+uint64_t sim_flash_due_ns(void);
+
+/* raises the simulated interrupts whose time is up, the main loop
+ * calls it wherever the target would be interrupted */
+void sim_irq_poll(void);
+
+#endif // SIM_H_
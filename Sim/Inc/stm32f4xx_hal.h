@@ -0,0 +1,267 @@
+#ifndef STM32F4XX_HAL_H_
+#define STM32F4XX_HAL_H_
+
+/* Host simulator stand-in for the STM32F4 HAL, only the parts the
+ * bootloader uses. Flash is a RAM or file backed array mapped at the
+ * device address, see sim_flash.c */
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+/* memory map */
+#define FLASH_BASE 0x08000000UL
+#define FLASH_END 0x081FFFFFUL
+#define SRAM1_BASE 0x20000000UL
+
+/* core */
+typedef struct {
+    volatile uint32_t VTOR;
+} SCB_Type;
+
+extern SCB_Type sim_scb;
+#define SCB (&sim_scb)
+
+#define __DSB() do { } while (0)
+#define __ISB() do { } while (0)
+#define __disable_irq() do { } while (0)
+#define __enable_irq() do { } while (0)
+void __set_MSP(uint32_t msp);
+
+/* sleeps until the next simulated interrupt */
+void sim_wfi(void);
+#define __WFI() sim_wfi()
+
+/* nvic, only the flash interrupt is simulated */
+typedef enum {
+    FLASH_IRQn = 4
+} IRQn_Type;
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+void FLASH_IRQHandler(void);
+
+void HAL_Init(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
+
+/* flash */
+#define FLASH_TYPEPROGRAM_BYTE 0x00U
+#define FLASH_TYPEPROGRAM_HALFWORD 0x01U
+#define FLASH_TYPEPROGRAM_WORD 0x02U
+#define FLASH_TYPEPROGRAM_DOUBLEWORD 0x03U
+
+#define FLASH_VOLTAGE_RANGE_1 0x00U
+#define FLASH_VOLTAGE_RANGE_2 0x01U
+#define FLASH_VOLTAGE_RANGE_3 0x02U
+#define FLASH_VOLTAGE_RANGE_4 0x03U
+
+#define FLASH_TYPEERASE_SECTORS 0x00U
+#define FLASH_TYPEERASE_MASSERASE 0x01U
+
+#define FLASH_SECTOR_0 0U
+#define FLASH_SECTOR_1 1U
+#define FLASH_SECTOR_2 2U
+#define FLASH_SECTOR_3 3U
+#define FLASH_SECTOR_4 4U
+#define FLASH_SECTOR_5 5U
+#define FLASH_SECTOR_6 6U
+#define FLASH_SECTOR_7 7U
+#define FLASH_SECTOR_8 8U
+#define FLASH_SECTOR_9 9U
+#define FLASH_SECTOR_10 10U
+#define FLASH_SECTOR_11 11U
+#define FLASH_SECTOR_12 12U
+#define FLASH_SECTOR_13 13U
+#define FLASH_SECTOR_14 14U
+#define FLASH_SECTOR_15 15U
+#define FLASH_SECTOR_16 16U
+#define FLASH_SECTOR_17 17U
+#define FLASH_SECTOR_18 18U
+#define FLASH_SECTOR_19 19U
+#define FLASH_SECTOR_20 20U
+#define FLASH_SECTOR_21 21U
+#define FLASH_SECTOR_22 22U
+#define FLASH_SECTOR_23 23U
+
+#define FLASH_LATENCY_0 0U
+#define FLASH_LATENCY_1 1U
+#define FLASH_LATENCY_2 2U
+#define FLASH_LATENCY_3 3U
+#define FLASH_LATENCY_4 4U
+#define FLASH_LATENCY_5 5U
+
+/* access control register, only the ART accelerator bits are simulated */
+typedef struct {
+    volatile uint32_t ACR;
+} FLASH_TypeDef;
+
+extern FLASH_TypeDef sim_flash_regs;
+#define FLASH (&sim_flash_regs)
+
+#define FLASH_ACR_PRFTEN (1U << 8)
+#define FLASH_ACR_ICEN (1U << 9)
+#define FLASH_ACR_DCEN (1U << 10)
+#define FLASH_ACR_ICRST (1U << 11)
+#define FLASH_ACR_DCRST (1U << 12)
+
+#define __HAL_FLASH_PREFETCH_BUFFER_ENABLE() (FLASH->ACR |= FLASH_ACR_PRFTEN)
+#define __HAL_FLASH_PREFETCH_BUFFER_DISABLE() (FLASH->ACR &= ~FLASH_ACR_PRFTEN)
+#define __HAL_FLASH_INSTRUCTION_CACHE_ENABLE() (FLASH->ACR |= FLASH_ACR_ICEN)
+#define __HAL_FLASH_INSTRUCTION_CACHE_DISABLE() (FLASH->ACR &= ~FLASH_ACR_ICEN)
+#define __HAL_FLASH_INSTRUCTION_CACHE_RESET() do { \
+    FLASH->ACR |= FLASH_ACR_ICRST; \
+    FLASH->ACR &= ~FLASH_ACR_ICRST; \
+} while (0)
+#define __HAL_FLASH_DATA_CACHE_ENABLE() (FLASH->ACR |= FLASH_ACR_DCEN)
+#define __HAL_FLASH_DATA_CACHE_DISABLE() (FLASH->ACR &= ~FLASH_ACR_DCEN)
+#define __HAL_FLASH_DATA_CACHE_RESET() do { \
+    FLASH->ACR |= FLASH_ACR_DCRST; \
+    FLASH->ACR &= ~FLASH_ACR_DCRST; \
+} while (0)
+
+typedef struct {
+    uint32_t TypeErase;
+    uint32_t Banks;
+    uint32_t Sector;
+    uint32_t NbSectors;
+    uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
+
+/* interrupt driven, the operation completes after its modelled time in
+ * the FLASH_IRQHandler the simulator calls */
+HAL_StatusTypeDef HAL_FLASH_Program_IT(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase_IT(FLASH_EraseInitTypeDef *pEraseInit);
+void HAL_FLASH_IRQHandler(void);
+void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue);
+void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue);
+
+/* reset and clock control, only the reset flags are registers */
+typedef struct {
+    volatile uint32_t CSR;
+} RCC_TypeDef;
+
+extern RCC_TypeDef sim_rcc;
+#define RCC (&sim_rcc)
+
+/* clocks, oscillators as set in stm32f4xx_hal_conf.h */
+#define HSE_VALUE 25000000U
+#define HSI_VALUE 16000000U
+
+#define RCC_OSCILLATORTYPE_NONE 0x00U
+#define RCC_OSCILLATORTYPE_HSE 0x01U
+#define RCC_OSCILLATORTYPE_HSI 0x02U
+#define RCC_HSE_OFF 0x00U
+#define RCC_HSE_ON 0x01U
+#define RCC_HSI_OFF 0x00U
+#define RCC_HSI_ON 0x01U
+#define RCC_HSICALIBRATION_DEFAULT 0x10U
+#define RCC_PLL_NONE 0x00U
+#define RCC_PLL_OFF 0x01U
+#define RCC_PLL_ON 0x02U
+#define RCC_PLLSOURCE_HSI 0x00U
+#define RCC_PLLSOURCE_HSE 0x01U
+#define RCC_PLLP_DIV2 0x02U
+#define RCC_PLLP_DIV4 0x04U
+#define RCC_PLLP_DIV6 0x06U
+#define RCC_PLLP_DIV8 0x08U
+
+#define RCC_CLOCKTYPE_SYSCLK 0x01U
+#define RCC_CLOCKTYPE_HCLK 0x02U
+#define RCC_CLOCKTYPE_PCLK1 0x04U
+#define RCC_CLOCKTYPE_PCLK2 0x08U
+#define RCC_SYSCLKSOURCE_HSI 0x00U
+#define RCC_SYSCLKSOURCE_HSE 0x01U
+#define RCC_SYSCLKSOURCE_PLLCLK 0x02U
+#define RCC_SYSCLK_DIV1 0x00U
+#define RCC_HCLK_DIV1 0x00U
+#define RCC_HCLK_DIV2 0x04U
+#define RCC_HCLK_DIV4 0x05U
+
+#define PWR_REGULATOR_VOLTAGE_SCALE1 0x0000C000U
+#define PWR_REGULATOR_VOLTAGE_SCALE2 0x00008000U
+#define PWR_REGULATOR_VOLTAGE_SCALE3 0x00004000U
+
+typedef struct {
+    uint32_t PLLState;
+    uint32_t PLLSource;
+    uint32_t PLLM;
+    uint32_t PLLN;
+    uint32_t PLLP;
+    uint32_t PLLQ;
+} RCC_PLLInitTypeDef;
+
+typedef struct {
+    uint32_t OscillatorType;
+    uint32_t HSEState;
+    uint32_t LSEState;
+    uint32_t HSIState;
+    uint32_t HSICalibrationValue;
+    uint32_t LSIState;
+    RCC_PLLInitTypeDef PLL;
+} RCC_OscInitTypeDef;
+
+typedef struct {
+    uint32_t ClockType;
+    uint32_t SYSCLKSource;
+    uint32_t AHBCLKDivider;
+    uint32_t APB1CLKDivider;
+    uint32_t APB2CLKDivider;
+} RCC_ClkInitTypeDef;
+
+#define __HAL_RCC_PWR_CLK_ENABLE() do { } while (0)
+
+/* regulator output scale, PWR_CR VOS */
+extern uint32_t sim_pwr_vos;
+#define __HAL_PWR_VOLTAGESCALING_CONFIG(scale) (sim_pwr_vos = (scale))
+
+HAL_StatusTypeDef HAL_PWREx_EnableOverDrive(void);
+HAL_StatusTypeDef HAL_PWREx_DisableOverDrive(void);
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct);
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency);
+uint32_t HAL_RCC_GetHCLKFreq(void);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+
+/* gpio */
+typedef struct {
+    uint32_t pins;          // input pins reading high
+} GPIO_TypeDef;
+
+typedef enum {
+    GPIO_PIN_RESET = 0,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+#define GPIO_PIN_0 ((uint16_t) 0x0001)
+#define GPIO_PIN_13 ((uint16_t) 0x2000)
+#define GPIO_PIN_14 ((uint16_t) 0x4000)
+
+extern GPIO_TypeDef sim_gpioa;
+extern GPIO_TypeDef sim_gpiog;
+#define GPIOA (&sim_gpioa)
+#define GPIOG (&sim_gpiog)
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+
+/* uart, the link itself is the pseudo terminal of sim_serial.c */
+typedef struct {
+    uint32_t baud;
+} UART_HandleTypeDef;
+
+#endif // STM32F4XX_HAL_H_
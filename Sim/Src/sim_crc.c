@@ -0,0 +1,37 @@
+#include "crc32.h"
+#include "sim.h"
+
+/* The crc32 entry points are wrapped at link time (-Wl,--wrap), the
+ * engine itself stays the one of Libs/crc32.c */
+void __real_crc32_update(crc32_ctx_t *ctx, const uint8_t *data, size_t length);
+uint32_t __real_crc32_calculate_from_flash(uint32_t addr, size_t length);
+uint32_t __real_crc32_calculate_from_memory(uint8_t *data, size_t length);
+
+void __wrap_crc32_update(crc32_ctx_t *ctx, const uint8_t *data, size_t length)
+{
+    uint64_t start = sim_time_ns();
+
+    __real_crc32_update(ctx, data, length);
+    sim_stats.crc_ns += sim_time_ns() - start;
+    sim_stats.crc_bytes += length;
+}
+
+uint32_t __wrap_crc32_calculate_from_flash(uint32_t addr, size_t length)
+{
+    uint64_t start = sim_time_ns();
+    uint32_t crc = __real_crc32_calculate_from_flash(addr, length);
+
+    sim_stats.crc_ns += sim_time_ns() - start;
+    sim_stats.crc_bytes += length;
+    return crc;
+}
+
+uint32_t __wrap_crc32_calculate_from_memory(uint8_t *data, size_t length)
+{
+    uint64_t start = sim_time_ns();
+    uint32_t crc = __real_crc32_calculate_from_memory(data, length);
+
+    sim_stats.crc_ns += sim_time_ns() - start;
+    sim_stats.crc_bytes += length;
+    return crc;
+}
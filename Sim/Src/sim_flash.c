@@ -0,0 +1,284 @@
+#include "stm32f4xx_hal.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define SIM_FLASH_SIZE (FLASH_END - FLASH_BASE + 1)
+
+/* Typical F429 timings (datasheet, x8 / x16 / x32 parallelism), a
+ * program operation takes the same time whatever its width */
+#define SIM_PROGRAM_NS 16000
+static const uint32_t sim_erase_16k_ms[] = {400, 300, 250, 250};
+static const uint32_t sim_erase_64k_ms[] = {1200, 700, 550, 550};
+static const uint32_t sim_erase_128k_ms[] = {2000, 1300, 1000, 1000};
+
+static uint8_t *sim_flash;
+static bool sim_flash_locked = true;
+
+/* Operation started by an _IT call, it completes once its time is up */
+typedef struct {
+    bool pending;
+    bool erase;
+    uint32_t addr;          // program address or erased sector
+    uint32_t width;
+    uint64_t data;
+    uint64_t due_ns;
+} sim_flash_op_t;
+
+static sim_flash_op_t sim_flash_op;
+
+static uint64_t sim_flash_scale(uint64_t ns)
+{
+    ns = (uint64_t) (ns * sim_options.flash_time);
+    sim_stats.flash_busy_ns += ns;
+    return ns;
+}
+
+static void sim_flash_busy(uint64_t ns)
+{
+    sim_wait_ns(sim_flash_scale(ns));
+}
+
+/* both banks are 4 x 16 KB, 1 x 64 KB and 7 x 128 KB */
+static uint32_t sim_sector_addr(uint32_t sector, uint32_t *size)
+{
+    uint32_t bank = FLASH_BASE + (sector / 12) * 0x100000;
+    uint32_t index = sector % 12;
+
+    if (index < 4) {
+        *size = 16 * 1024;
+        return bank + index * 16 * 1024;
+    }
+
+    if (index == 4) {
+        *size = 64 * 1024;
+        return bank + 64 * 1024;
+    }
+
+    *size = 128 * 1024;
+    return bank + (index - 4) * 128 * 1024;
+}
+
+int sim_flash_init(const char *path)
+{
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror("sim: flash image");
+        return -1;
+    }
+
+    // a new image starts out erased
+    if (lseek(fd, 0, SEEK_END) < SIM_FLASH_SIZE) {
+        uint8_t erased[4096];
+
+        memset(erased, 0xFF, sizeof(erased));
+        lseek(fd, 0, SEEK_SET);
+        for (uint32_t i = 0; i < SIM_FLASH_SIZE; i += sizeof(erased)) {
+            if (write(fd, erased, sizeof(erased)) != sizeof(erased)) {
+                perror("sim: flash image");
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    // at the device address, the bootloader passes flash addresses around
+    // as 32 bit integers
+    map = mmap((void *) FLASH_BASE, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+
+    if (map != (void *) FLASH_BASE) {
+        perror("sim: flash mapping");
+        return -1;
+    }
+
+    sim_flash = map;
+    return 0;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+    sim_flash_locked = false;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+    sim_flash_locked = true;
+    return HAL_OK;
+}
+
+static HAL_StatusTypeDef sim_flash_check_program(uint32_t Address, uint32_t width)
+{
+    if (sim_flash_op.pending)
+        return HAL_BUSY;
+
+    if (sim_flash_locked || Address < FLASH_BASE || Address + width - 1 > FLASH_END ||
+        (Address % width) != 0) {
+        fprintf(stderr, "sim: program error at %08x\n", Address);
+        return HAL_ERROR;
+    }
+
+    sim_stats.flash_program_ops++;
+    sim_stats.flash_program_bytes += width;
+    return HAL_OK;
+}
+
+static HAL_StatusTypeDef sim_flash_write(uint32_t Address, uint32_t width, uint64_t Data)
+{
+    uint8_t *cell = sim_flash + (Address - FLASH_BASE);
+    uint8_t value;
+
+    // programming only clears bits, asking for a set bit is an error
+    for (uint32_t i = 0; i < width; i++) {
+        value = (uint8_t) (Data >> (8 * i));
+        if ((cell[i] & value) != value) {
+            fprintf(stderr, "sim: program of a non erased cell at %08x\n", Address + i);
+            return HAL_ERROR;
+        }
+        cell[i] &= value;
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+    uint32_t width = 1U << TypeProgram;
+    HAL_StatusTypeDef ret;
+
+    ret = sim_flash_check_program(Address, width);
+    if (ret != HAL_OK)
+        return ret;
+
+    sim_flash_busy(SIM_PROGRAM_NS);
+    return sim_flash_write(Address, width, Data);
+}
+
+static HAL_StatusTypeDef sim_flash_check_erase(FLASH_EraseInitTypeDef *pEraseInit)
+{
+    if (sim_flash_op.pending)
+        return HAL_BUSY;
+
+    if (sim_flash_locked || pEraseInit->TypeErase != FLASH_TYPEERASE_SECTORS ||
+        pEraseInit->Sector + pEraseInit->NbSectors > 24 || pEraseInit->VoltageRange > FLASH_VOLTAGE_RANGE_4) {
+        fprintf(stderr, "sim: erase error\n");
+        return HAL_ERROR;
+    }
+
+    return HAL_OK;
+}
+
+static uint64_t sim_flash_erase_ns(uint32_t sector, uint32_t range)
+{
+    uint32_t size;
+
+    sim_sector_addr(sector, &size);
+    if (size == 16 * 1024)
+        return sim_erase_16k_ms[range] * 1000000ULL;
+    if (size == 64 * 1024)
+        return sim_erase_64k_ms[range] * 1000000ULL;
+    return sim_erase_128k_ms[range] * 1000000ULL;
+}
+
+static void sim_flash_erase_sector(uint32_t sector)
+{
+    uint32_t addr;
+    uint32_t size;
+
+    addr = sim_sector_addr(sector, &size);
+    memset(sim_flash + (addr - FLASH_BASE), 0xFF, size);
+    sim_stats.flash_erase_ops++;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError)
+{
+    HAL_StatusTypeDef ret;
+
+    *SectorError = 0xFFFFFFFFU;
+
+    ret = sim_flash_check_erase(pEraseInit);
+    if (ret != HAL_OK)
+        return ret;
+
+    for (uint32_t sector = pEraseInit->Sector; sector < pEraseInit->Sector + pEraseInit->NbSectors; sector++) {
+        sim_flash_erase_sector(sector);
+        sim_flash_busy(sim_flash_erase_ns(sector, pEraseInit->VoltageRange));
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program_IT(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+    uint32_t width = 1U << TypeProgram;
+    HAL_StatusTypeDef ret;
+
+    ret = sim_flash_check_program(Address, width);
+    if (ret != HAL_OK)
+        return ret;
+
+    // the cells change when the operation completes
+    sim_flash_op.pending = true;
+    sim_flash_op.erase = false;
+    sim_flash_op.addr = Address;
+    sim_flash_op.width = width;
+    sim_flash_op.data = Data;
+    sim_flash_op.due_ns = sim_time_ns() + sim_flash_scale(SIM_PROGRAM_NS);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase_IT(FLASH_EraseInitTypeDef *pEraseInit)
+{
+    HAL_StatusTypeDef ret;
+
+    ret = sim_flash_check_erase(pEraseInit);
+    if (ret != HAL_OK)
+        return ret;
+
+    // one sector per operation, the way the flash job queue uses it
+    if (pEraseInit->NbSectors != 1) {
+        fprintf(stderr, "sim: interrupt driven erase of %u sectors\n", pEraseInit->NbSectors);
+        return HAL_ERROR;
+    }
+
+    // the sector reads as before until the erase completes
+    sim_flash_op.pending = true;
+    sim_flash_op.erase = true;
+    sim_flash_op.addr = pEraseInit->Sector;
+    sim_flash_op.due_ns = sim_time_ns() +
+        sim_flash_scale(sim_flash_erase_ns(pEraseInit->Sector, pEraseInit->VoltageRange));
+    return HAL_OK;
+}
+
+void HAL_FLASH_IRQHandler(void)
+{
+    sim_flash_op_t op = sim_flash_op;
+
+    if (!op.pending || sim_time_ns() < op.due_ns)
+        return;
+
+    sim_flash_op.pending = false;
+
+    if (op.erase) {
+        sim_flash_erase_sector(op.addr);
+        HAL_FLASH_EndOfOperationCallback(0xFFFFFFFFU);
+    } else if (sim_flash_write(op.addr, op.width, op.data) != HAL_OK) {
+        HAL_FLASH_OperationErrorCallback(op.addr);
+    } else {
+        HAL_FLASH_EndOfOperationCallback(op.addr);
+    }
+}
+
+uint64_t sim_flash_due_ns(void)
+{
+    return sim_flash_op.pending ? sim_flash_op.due_ns : 0;
+}
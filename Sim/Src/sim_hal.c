@@ -0,0 +1,288 @@
+#include "main.h"
+#include "usart.h"
+#include "gpio.h"
+#include "flash_job.h"
+#include "handoff.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+SCB_Type sim_scb;
+FLASH_TypeDef sim_flash_regs;
+
+/* power on and pin reset flags, as after a power up */
+RCC_TypeDef sim_rcc = {.CSR = 0x0C000000};
+GPIO_TypeDef sim_gpioa;
+GPIO_TypeDef sim_gpiog;
+UART_HandleTypeDef huart5;
+
+static uint64_t sim_start_ns = 0;
+static uint64_t sim_busy_until_ns = 0;
+
+/* Flash interrupt enabled in the NVIC, and an interrupt is being served */
+static bool sim_flash_irq_enabled = false;
+static bool sim_in_irq = false;
+
+/* Clock tree as configured through the RCC and PWR calls, out of reset */
+static RCC_PLLInitTypeDef sim_pll = {.PLLState = RCC_PLL_OFF};
+static uint32_t sim_hse_state = RCC_HSE_OFF;
+static uint32_t sim_sysclk_source = RCC_SYSCLKSOURCE_HSI;
+static uint32_t sim_apb1_divider = RCC_HCLK_DIV1;
+static bool sim_overdrive = false;
+uint32_t sim_pwr_vos = PWR_REGULATOR_VOLTAGE_SCALE1;
+
+static uint64_t sim_clock_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint64_t sim_time_ns(void)
+{
+    if (sim_start_ns == 0)
+        sim_start_ns = sim_clock_ns();
+
+    return sim_clock_ns() - sim_start_ns;
+}
+
+void sim_wait_ns(uint64_t ns)
+{
+    uint64_t now = sim_time_ns();
+    struct timespec delay;
+
+    // short waits add up and are slept off together, a sleep call
+    // costs more than a flash word program
+    if (sim_busy_until_ns < now)
+        sim_busy_until_ns = now;
+    sim_busy_until_ns += ns;
+
+    if (sim_busy_until_ns - now < 1000000)
+        return;
+
+    delay.tv_sec = (sim_busy_until_ns - now) / 1000000000ULL;
+    delay.tv_nsec = (sim_busy_until_ns - now) % 1000000000ULL;
+    nanosleep(&delay, NULL);
+}
+
+void HAL_Init(void)
+{
+    sim_time_ns();
+
+    // the ART accelerator as enabled in stm32f4xx_hal_conf.h
+    FLASH->ACR |= FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN;
+}
+
+void sim_irq_poll(void)
+{
+    uint64_t due = sim_flash_due_ns();
+
+    // interrupts don't nest, and a masked one stays pending
+    if (sim_in_irq || !sim_flash_irq_enabled || due == 0 || due > sim_time_ns())
+        return;
+
+    sim_in_irq = true;
+    FLASH_IRQHandler();
+    sim_in_irq = false;
+}
+
+void sim_wfi(void)
+{
+    uint64_t due = sim_flash_due_ns();
+    struct timespec delay = {0, 100000};
+
+    // a word program is over long before a sleep call returns, spin for
+    // the flash operations about to complete and sleep a while otherwise
+    if (due != 0 && due < sim_time_ns() + 1000000) {
+        while (sim_time_ns() < due);
+    } else {
+        nanosleep(&delay, NULL);
+    }
+
+    sim_irq_poll();
+}
+
+/* as in stm32f4xx_it.c */
+void FLASH_IRQHandler(void)
+{
+    flash_job_irq_handler();
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+    (void) IRQn;
+    (void) PreemptPriority;
+    (void) SubPriority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    if (IRQn == FLASH_IRQn)
+        sim_flash_irq_enabled = true;
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    if (IRQn == FLASH_IRQn)
+        sim_flash_irq_enabled = false;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    sim_irq_poll();
+    return (uint32_t) (sim_time_ns() / 1000000);
+}
+
+void HAL_Delay(uint32_t delay)
+{
+    uint32_t start = HAL_GetTick();
+
+    while (HAL_GetTick() - start < delay);
+}
+
+void __set_MSP(uint32_t msp)
+{
+    uint32_t reset = *((volatile uint32_t *) (uintptr_t) (SCB->VTOR + 4));
+
+    // the application can't run on the host, the jump ends the simulation
+    fprintf(stderr, "sim: jump to application, vtor %08x msp %08x reset %08x at %.3f s\n",
+            SCB->VTOR, msp, reset, sim_time_ns() / 1e9);
+
+    // what the application would find at HANDOFF_ADDR
+    if (handoff_check(&handoff_block)) {
+        fprintf(stderr, "sim: handoff reason %u flags %x image %08x size %u crc %08x slot %u, phases (us)",
+                handoff_block.reason, handoff_block.flags, handoff_block.image_addr, handoff_block.image_size,
+                handoff_block.image_crc, handoff_block.slot);
+        for (int i = 0; i < HANDOFF_PHASES; i++)
+            fprintf(stderr, " %u", handoff_block.phase_us[i]);
+        fprintf(stderr, "\n");
+    } else {
+        fprintf(stderr, "sim: handoff block invalid\n");
+    }
+    sim_stats.jumped = true;
+    exit(0);
+}
+
+static uint32_t sim_sysclk_freq(uint32_t source)
+{
+    uint32_t input;
+
+    if (source == RCC_SYSCLKSOURCE_HSE)
+        return HSE_VALUE;
+
+    if (source != RCC_SYSCLKSOURCE_PLLCLK || sim_pll.PLLM == 0 || sim_pll.PLLP == 0)
+        return HSI_VALUE;
+
+    input = (sim_pll.PLLSource == RCC_PLLSOURCE_HSE) ? HSE_VALUE : HSI_VALUE;
+    return (uint32_t) ((uint64_t) input / sim_pll.PLLM * sim_pll.PLLN / sim_pll.PLLP);
+}
+
+/* the rules the hardware enforces, or would break on, are failures here */
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct)
+{
+    bool pll_hse = sim_pll.PLLState == RCC_PLL_ON && sim_pll.PLLSource == RCC_PLLSOURCE_HSE;
+
+    if (RCC_OscInitStruct->OscillatorType & RCC_OSCILLATORTYPE_HSE) {
+        if (RCC_OscInitStruct->HSEState == RCC_HSE_OFF &&
+            (sim_sysclk_source == RCC_SYSCLKSOURCE_HSE || pll_hse))
+            return HAL_ERROR;
+        sim_hse_state = RCC_OscInitStruct->HSEState;
+    }
+
+    if (RCC_OscInitStruct->PLL.PLLState != RCC_PLL_NONE) {
+        if (sim_sysclk_source == RCC_SYSCLKSOURCE_PLLCLK)
+            return HAL_ERROR;
+        if (RCC_OscInitStruct->PLL.PLLState == RCC_PLL_ON &&
+            RCC_OscInitStruct->PLL.PLLSource == RCC_PLLSOURCE_HSE && sim_hse_state != RCC_HSE_ON)
+            return HAL_ERROR;
+        sim_pll = RCC_OscInitStruct->PLL;
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency)
+{
+    uint32_t source = RCC_ClkInitStruct->SYSCLKSource;
+    uint32_t freq = sim_sysclk_freq(source);
+    uint32_t max = 120000000;
+
+    if (sim_pwr_vos == PWR_REGULATOR_VOLTAGE_SCALE1)
+        max = sim_overdrive ? 180000000 : 168000000;
+    else if (sim_pwr_vos == PWR_REGULATOR_VOLTAGE_SCALE2)
+        max = sim_overdrive ? 168000000 : 144000000;
+    if (freq > max)
+        return HAL_ERROR;
+
+    if (source == RCC_SYSCLKSOURCE_PLLCLK && sim_pll.PLLState != RCC_PLL_ON)
+        return HAL_ERROR;
+    if (source == RCC_SYSCLKSOURCE_HSE && sim_hse_state != RCC_HSE_ON)
+        return HAL_ERROR;
+
+    // 30 MHz per wait state at 2.7 to 3.6 V
+    if (FLatency < (freq - 1) / 30000000)
+        return HAL_ERROR;
+
+    sim_sysclk_source = source;
+    sim_apb1_divider = RCC_ClkInitStruct->APB1CLKDivider;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PWREx_EnableOverDrive(void)
+{
+    if (sim_pll.PLLState != RCC_PLL_ON || sim_pwr_vos != PWR_REGULATOR_VOLTAGE_SCALE1)
+        return HAL_ERROR;
+
+    sim_overdrive = true;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PWREx_DisableOverDrive(void)
+{
+    if (sim_sysclk_source == RCC_SYSCLKSOURCE_PLLCLK)
+        return HAL_ERROR;
+
+    sim_overdrive = false;
+    return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void)
+{
+    return sim_sysclk_freq(sim_sysclk_source);
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+    if (sim_apb1_divider >= RCC_HCLK_DIV2)
+        return HAL_RCC_GetHCLKFreq() >> (sim_apb1_divider - RCC_HCLK_DIV2 + 1);
+
+    return HAL_RCC_GetHCLKFreq();
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->pins & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    if (PinState == GPIO_PIN_SET)
+        GPIOx->pins |= GPIO_Pin;
+    else
+        GPIOx->pins &= ~GPIO_Pin;
+}
+
+void MX_GPIO_Init(void)
+{
+    // the user button of the discovery board
+    if (sim_options.button)
+        sim_gpioa.pins |= GPIO_PIN_0;
+}
+
+void MX_UART5_Init(void)
+{
+    huart5.baud = 115200;
+}
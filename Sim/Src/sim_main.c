@@ -0,0 +1,147 @@
+#include "main.h"
+#include "sim.h"
+#include "handoff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include <unistd.h>
+
+/* main() of Core/Src/main.c, renamed for the simulator build */
+#undef main
+int sim_app_main(void);
+
+sim_options_t sim_options = {
+    .flash_path = "sim_flash.bin",
+    .flash_time = 1.0,
+    .link_path = NULL,
+    .ideal_link = false,
+    .button = false,
+    .request = false,
+    .timeout = 0,
+    .stats_path = NULL,
+    .rtt_path = NULL,
+};
+
+sim_stats_t sim_stats;
+
+static void sim_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --flash FILE        flash image, kept between runs (default sim_flash.bin)\n"
+            "  --flash-time SCALE  scale of the F429 program and erase times, 0 is instant (default 1)\n"
+            "  --link PATH         symlink to the UART pseudo terminal\n"
+            "  --ideal-link        no line rate, the UART is as fast as the pty\n"
+            "  --button            hold the user button, enters the bootloader mode\n"
+            "  --request           boot after the application requested the bootloader mode\n"
+            "  --timeout SECONDS   give up after this long\n"
+            "  --stats FILE        write the counters as JSON on exit\n"
+            "  --rtt DIR           append RTT up buffer N (profile dumps, binary log) to DIR/rtt<N>.bin\n",
+            name);
+}
+
+static void sim_report(void)
+{
+    FILE *json;
+
+    fprintf(stderr, "sim: flash %u program ops, %u bytes, %u sector erases, %.3f s busy\n",
+            sim_stats.flash_program_ops, sim_stats.flash_program_bytes,
+            sim_stats.flash_erase_ops, sim_stats.flash_busy_ns / 1e9);
+    fprintf(stderr, "sim: uart %llu bytes received, %llu bytes sent, %.3f s on the line\n",
+            (unsigned long long) sim_stats.uart_rx_bytes, (unsigned long long) sim_stats.uart_tx_bytes,
+            (sim_stats.uart_rx_wire_ns + sim_stats.uart_tx_wire_ns) / 1e9);
+    fprintf(stderr, "sim: crc %llu bytes\n", (unsigned long long) sim_stats.crc_bytes);
+
+    if (sim_options.stats_path == NULL)
+        return;
+
+    json = fopen(sim_options.stats_path, "w");
+    if (json == NULL) {
+        perror("sim: stats");
+        return;
+    }
+
+    fprintf(json, "{\"time_s\": %.6f, \"jumped\": %s, "
+            "\"flash_program_ops\": %u, \"flash_program_bytes\": %u, "
+            "\"flash_erase_ops\": %u, \"flash_busy_s\": %.6f, "
+            "\"uart_rx_bytes\": %llu, \"uart_tx_bytes\": %llu, "
+            "\"uart_rx_wire_s\": %.6f, \"uart_tx_wire_s\": %.6f, "
+            "\"crc_bytes\": %llu, \"crc_host_s\": %.6f}\n",
+            sim_time_ns() / 1e9, sim_stats.jumped ? "true" : "false",
+            sim_stats.flash_program_ops, sim_stats.flash_program_bytes,
+            sim_stats.flash_erase_ops, sim_stats.flash_busy_ns / 1e9,
+            (unsigned long long) sim_stats.uart_rx_bytes, (unsigned long long) sim_stats.uart_tx_bytes,
+            sim_stats.uart_rx_wire_ns / 1e9, sim_stats.uart_tx_wire_ns / 1e9,
+            (unsigned long long) sim_stats.crc_bytes, sim_stats.crc_ns / 1e9);
+    fclose(json);
+}
+
+static void sim_stop(int sig)
+{
+    (void) sig;
+    exit(1);
+}
+
+static void sim_alarm(int sig)
+{
+    (void) sig;
+    fprintf(stderr, "sim: timeout\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"flash", required_argument, NULL, 'f'},
+        {"flash-time", required_argument, NULL, 't'},
+        {"link", required_argument, NULL, 'l'},
+        {"ideal-link", no_argument, NULL, 'i'},
+        {"button", no_argument, NULL, 'b'},
+        {"request", no_argument, NULL, 'R'},
+        {"timeout", required_argument, NULL, 'T'},
+        {"stats", required_argument, NULL, 's'},
+        {"rtt", required_argument, NULL, 'r'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "f:t:l:ibRT:s:r:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'f': sim_options.flash_path = optarg; break;
+        case 't': sim_options.flash_time = atof(optarg); break;
+        case 'l': sim_options.link_path = optarg; break;
+        case 'i': sim_options.ideal_link = true; break;
+        case 'b': sim_options.button = true; break;
+        case 'R': sim_options.request = true; break;
+        case 'T': sim_options.timeout = atoi(optarg); break;
+        case 's': sim_options.stats_path = optarg; break;
+        case 'r': sim_options.rtt_path = optarg; break;
+        default:
+            sim_usage(argv[0]);
+            return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (sim_flash_init(sim_options.flash_path) != 0)
+        return 1;
+
+    atexit(sim_report);
+    signal(SIGINT, sim_stop);
+    signal(SIGTERM, sim_stop);
+
+    if (sim_options.timeout != 0) {
+        signal(SIGALRM, sim_alarm);
+        alarm(sim_options.timeout);
+    }
+
+    // what the application leaves at HANDOFF_REQUEST_ADDR before its reset
+    if (sim_options.request) {
+        handoff_request_word.request = HANDOFF_REQUEST_BOOTLOADER;
+        handoff_request_word.check = ~HANDOFF_REQUEST_BOOTLOADER;
+    }
+
+    return sim_app_main();
+}
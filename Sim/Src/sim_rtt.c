@@ -0,0 +1,106 @@
+#include "SEGGER_RTT.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* The buffers are never read back, a host attached to the target drains
+ * them as they fill */
+int SEGGER_RTT_ConfigUpBuffer(unsigned BufferIndex, const char *sName, void *pBuffer,
+                              unsigned BufferSize, unsigned Flags)
+{
+    (void) BufferIndex;
+    (void) sName;
+    (void) pBuffer;
+    (void) BufferSize;
+    (void) Flags;
+    return 0;
+}
+
+unsigned SEGGER_RTT_Write(unsigned BufferIndex, const void *pBuffer, unsigned NumBytes)
+{
+    char path[512];
+    FILE *file;
+
+    if (BufferIndex == 0)
+        return fwrite(pBuffer, 1, NumBytes, stderr);
+
+    if (sim_options.rtt_path == NULL)
+        return NumBytes;
+
+    snprintf(path, sizeof(path), "%s/rtt%u.bin", sim_options.rtt_path, BufferIndex);
+    file = fopen(path, "ab");
+    if (file == NULL)
+        return 0;
+    NumBytes = fwrite(pBuffer, 1, NumBytes, file);
+    fclose(file);
+    return NumBytes;
+}
+
+/* Same conversions as SEGGER_RTT_printf, every integer argument is read
+ * as a 32 bit int like on the target, whatever its length modifier */
+int SEGGER_RTT_printf(unsigned BufferIndex, const char *sFormat, ...)
+{
+    char spec[16];
+    char out[512];
+    size_t used = 0;
+    size_t len;
+    va_list args;
+
+    (void) BufferIndex;
+    va_start(args, sFormat);
+
+    while (*sFormat != '\0' && used < sizeof(out) - 1) {
+        if (*sFormat != '%') {
+            if (*sFormat != '\r')
+                out[used++] = *sFormat;
+            sFormat++;
+            continue;
+        }
+
+        // copy flags and width, drop the length modifier
+        len = 0;
+        spec[len++] = *sFormat++;
+        while (strchr("-0123456789", *sFormat) != NULL && *sFormat != '\0' && len < sizeof(spec) - 3)
+            spec[len++] = *sFormat++;
+        while (*sFormat == 'l' || *sFormat == 'h')
+            sFormat++;
+        spec[len++] = *sFormat;
+        spec[len] = '\0';
+
+        switch (*sFormat) {
+        case 'd':
+            used += snprintf(out + used, sizeof(out) - used, spec, va_arg(args, int));
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+            used += snprintf(out + used, sizeof(out) - used, spec, va_arg(args, unsigned));
+            break;
+        case 's':
+            used += snprintf(out + used, sizeof(out) - used, spec, va_arg(args, const char *));
+            break;
+        case 'p':
+            used += snprintf(out + used, sizeof(out) - used, "%08x", va_arg(args, unsigned));
+            break;
+        case '%':
+            out[used++] = '%';
+            break;
+        default:
+            va_end(args);
+            return -1;
+        }
+
+        if (*sFormat != '\0')
+            sFormat++;
+        if (used > sizeof(out) - 1)
+            used = sizeof(out) - 1;
+    }
+
+    va_end(args);
+
+    out[used] = '\0';
+    fputs(out, stderr);
+    return (int) used;
+}
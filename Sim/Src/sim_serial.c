@@ -0,0 +1,211 @@
+#include "serial.h"
+#include "ring.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+/* Line idle after this many character times without a byte */
+#define SIM_IDLE_CHARS 2
+
+static int sim_serial_fd = -1;
+static int sim_serial_slave_fd = -1;
+static uint32_t sim_serial_baud = 115200;
+
+static ring_t sim_rx_ring;
+static uint8_t sim_rx_buf[SERIAL_RX_BUFFER_SIZE];
+
+/* Bytes read from the pty are still on the line until this time */
+static uint64_t sim_rx_wire_until_ns = 0;
+
+static uint64_t sim_char_ns(void)
+{
+    // 8N1, ten bit times per character
+    return sim_options.ideal_link ? 0 : 10000000000ULL / sim_serial_baud;
+}
+
+static void sim_serial_pump(void)
+{
+    uint8_t buf[512];
+    uint64_t now;
+    ssize_t len;
+    uint32_t space;
+
+    // the flash interrupt comes in while the bootloader polls the link
+    sim_irq_poll();
+
+    for (;;) {
+        space = ring_space(&sim_rx_ring);
+        if (space == 0)
+            return;
+
+        len = read(sim_serial_fd, buf, space < sizeof(buf) ? space : sizeof(buf));
+        if (len <= 0)
+            return;
+
+        // the bytes take their line time to arrive, after what is already
+        // on the line
+        now = sim_time_ns();
+        if (sim_rx_wire_until_ns < now)
+            sim_rx_wire_until_ns = now;
+        sim_rx_wire_until_ns += len * sim_char_ns();
+
+        ring_put(&sim_rx_ring, buf, len);
+        sim_stats.uart_rx_bytes += len;
+        sim_stats.uart_rx_wire_ns += len * sim_char_ns();
+    }
+}
+
+int serial_init(void)
+{
+    struct termios tio;
+    const char *name;
+
+    ring_init(&sim_rx_ring, sim_rx_buf, sizeof(sim_rx_buf));
+
+    sim_serial_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (sim_serial_fd < 0 || grantpt(sim_serial_fd) != 0 || unlockpt(sim_serial_fd) != 0) {
+        perror("sim: pty");
+        return -1;
+    }
+
+    name = ptsname(sim_serial_fd);
+
+    // keep the slave open, the master would read EIO between two host
+    // tool sessions otherwise
+    sim_serial_slave_fd = open(name, O_RDWR | O_NOCTTY);
+    if (sim_serial_slave_fd < 0 || tcgetattr(sim_serial_slave_fd, &tio) != 0) {
+        perror("sim: pty");
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(sim_serial_slave_fd, TCSANOW, &tio);
+
+    if (sim_options.link_path != NULL) {
+        unlink(sim_options.link_path);
+        if (symlink(name, sim_options.link_path) != 0) {
+            perror("sim: uart link");
+            return -1;
+        }
+        name = sim_options.link_path;
+    }
+
+    fprintf(stderr, "sim: uart on %s\n", name);
+    return 0;
+}
+
+void serial_deinit(void)
+{
+    // the pty stays open, the simulation ends at the jump
+}
+
+uint32_t serial_available(void)
+{
+    uint64_t now;
+    uint64_t on_wire;
+    uint32_t count;
+
+    sim_serial_pump();
+
+    // what still is on the line has not been received yet
+    now = sim_time_ns();
+    count = ring_count(&sim_rx_ring);
+    if (sim_char_ns() == 0 || sim_rx_wire_until_ns <= now)
+        return count;
+
+    on_wire = (sim_rx_wire_until_ns - now + sim_char_ns() - 1) / sim_char_ns();
+    return (on_wire >= count) ? 0 : count - (uint32_t) on_wire;
+}
+
+int serial_read(uint8_t *data, uint32_t len, uint32_t timeout)
+{
+    uint32_t start_time = HAL_GetTick();
+    struct pollfd pfd = {.fd = sim_serial_fd, .events = POLLIN};
+
+    while (serial_available() < len) {
+        if (timeout != HAL_MAX_DELAY && HAL_GetTick() - start_time >= timeout)
+            return -1;
+
+        // sleep while nothing is on the way
+        if (ring_count(&sim_rx_ring) < len)
+            poll(&pfd, 1, 1);
+    }
+
+    ring_get(&sim_rx_ring, data, len);
+    return 0;
+}
+
+uint8_t serial_peek(uint32_t offset)
+{
+    return ring_peek(&sim_rx_ring, offset);
+}
+
+void serial_discard_until_idle(uint32_t timeout)
+{
+    uint32_t start_time = HAL_GetTick();
+    uint64_t idle_ns = SIM_IDLE_CHARS * (sim_char_ns() ? sim_char_ns() : 100000);
+
+    // the line is idle once its last character has been on it for a while,
+    // packets sent back to back behind a broken one keep it busy
+    do {
+        ring_skip(&sim_rx_ring, serial_available());
+    } while (sim_time_ns() < sim_rx_wire_until_ns + idle_ns && HAL_GetTick() - start_time < timeout);
+
+    ring_skip(&sim_rx_ring, serial_available());
+}
+
+int serial_write(const uint8_t *data, uint32_t len)
+{
+    uint64_t ns = len * sim_char_ns();
+    ssize_t ret;
+
+    while (len > 0) {
+        ret = write(sim_serial_fd, data, len);
+        if (ret < 0)
+            return -1;
+        data += ret;
+        len -= ret;
+        sim_stats.uart_tx_bytes += ret;
+    }
+
+    // blocking transmit, returns once the last character left
+    sim_stats.uart_tx_wire_ns += ns;
+    sim_wait_ns(ns);
+    return 0;
+}
+
+uint32_t serial_compute_brr(uint32_t pclk, uint32_t baud, bool *over8)
+{
+    // the pseudo terminal carries any rate
+    if (baud == 0)
+        return 0;
+
+    *over8 = false;
+    return (pclk + baud / 2) / baud;
+}
+
+int serial_set_baud(uint32_t baud)
+{
+    if (baud == 0)
+        return -1;
+
+    sim_serial_baud = baud;
+    return 0;
+}
+
+uint32_t serial_get_baud(void)
+{
+    return sim_serial_baud;
+}
+
+void serial_irq_handler(void)
+{
+}
+
+void serial_dma_irq_handler(void)
+{
+}
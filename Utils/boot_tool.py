@@ -1,28 +1,71 @@
 import sys
 import time
+import argparse
 import serial
 from crccheck.crc import Crc32Mpeg2
 
+import sbp_compress
+import sbp_delta
+
 SBP_HEADER_SOF_OFFSET = 0
 SBP_HEADER_TYPE_OFFSET = 1
 SBP_HEADER_LEN_OFFSET = 2
 SBP_DATA_OFFSET = 3
 
 SBP_HEADER_SOF = 0x5A
+SBP_HEADER_SIZE = 4
 
 SBP_TYPE_START = 0x01
 SBP_TYPE_STOP = 0x23
 SBP_TYPE_RESP = 0x45
 SBP_TYPE_CONF = 0x67
 SBP_TYPE_DATA = 0x89
+SBP_TYPE_BAUD = 0x3C
+SBP_TYPE_WDATA = 0xAB
+SBP_TYPE_WACK = 0xCD
+SBP_TYPE_QUERY = 0x4B
+SBP_TYPE_PROG = 0x4D
+SBP_TYPE_TQUERY = 0x6B
+SBP_TYPE_TLINE = 0x6D
 
 SBP_CONF_VERSION_OFFSET = 0
 SBP_CONF_SIZE_OFFSET = 4
 SBP_CONF_CRC_OFFSET = 8
+SBP_CONF_FLAGS_OFFSET = 12
+
+SBP_CONF_FLAG_COMPRESSED = 0x01
+SBP_CONF_FLAG_DELTA = 0x02
+SBP_CONF_FLAG_RESUME = 0x04
 
 SBP_RESP_ACK = 0x15
 SBP_RESP_NACK = 0x16
 
+# the target writes the response byte over the high byte of LEN and its
+# crc right after the 4 data bytes counted from there
+SBP_RESP_SIZE = 12
+SBP_RESP_OFFSET = SBP_DATA_OFFSET
+SBP_RESP_CRC_OFFSET = SBP_DATA_OFFSET + 4
+SBP_WACK_SIZE = 16
+SBP_PROG_SIZE = 20
+
+SBP_BAUD_CONFIRM_TIMEOUT = 1.0
+SBP_BAUD_PROBE_RATES = [2000000, 1000000, 921600, 460800, 230400]
+
+SBP_DATA_MAX_SIZE = 1024
+SBP_WINDOW_SIZE = 8
+
+# turnaround of the target, on top of the line time of the frames
+SBP_RTO_INITIAL = 1.0
+SBP_RTO_MIN = 0.02
+SBP_RTO_MAX = 10.0
+
+SBP_RESPONSE_TIMEOUT = 5.0
+
+# the target erases the slot after acknowledging CONF, the first DATA response
+# waits for it (F429 sector erase, max 2 s per 128 KB at x32 parallelism)
+SBP_ERASE_TIME_PER_BYTE = 2.0 / (128 * 1024)
+SBP_ERASE_TIME_MIN = 1.0
+
 def read_binfile(filename):
     try:
         with open(filename, 'rb') as binfile:
@@ -33,129 +76,613 @@ def read_binfile(filename):
 
     return bindata
 
-def validate_response(ser):
-    data = ser.read(12)
+class SbpLink:
+    # serial port with an incremental parser of the target responses, frames
+    # are returned as soon as their last byte arrives
+
+    def __init__(self, ser):
+        self.ser = ser
+        self.rx = bytearray()
+
+    @property
+    def baudrate(self):
+        return self.ser.baudrate
+
+    @baudrate.setter
+    def baudrate(self, baud):
+        self.ser.baudrate = baud
+
+    def write(self, data):
+        self.ser.write(data)
+
+    def reset_input_buffer(self):
+        self.ser.reset_input_buffer()
+        self.rx.clear()
+
+    def line_time(self, size):
+        # 10 bits per byte, 8N1
+        return size * 10.0 / self.ser.baudrate
+
+    def parse_frame(self):
+        while True:
+            start = self.rx.find(bytes([SBP_HEADER_SOF]))
+            if start < 0:
+                self.rx.clear()
+                return None
+            del self.rx[:start]
+
+            if len(self.rx) < SBP_HEADER_SIZE:
+                return None
+
+            frame_type = self.rx[SBP_HEADER_TYPE_OFFSET]
+            if frame_type == SBP_TYPE_RESP:
+                size = SBP_RESP_SIZE
+            elif frame_type == SBP_TYPE_WACK:
+                size = SBP_WACK_SIZE
+            elif frame_type == SBP_TYPE_PROG:
+                size = SBP_PROG_SIZE
+            elif frame_type == SBP_TYPE_TLINE:
+                # the only frame of variable length, header, LEN and crc
+                length = int.from_bytes(self.rx[SBP_HEADER_LEN_OFFSET:SBP_HEADER_LEN_OFFSET + 2], byteorder='little')
+                if length > SBP_DATA_MAX_SIZE:
+                    del self.rx[:1]
+                    continue
+                size = SBP_HEADER_SIZE + length + 4
+            else:
+                # not the start of a frame, resynchronise on the next SOF
+                del self.rx[:1]
+                continue
+
+            if len(self.rx) < size:
+                return None
+
+            frame = bytes(self.rx[:size])
+            del self.rx[:size]
+
+            if frame_type == SBP_TYPE_RESP:
+                # the RESP crc only covers the response byte
+                crc = frame[SBP_RESP_CRC_OFFSET:SBP_RESP_CRC_OFFSET + 4]
+                crc_ok = Crc32Mpeg2.calc(frame[SBP_RESP_OFFSET:SBP_RESP_OFFSET + 1]) == int.from_bytes(crc, byteorder='little')
+            else:
+                crc_ok = Crc32Mpeg2.calc(frame[4:size - 4]) == int.from_bytes(frame[size - 4:], byteorder='little')
+            if not crc_ok:
+                print("parse_frame: response crc failed", file=sys.stderr)
+                continue
+
+            return frame_type, frame
+
+    def read_frame(self, timeout):
+        # waits up to timeout seconds for the next whole frame
+        deadline = time.monotonic() + timeout
+
+        while True:
+            frame = self.parse_frame()
+            if frame is not None:
+                return frame
+
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+
+            self.ser.timeout = remaining
+            data = self.ser.read(max(1, self.ser.in_waiting))
+            if not data:
+                return None
+            self.rx.extend(data)
+
+class RtoEstimator:
+    # retransmit timeout from the measured round trips (RFC 6298), the line
+    # time of the frames is taken out of the samples and added back per frame,
+    # so the estimate carries over between packet sizes and link rates
+
+    def __init__(self, link):
+        self.link = link
+        self.srtt = None
+        self.rttvar = None
+        self.backoff = 1
+
+    def sample(self, rtt, sent_size, resp_size):
+        turnaround = max(0.0, rtt - self.link.line_time(sent_size + resp_size))
+
+        if self.srtt is None:
+            self.srtt = turnaround
+            self.rttvar = turnaround / 2
+        else:
+            self.rttvar = 0.75 * self.rttvar + 0.25 * abs(self.srtt - turnaround)
+            self.srtt = 0.875 * self.srtt + 0.125 * turnaround
+        self.backoff = 1
+
+    def timeout(self, sent_size, resp_size):
+        if self.srtt is None:
+            rto = SBP_RTO_INITIAL
+        else:
+            rto = max(SBP_RTO_MIN, self.srtt + 4 * self.rttvar)
+        rto = min(SBP_RTO_MAX, rto * self.backoff)
+        return self.link.line_time(sent_size + resp_size) + rto
+
+    def expire(self):
+        self.backoff = min(self.backoff * 2, 64)
+
+class Progress:
+    # progress bar with the live throughput, only on a terminal
+
+    WIDTH = 32
+    INTERVAL = 0.1
+
+    def __init__(self, total, label, done=0):
+        self.total = max(1, total)
+        self.label = label
+        self.base = done
+        self.start = time.monotonic()
+        self.shown = 0.0
+        self.enabled = sys.stderr.isatty()
+
+    def update(self, done, force=False):
+        now = time.monotonic()
+        if not self.enabled or (not force and now - self.shown < self.INTERVAL):
+            return
+        self.shown = now
+
+        elapsed = max(now - self.start, 1e-6)
+        filled = self.WIDTH * done // self.total
+        sys.stderr.write("\r{} [{}{}] {:3d}% {:8.1f} KB/s {:6.1f} s".format(
+            self.label, "#" * filled, "-" * (self.WIDTH - filled), 100 * done // self.total,
+            (done - self.base) / elapsed / 1024, elapsed))
+        sys.stderr.flush()
+
+    def finish(self, done):
+        self.update(done, force=True)
+        if self.enabled:
+            sys.stderr.write("\n")
+        elapsed = time.monotonic() - self.start
+        print("{}: {} bytes in {:.2f} s, {:.1f} KB/s".format(
+            self.label, done - self.base, elapsed, (done - self.base) / max(elapsed, 1e-6) / 1024))
+
+def read_response(link, timeout=SBP_RESPONSE_TIMEOUT):
+    # response byte of the next RESP frame, None on timeout
+    while True:
+        frame = link.read_frame(timeout)
+        if frame is None:
+            return None
+        frame_type, data = frame
+        if frame_type == SBP_TYPE_RESP:
+            return data[SBP_RESP_OFFSET]
+
+def validate_response(link, timeout=SBP_RESPONSE_TIMEOUT):
+    resp = read_response(link, timeout)
+
+    if resp is None:
+        print("validate_response: response timeout")
+        return False
 
-    if data[0] != SBP_HEADER_SOF:
-        print("validate_response: response sof failed")
+    if resp == SBP_RESP_NACK:
+        print("validate_response: response nack received")
         return False
 
-    if data[1] != SBP_TYPE_RESP:
-        print("validate_response: response byte doesn't match")
+    return True
+
+def baud_packet(baud):
+    LENGTH = 4
+    length = LENGTH.to_bytes(2, byteorder='little')
+    header = [SBP_HEADER_SOF, SBP_TYPE_BAUD]
+    header.extend(length)
+
+    data = list(baud.to_bytes(4, byteorder='little'))
+    data.extend(Crc32Mpeg2.calc(bytes(data)).to_bytes(4, byteorder='little'))
+    return bytes(header + data)
+
+def send_baud_packet(link, baud):
+    link.write(baud_packet(baud))
+
+def drain(link, duration):
+    # the target is waiting out a timeout, drop whatever it still sends
+    deadline = time.monotonic() + duration
+    while link.read_frame(max(0.0, deadline - time.monotonic())) is not None:
+        pass
+    link.reset_input_buffer()
+
+def negotiate_baud(link, baud):
+    old_baud = link.baudrate
+
+    send_baud_packet(link, baud)
+    if not validate_response(link):
+        print("negotiate_baud: {} rejected".format(baud))
         return False
 
-    if data[4] == SBP_RESP_NACK:
-        print("validate_response: response nack received")
+    # confirm at the new rate, the target falls back when it can't hear us
+    link.baudrate = baud
+    link.reset_input_buffer()
+    send_baud_packet(link, baud)
+    if not validate_response(link, SBP_BAUD_CONFIRM_TIMEOUT):
+        print("negotiate_baud: {} not confirmed, back to {}".format(baud, old_baud))
+        link.baudrate = old_baud
+        drain(link, SBP_BAUD_CONFIRM_TIMEOUT * 2)
         return False
 
-    print("validate_response: response received OK..!")
+    print("negotiate_baud: switched to {}".format(baud))
     return True
 
-def send_start_packet(ser):
+def probe_baud(link):
+    for baud in SBP_BAUD_PROBE_RATES:
+        if negotiate_baud(link, baud):
+            return True
+    return False
+
+def start_packet():
     LENGTH = 4
     length = LENGTH.to_bytes(2, byteorder='little')
     header = [SBP_HEADER_SOF, SBP_TYPE_START]
     header.extend(length)
 
     data = [0 for i in range(8)]
-    ser.write(header)
-    time.sleep(0.1)  # Time is required
-    ser.write(data)
-    print("send_start_packet: start command sent...!")
+    return bytes(header + data)
+
+def send_start_packet(link):
+    link.write(start_packet())
 
-def send_config_packet(ser, bindata, version):
-    LENGTH = 12
+def config_packet(bindata, version, flags=0, base_crc=None):
+    # the flags field is optional, older targets only know the short packet
+    LENGTH = 16 if flags else 12
+    if base_crc is not None:
+        LENGTH = 20
 
     length = LENGTH.to_bytes(2, byteorder='little')
     header = [SBP_HEADER_SOF, SBP_TYPE_CONF]
     header.extend(length)
 
     data = []
-    version.extend([0 for i in range(4 - len(version))])
+    version = version + [0 for i in range(4 - len(version))]
 
     size = len(bindata).to_bytes(4, byteorder='little')
     crc = Crc32Mpeg2.calc(bindata).to_bytes(4, byteorder='little')
-    print("size: ", len(bindata))
-    print("crc: ", bytes(crc).hex())
 
     data.extend(bytes(version))
     data.extend(size)
     data.extend(crc)
+    if flags:
+        data.extend(flags.to_bytes(4, byteorder='little'))
+    if base_crc is not None:
+        data.extend(base_crc.to_bytes(4, byteorder='little'))
 
     new_crc = Crc32Mpeg2.calc(bytes(data)).to_bytes(4, byteorder='little')
     data.extend(new_crc)
 
-    ser.write(header)
-    time.sleep(0.1)  # Time is required
-    ser.write(data)
-    print("send_config_packet: config packet sent...!")
-
-def send_data_packet(ser, bindata):
-    header = [SBP_HEADER_SOF, SBP_TYPE_DATA]
-    start = 0
-    end = 1024
-    data = bindata[start: end]
-
-    while data:
-        length = len(data).to_bytes(2, byteorder='little')
-        header_packet = header + list(length)
-        crc = Crc32Mpeg2.calc(data).to_bytes(4, byteorder='little')
-        data_packet = list(data) + list(crc)
-
-        ser.write(header_packet)
-        time.sleep(0.1)
-        ser.write(data_packet)
-
-        start = end
-        end += 1024
-        data = bindata[start: end]
-        time.sleep(1)
-
-        if not validate_response(ser):
-            return sys.exit(1)
-    print("send_data_packet: data packet sent...!")
-
-def send_stop_packet(ser):
+    return bytes(header + data)
+
+def send_config_packet(link, bindata, version, flags=0, base_crc=None):
+    link.write(config_packet(bindata, version, flags, base_crc))
+
+def query_packet():
     LENGTH = 4
     length = LENGTH.to_bytes(2, byteorder='little')
-    header = [SBP_HEADER_SOF, SBP_TYPE_STOP]
+    header = [SBP_HEADER_SOF, SBP_TYPE_QUERY]
     header.extend(length)
 
     data = [0 for i in range(8)]
-    ser.write(header)
-    time.sleep(0.1)  # Time is required
-    ser.write(data)
-    print("send_stop_packet: stop command sent...!")
+    return bytes(header + data)
+
+def query_progress(link, rto, retries):
+    # (size, crc, offset) of the download the target can resume, None when
+    # there is none or the target predates QUERY
+    for attempt in range(retries + 1):
+        link.write(query_packet())
+
+        deadline = time.monotonic() + rto.timeout(12, SBP_PROG_SIZE)
+        while True:
+            frame = link.read_frame(max(0.0, deadline - time.monotonic()))
+            if frame is None:
+                break
+            frame_type, data = frame
+            if frame_type == SBP_TYPE_PROG:
+                size, crc, offset = (int.from_bytes(data[i:i + 4], byteorder='little') for i in (4, 8, 12))
+                return (size, crc, offset) if size else None
+            if frame_type == SBP_TYPE_RESP and data[SBP_RESP_OFFSET] == SBP_RESP_ACK:
+                # an ACK, QUERY is unknown to the target
+                drain(link, rto.timeout(0, SBP_RESP_SIZE))
+                return None
+
+        rto.expire()
+
+    return None
+
+def timeline_query_packet(count=0):
+    LENGTH = 4
+    length = LENGTH.to_bytes(2, byteorder='little')
+    header = [SBP_HEADER_SOF, SBP_TYPE_TQUERY]
+    header.extend(length)
 
-def main():
-    if len(sys.argv) < 3:
-        print("Usage: python3 boot_tool.py <app-bin> <app-version(0.0.0)>")
+    data = list(count.to_bytes(4, byteorder='little'))
+    data.extend(Crc32Mpeg2.calc(bytes(data)).to_bytes(4, byteorder='little'))
+    return bytes(header + data)
+
+def query_timeline(link, rto, retries, count=0):
+    # the boot timeline ring in the export format of Libs/timeline.h, None
+    # when the target predates TQUERY
+    for attempt in range(retries + 1):
+        link.write(timeline_query_packet(count))
+
+        deadline = time.monotonic() + rto.timeout(12, SBP_HEADER_SIZE + SBP_DATA_MAX_SIZE + 4)
+        while True:
+            frame = link.read_frame(max(0.0, deadline - time.monotonic()))
+            if frame is None:
+                break
+            frame_type, data = frame
+            if frame_type == SBP_TYPE_TLINE:
+                return data[SBP_HEADER_SIZE:-4]
+            if frame_type == SBP_TYPE_RESP and data[SBP_RESP_OFFSET] == SBP_RESP_ACK:
+                # an ACK, TQUERY is unknown to the target
+                drain(link, rto.timeout(0, SBP_RESP_SIZE))
+                return None
+
+        rto.expire()
+
+    return None
+
+def data_packet(data):
+    length = len(data).to_bytes(2, byteorder='little')
+    crc = Crc32Mpeg2.calc(data).to_bytes(4, byteorder='little')
+    return bytes([SBP_HEADER_SOF, SBP_TYPE_DATA]) + length + bytes(data) + crc
+
+def send_data_chunk(link, data):
+    link.write(data_packet(data))
+
+def stop_packet():
+    LENGTH = 4
+    length = LENGTH.to_bytes(2, byteorder='little')
+    header = [SBP_HEADER_SOF, SBP_TYPE_STOP]
+    header.extend(length)
 
-    ser = serial.Serial("/dev/ttyUSB0", baudrate=115200, timeout=30)
-    filepath = sys.argv[1]
-    version = [int(x) for x in sys.argv[2].split('.')]
-    print(version)
+    data = [0 for i in range(8)]
+    return bytes(header + data)
+
+def send_stop_packet(link):
+    link.write(stop_packet())
+
+def request(link, packet, rto, retries, name):
+    # control packets are idempotent, resent on a nack or a timeout
+    for attempt in range(retries + 1):
+        sent = time.monotonic()
+        link.write(packet)
+
+        resp = read_response(link, rto.timeout(len(packet), SBP_RESP_SIZE))
+        if resp == SBP_RESP_ACK:
+            # Karn, only first transmissions give a round trip
+            if attempt == 0:
+                rto.sample(time.monotonic() - sent, len(packet), SBP_RESP_SIZE)
+            return True
+
+        if resp is None:
+            rto.expire()
+            print("request: {} timeout".format(name), file=sys.stderr)
+        else:
+            print("request: {} nack".format(name), file=sys.stderr)
+
+    print("request: {} failed after {} retries".format(name, retries))
+    return False
+
+def erase_time(image_size):
+    return SBP_ERASE_TIME_MIN + image_size * SBP_ERASE_TIME_PER_BYTE
+
+def send_data_packets(link, bindata, rto, retries, progress, erase_wait, start=0):
+    # DATA packets carry no sequence number, a lost ACK followed by a resend
+    # would write the packet twice, so only a NACK is answered with a resend.
+    # The target erases in the background from CONF on, until the erase
+    # budget is spent any response may wait for it
+    erase_end = time.monotonic() + erase_wait
+    for offset in range(start, len(bindata), SBP_DATA_MAX_SIZE):
+        chunk = bindata[offset: offset + SBP_DATA_MAX_SIZE]
+        packet = data_packet(chunk)
+        failures = 0
+
+        while True:
+            sent = time.monotonic()
+            link.write(packet)
+
+            timeout = rto.timeout(len(packet), SBP_RESP_SIZE) * (retries + 1) + max(0.0, erase_end - sent)
+            resp = read_response(link, timeout)
+            if resp == SBP_RESP_ACK:
+                # round trips that may have waited for the erase say nothing
+                # about the link
+                if failures == 0 and sent > erase_end:
+                    rto.sample(time.monotonic() - sent, len(packet), SBP_RESP_SIZE)
+                break
+
+            if resp is None:
+                print("send_data_packets: response timeout at {}".format(offset))
+                return False
+
+            failures += 1
+            if failures > retries:
+                print("send_data_packets: too many nacks at {}".format(offset))
+                return False
+
+        progress.update(offset + len(chunk))
 
-    bindata = read_binfile(filepath)
-    send_start_packet(ser)
-    if not validate_response(ser):
-        return sys.exit(1)
+    return True
 
-    time.sleep(2)
+def read_window_ack(link, timeout=SBP_RESPONSE_TIMEOUT):
+    while True:
+        frame = link.read_frame(timeout)
+        if frame is None:
+            return None
+        frame_type, data = frame
+        if frame_type != SBP_TYPE_WACK:
+            continue
+
+        status = data[4]
+        next_seq = int.from_bytes(data[6:8], byteorder='little')
+        bitmap = int.from_bytes(data[8:12], byteorder='little')
+        return status, next_seq, bitmap
+
+def window_data_packet(chunk, seq, offset):
+    payload = seq.to_bytes(2, byteorder='little') + offset.to_bytes(4, byteorder='little') + chunk
+    length = len(payload).to_bytes(2, byteorder='little')
+    crc = Crc32Mpeg2.calc(payload).to_bytes(4, byteorder='little')
+
+    return bytes([SBP_HEADER_SOF, SBP_TYPE_WDATA]) + length + payload + crc
+
+def send_window_data_packet(link, chunk, seq, offset):
+    link.write(window_data_packet(chunk, seq, offset))
+
+def send_window_data(link, bindata, window, rto, retries, progress, erase_wait, start=0):
+    # the packets carry their image offset, a resumed download starts at start
+    chunks = [bindata[i: i + SBP_DATA_MAX_SIZE] for i in range(start, len(bindata), SBP_DATA_MAX_SIZE)]
+    packets = [window_data_packet(chunk, seq, start + seq * SBP_DATA_MAX_SIZE) for seq, chunk in enumerate(chunks)]
+    base = 0            # oldest packet not acknowledged
+    sent = 0            # next packet never sent
+    sacked = set()      # packets acknowledged ahead of base
+    line_free = 0.0     # when the host UART has sent everything queued
+    sent_at = {}        # line end of the last transmission of each packet
+    due = {}            # retransmit deadline of each outstanding packet
+    resent = set()      # packets sent more than once, no round trip from them
+    erase_end = time.monotonic() + erase_wait  # the target may still erase
+    failures = 0
+
+    def transmit(seq):
+        nonlocal line_free
+        link.write(packets[seq])
+        line_free = max(time.monotonic(), line_free) + link.line_time(len(packets[seq]))
+        sent_at[seq] = line_free
+        due[seq] = line_free + rto.timeout(0, SBP_WACK_SIZE) + max(0.0, erase_end - line_free)
+
+    while base < len(packets):
+        # fill the window
+        while sent < len(packets) and sent < base + window:
+            transmit(sent)
+            sent += 1
+
+        outstanding = [seq for seq in range(base, sent) if seq not in sacked]
+        first_due = min(due[seq] for seq in outstanding)
+        ack = read_window_ack(link, max(0.0, first_due - time.monotonic()))
+
+        if ack is None:
+            # the oldest timers ran out, resend those packets
+            rto.expire()
+            failures += 1
+            if failures > retries:
+                print("send_window_data: too many retransmissions")
+                return False
+
+            now = time.monotonic()
+            for seq in outstanding:
+                if due[seq] <= now:
+                    resent.add(seq)
+                    transmit(seq)
+            continue
+
+        status, next_seq, bitmap = ack
+        if next_seq > base:
+            last = next_seq - 1
+            if last not in resent and sent_at[last] > erase_end:
+                rto.sample(time.monotonic() - sent_at[last] + link.line_time(len(packets[last])),
+                           len(packets[last]), SBP_WACK_SIZE)
+            base = min(next_seq, len(packets))
+            failures = 0
+            progress.update(min(start + base * SBP_DATA_MAX_SIZE, len(bindata)))
+        sacked = {next_seq + 1 + i for i in range(SBP_WINDOW_SIZE) if bitmap & (1 << i)}
+
+        if status != SBP_RESP_ACK and base < sent:
+            # a corrupted packet, the oldest missing one is the likely victim
+            failures += 1
+            if failures > retries:
+                print("send_window_data: too many retransmissions")
+                return False
+            resent.add(base)
+            transmit(base)
 
-    send_config_packet(ser, bindata, version)
-    if not validate_response(ser):
+    return True
+
+def main():
+    parser = argparse.ArgumentParser(description="Flash an application over the simple bootloader protocol")
+    parser.add_argument("binary", help="application binary")
+    parser.add_argument("version", help="application version (0.0.0)")
+    parser.add_argument("--port", default="/dev/ttyUSB0",
+                        help="serial port of the target, or the pty of the host simulator")
+    parser.add_argument("--initial-baud", type=int, default=115200,
+                        help="baud rate the bootloader starts at")
+    parser.add_argument("--baud", default=None,
+                        help="baud rate to switch to for the download, or 'auto' to probe")
+    parser.add_argument("--window", type=int, default=SBP_WINDOW_SIZE,
+                        help="WDATA packets in flight, 1 is stop-and-wait (max {}, default {})".format(
+                            SBP_WINDOW_SIZE, SBP_WINDOW_SIZE))
+    parser.add_argument("--plain", action="store_true",
+                        help="send DATA packets one at a time instead of WDATA")
+    parser.add_argument("--restart", action="store_true",
+                        help="download the whole image even if the target could resume it")
+    parser.add_argument("--retries", type=int, default=10,
+                        help="retransmissions of a packet before giving up (default 10)")
+    parser.add_argument("--compress", action="store_true",
+                        help="send the image LZSS compressed, the target decompresses it")
+    parser.add_argument("--delta", metavar="OLD_BINARY", default=None,
+                        help="send a patch against the installed image OLD_BINARY")
+    args = parser.parse_args()
+
+    window = max(1, min(args.window, SBP_WINDOW_SIZE))
+
+    link = SbpLink(serial.Serial(args.port, baudrate=args.initial_baud, timeout=0))
+    rto = RtoEstimator(link)
+    version = [int(x) for x in args.version.split('.')]
+
+    bindata = read_binfile(args.binary)
+
+    # the CONF packet always describes the image, DATA packets carry the payload
+    flags = 0
+    payload = bindata
+    base_crc = None
+    if args.delta is not None:
+        olddata = read_binfile(args.delta)
+        base_crc = Crc32Mpeg2.calc(olddata)
+        payload = sbp_delta.diff(olddata, bindata)
+        flags |= SBP_CONF_FLAG_DELTA
+        print("delta: {} -> {} bytes".format(len(bindata), len(payload)))
+
+    # a patch is mostly zero bytes, it is always worth compressing
+    if args.compress or args.delta is not None:
+        compressed = sbp_compress.compress(payload)
+        print("compressed: {} -> {} bytes".format(len(payload), len(compressed)))
+        if len(compressed) < len(payload):
+            flags |= SBP_CONF_FLAG_COMPRESSED
+            payload = compressed
+
+    print("image: {} bytes, crc {:08x}, version {}".format(
+        len(bindata), Crc32Mpeg2.calc(bindata), args.version))
+
+    if args.baud == "auto":
+        probe_baud(link)
+    elif args.baud is not None:
+        negotiate_baud(link, int(args.baud))
+
+    if not request(link, start_packet(), rto, args.retries, "start"):
         return sys.exit(1)
 
-    time.sleep(2)
+    # an interrupted download of this very image continues where it stopped,
+    # only uncompressed downloads can be resumed
+    resume = 0
+    if flags == 0 and not args.restart:
+        prog = query_progress(link, rto, args.retries)
+        if prog is not None and prog[0] == len(bindata) and prog[1] == Crc32Mpeg2.calc(bindata):
+            resume = prog[2]
+            print("resume: {} of {} bytes already on the target".format(resume, len(bindata)))
+
+    conf_flags = flags | SBP_CONF_FLAG_RESUME if resume else flags
+    if not request(link, config_packet(bindata, version, conf_flags, base_crc), rto, args.retries, "config"):
+        return sys.exit(1)
 
-    send_data_packet(ser, bindata)
+    # nothing is erased when resuming
+    erase_wait = 0.0 if resume else erase_time(len(bindata))
 
-    time.sleep(2)
+    progress = Progress(len(payload), "download", resume)
+    if args.plain:
+        done = send_data_packets(link, payload, rto, args.retries, progress, erase_wait, resume)
+    else:
+        done = send_window_data(link, payload, window, rto, args.retries, progress, erase_wait, resume)
+    if not done:
+        return sys.exit(1)
+    progress.finish(len(payload))
 
-    send_stop_packet(ser)
-    if not validate_response(ser):
+    if not request(link, stop_packet(), rto, args.retries, "stop"):
         return sys.exit(1)
+    print("download complete")
 
 
 if __name__ == "__main__":
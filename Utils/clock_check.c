@@ -0,0 +1,217 @@
+// Host check of the clock profiles in Libs/clock.c
+//
+// Build and run with: make clock-check
+//
+// Checks every profile against the F429 datasheet limits (PLL ranges,
+// SYSCLK per regulator setting, flash wait states, bus clocks) and prints
+// the UART5 baud rate register for the rates boot_tool.py asks for. Then
+// switches between every pair of profiles through clock_apply() on a
+// model of the RCC that fails the steps the hardware refuses, and checks
+// the state each switch ends in.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "serial.h"
+
+/* the rate UART5 starts at, see MX_UART5_Init() */
+#define CHECK_INITIAL_BAUD 115200
+
+static const uint32_t check_bauds[] = {115200, 230400, 460800, 921600, 1000000, 2000000};
+
+/* RCC, PWR and flash interface model */
+FLASH_TypeDef sim_flash_regs;
+uint32_t sim_pwr_vos = PWR_REGULATOR_VOLTAGE_SCALE1;
+
+static RCC_PLLInitTypeDef model_pll = {.PLLState = RCC_PLL_OFF};
+static bool model_hse = false;
+static bool model_overdrive = false;
+static uint32_t model_source = RCC_SYSCLKSOURCE_HSI;
+static uint32_t model_latency = FLASH_LATENCY_0;
+
+static int check_failures = 0;
+
+static void check(bool ok, const char *name, const char *what)
+{
+    if (!ok) {
+        printf("%-8s FAIL %s\n", name, what);
+        check_failures++;
+    }
+}
+
+static uint32_t model_sysclk(uint32_t source)
+{
+    uint32_t input;
+
+    if (source == RCC_SYSCLKSOURCE_HSE)
+        return HSE_VALUE;
+    if (source != RCC_SYSCLKSOURCE_PLLCLK)
+        return HSI_VALUE;
+
+    input = (model_pll.PLLSource == RCC_PLLSOURCE_HSE) ? HSE_VALUE : HSI_VALUE;
+    return (uint32_t) ((uint64_t) input / model_pll.PLLM * model_pll.PLLN / model_pll.PLLP);
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef *RCC_OscInitStruct)
+{
+    bool pll_hse = model_pll.PLLState == RCC_PLL_ON && model_pll.PLLSource == RCC_PLLSOURCE_HSE;
+
+    if (RCC_OscInitStruct->OscillatorType & RCC_OSCILLATORTYPE_HSE) {
+        if (RCC_OscInitStruct->HSEState == RCC_HSE_OFF &&
+            (model_source == RCC_SYSCLKSOURCE_HSE || pll_hse))
+            return HAL_ERROR;
+        model_hse = RCC_OscInitStruct->HSEState == RCC_HSE_ON;
+    }
+
+    if (RCC_OscInitStruct->PLL.PLLState != RCC_PLL_NONE) {
+        if (model_source == RCC_SYSCLKSOURCE_PLLCLK)
+            return HAL_ERROR;
+        if (RCC_OscInitStruct->PLL.PLLState == RCC_PLL_ON &&
+            RCC_OscInitStruct->PLL.PLLSource == RCC_PLLSOURCE_HSE && !model_hse)
+            return HAL_ERROR;
+        model_pll = RCC_OscInitStruct->PLL;
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef *RCC_ClkInitStruct, uint32_t FLatency)
+{
+    uint32_t source = RCC_ClkInitStruct->SYSCLKSource;
+
+    if (source == RCC_SYSCLKSOURCE_PLLCLK && model_pll.PLLState != RCC_PLL_ON)
+        return HAL_ERROR;
+    if (model_sysclk(source) > clock_sysclk_max_hz(sim_pwr_vos, model_overdrive))
+        return HAL_ERROR;
+    if (FLatency < clock_min_latency(model_sysclk(source)))
+        return HAL_ERROR;
+
+    model_source = source;
+    model_latency = FLatency;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PWREx_EnableOverDrive(void)
+{
+    if (model_pll.PLLState != RCC_PLL_ON || sim_pwr_vos != PWR_REGULATOR_VOLTAGE_SCALE1)
+        return HAL_ERROR;
+
+    model_overdrive = true;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_PWREx_DisableOverDrive(void)
+{
+    if (model_source == RCC_SYSCLKSOURCE_PLLCLK)
+        return HAL_ERROR;
+
+    model_overdrive = false;
+    return HAL_OK;
+}
+
+static void check_limits(const clock_profile_t *p)
+{
+    uint32_t sysclk = clock_sysclk_hz(p);
+    uint32_t input;
+    uint32_t vco;
+
+    if (p->pll) {
+        input = ((p->pll_source == RCC_PLLSOURCE_HSE) ? HSE_VALUE : HSI_VALUE) / p->pll_m;
+        vco = input * p->pll_n;
+        check(p->pll_m >= 2 && p->pll_m <= 63, p->name, "PLLM out of 2..63");
+        check(p->pll_n >= 50 && p->pll_n <= 432, p->name, "PLLN out of 50..432");
+        check(p->pll_p == 2 || p->pll_p == 4 || p->pll_p == 6 || p->pll_p == 8, p->name, "PLLP not 2, 4, 6 or 8");
+        check(p->pll_q >= 2 && p->pll_q <= 15, p->name, "PLLQ out of 2..15");
+        check(input >= CLOCK_VCO_INPUT_MIN && input <= CLOCK_VCO_INPUT_MAX, p->name, "VCO input out of range");
+        check(vco >= CLOCK_VCO_OUTPUT_MIN && vco <= CLOCK_VCO_OUTPUT_MAX, p->name, "VCO output out of range");
+    } else {
+        check(!p->overdrive, p->name, "over-drive without the PLL");
+    }
+
+    check(sysclk != 0 && clock_pclk1_hz(p) != 0 && clock_pclk2_hz(p) != 0, p->name, "malformed dividers");
+    check(sysclk <= clock_sysclk_max_hz(p->voltage_scale, p->overdrive), p->name, "SYSCLK above the regulator limit");
+    check(!p->overdrive || p->voltage_scale == PWR_REGULATOR_VOLTAGE_SCALE1, p->name, "over-drive outside scale 1");
+    check(p->latency >= clock_min_latency(sysclk), p->name, "too few flash wait states");
+    check(p->latency == clock_min_latency(sysclk), p->name,
+          "flash wait states above the minimum");
+    check(clock_pclk1_hz(p) <= CLOCK_PCLK1_MAX, p->name, "APB1 above 45 MHz");
+    check(clock_pclk2_hz(p) <= CLOCK_PCLK2_MAX, p->name, "APB2 above 90 MHz");
+}
+
+static void check_bauds_table(const clock_profile_t *p)
+{
+    uint32_t pclk1 = clock_pclk1_hz(p);
+    uint32_t brr;
+    uint32_t div;
+    bool over8 = false;
+
+    printf("%-8s sysclk %3u MHz apb1 %2u MHz apb2 %2u MHz latency %u\n", p->name, clock_sysclk_hz(p) / 1000000,
+           pclk1 / 1000000, clock_pclk2_hz(p) / 1000000, p->latency);
+
+    for (size_t i = 0; i < sizeof(check_bauds) / sizeof(check_bauds[0]); i++) {
+        brr = serial_compute_brr(pclk1, check_bauds[i], &over8);
+        if (brr == 0) {
+            printf("%-8s   %7u baud: not supported\n", "", check_bauds[i]);
+            check(check_bauds[i] != CHECK_INITIAL_BAUD, p->name, "initial baud rate not supported");
+            continue;
+        }
+
+        div = over8 ? (((brr >> 4) << 3) | (brr & 0x7)) : brr;
+        printf("%-8s   %7u baud: brr %04x over%d error %+.2f%%\n", "", check_bauds[i], brr, over8 ? 8 : 16,
+               ((double) pclk1 / div - check_bauds[i]) * 100.0 / check_bauds[i]);
+    }
+}
+
+static void check_switch(clock_profile_id_t from, clock_profile_id_t to)
+{
+    const clock_profile_t *p = clock_get_profile(to);
+    uint32_t art = (p->prefetch ? FLASH_ACR_PRFTEN : 0) | (p->icache ? FLASH_ACR_ICEN : 0) |
+                   (p->dcache ? FLASH_ACR_DCEN : 0);
+    char what[64];
+
+    if (clock_apply(from) != 0 || clock_current() != from) {
+        snprintf(what, sizeof(what), "switch to it from %s", clock_get_profile(clock_current())->name);
+        check(false, clock_get_profile(from)->name, what);
+        return;
+    }
+
+    snprintf(what, sizeof(what), "switch from %s", clock_get_profile(from)->name);
+    check(clock_apply(to) == 0 && clock_current() == to, p->name, what);
+    check(model_sysclk(model_source) == clock_sysclk_hz(p), p->name, "SYSCLK differs after the switch");
+    check(model_latency == p->latency, p->name, "latency differs after the switch");
+    check(sim_pwr_vos == p->voltage_scale, p->name, "regulator scale differs after the switch");
+    check(model_overdrive == p->overdrive, p->name, "over-drive differs after the switch");
+    check((model_pll.PLLState == RCC_PLL_ON) == p->pll, p->name, "PLL left running");
+    check(model_hse == (p->pll && p->pll_source == RCC_PLLSOURCE_HSE), p->name, "HSE left running");
+    check((FLASH->ACR & (FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN)) == art, p->name, "ART state differs");
+}
+
+int main(void)
+{
+    const clock_profile_t *reset = clock_get_profile(CLOCK_PROFILE_RESET);
+
+    // the restore before the jump must give what SystemClock_Config() gives
+    check(!reset->pll && clock_sysclk_hz(reset) == HSI_VALUE && reset->latency == FLASH_LATENCY_0 &&
+          reset->voltage_scale == PWR_REGULATOR_VOLTAGE_SCALE3 && clock_pclk1_hz(reset) == HSI_VALUE &&
+          clock_pclk2_hz(reset) == HSI_VALUE, reset->name, "differs from SystemClock_Config()");
+    check(BOOT_CLOCK_PROFILE < CLOCK_PROFILES, "boot", "BOOT_CLOCK_PROFILE unknown");
+
+    for (clock_profile_id_t id = 0; id < CLOCK_PROFILES; id++) {
+        check_limits(clock_get_profile(id));
+        check_bauds_table(clock_get_profile(id));
+    }
+
+    for (clock_profile_id_t from = 0; from < CLOCK_PROFILES; from++)
+        for (clock_profile_id_t to = 0; to < CLOCK_PROFILES; to++)
+            check_switch(from, to);
+
+    if (check_failures != 0) {
+        printf("%d checks failed\n", check_failures);
+        return 1;
+    }
+
+    printf("all profiles pass\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Host decoders of the compressed and delta transfers, Libs/lzss.c and
+// Libs/delta.c chained as the target runs them
+//
+// Build and run with: make codec-test
+//
+// Reads a stream from stdin and writes what the target would program to
+// stdout. The stream is handed to the decoder in pieces split at random
+// points, the way the DATA packets of the transfer cut it, so every field
+// of the bitstream and every control record ends up straddling pieces;
+// seed 0 feeds it in one piece. With -d the stream is a compressed patch
+// against OLD, with -r as well the patch is not compressed.
+//
+// Usage: codec_check [-d OLD [-r]] SEED < stream > image
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "lzss.h"
+#include "delta.h"
+
+/* longest piece, a little over the window so a piece can wrap it */
+#define CHECK_PIECE_MAX (LZSS_WINDOW_SIZE + 100)
+
+static lzss_decoder_t check_decoder;
+static delta_patch_t check_patch;
+static bool check_delta = false;
+
+static uint8_t *read_all(FILE *file, size_t *size)
+{
+    size_t capacity = 64 * 1024;
+    uint8_t *data = malloc(capacity);
+    size_t n;
+
+    *size = 0;
+    while (data != NULL && (n = fread(data + *size, 1, capacity - *size, file)) > 0) {
+        *size += n;
+        if (*size == capacity)
+            data = realloc(data, capacity *= 2);
+    }
+
+    return data;
+}
+
+static int check_sink(const uint8_t *data, uint16_t size)
+{
+    // the flash writer behind the sink takes at most a window per call
+    if (size == 0 || size > LZSS_WINDOW_SIZE) {
+        fprintf(stderr, "codec_check: sink called with %u bytes\n", size);
+        return -1;
+    }
+
+    return fwrite(data, 1, size, stdout) == size ? 0 : -1;
+}
+
+static int check_lzss_sink(const uint8_t *data, uint16_t size)
+{
+    // a compressed patch goes through the patch applier
+    if (check_delta)
+        return delta_apply(&check_patch, data, size, check_sink);
+
+    return check_sink(data, size);
+}
+
+static int check_decode(const uint8_t *data, size_t size, bool raw)
+{
+    if (raw)
+        return delta_apply(&check_patch, data, size, check_sink);
+
+    return lzss_decode(&check_decoder, data, size, check_lzss_sink);
+}
+
+static size_t piece_size(void)
+{
+    // mostly short pieces, a field split every few bytes, now and then a
+    // long one
+    switch (rand() % 4) {
+        case 0:
+            return 1;
+        case 1:
+            return 1 + rand() % CHECK_PIECE_MAX;
+        default:
+            return 1 + rand() % 16;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *old_path = NULL;
+    FILE *old_file;
+    uint8_t *old = NULL;
+    size_t old_size = 0;
+    uint8_t *stream;
+    size_t size;
+    size_t offset = 0;
+    size_t piece;
+    unsigned seed;
+    bool raw = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:r")) != -1) {
+        switch (opt) {
+            case 'd': old_path = optarg; break;
+            case 'r': raw = true; break;
+            default: optind = argc + 1; break;
+        }
+    }
+
+    if (optind != argc - 1 || (raw && old_path == NULL)) {
+        fprintf(stderr, "usage: %s [-d OLD [-r]] SEED < stream > image\n", argv[0]);
+        return 2;
+    }
+
+    seed = strtoul(argv[optind], NULL, 0);
+    srand(seed);
+
+    // the base image the patch applies to, the appslot on the target
+    if (old_path != NULL) {
+        old_file = fopen(old_path, "rb");
+        if (old_file == NULL) {
+            perror(old_path);
+            return 2;
+        }
+        old = read_all(old_file, &old_size);
+        fclose(old_file);
+        check_delta = true;
+    }
+
+    stream = read_all(stdin, &size);
+    if (stream == NULL || (old_path != NULL && old == NULL)) {
+        fprintf(stderr, "codec_check: out of memory\n");
+        return 2;
+    }
+
+    lzss_init(&check_decoder);
+    delta_init(&check_patch, old, old_size);
+
+    while (offset < size) {
+        piece = (seed == 0) ? size : piece_size();
+        if (piece > size - offset)
+            piece = size - offset;
+
+        if (check_decode(stream + offset, piece, raw) != 0) {
+            fprintf(stderr, "codec_check: decode failed at %zu\n", offset);
+            return 1;
+        }
+        offset += piece;
+    }
+
+    // a patch cut short leaves a record behind
+    if (check_delta && (check_patch.control_len != 0 || check_patch.diff_len != 0 ||
+                        check_patch.extra_len != 0)) {
+        fprintf(stderr, "codec_check: patch ends inside a record\n");
+        return 1;
+    }
+
+    free(stream);
+    free(old);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
@@ -0,0 +1,155 @@
+import os
+import random
+import tempfile
+import subprocess
+
+import sbp_compress
+import sbp_delta
+from test_runner import check
+import test_runner
+
+# Round trips of the transfer encoders through the target decoders: the
+# streams sbp_compress.py and sbp_delta.py build are decoded by Libs/lzss.c
+# and Libs/delta.c in the codec_check harness, in random splits of the stream
+
+# splits tried per case, seed 0 is the whole stream in one piece
+SEEDS = range(0, 9)
+
+BLINKY = os.path.join(os.path.dirname(os.path.abspath(__file__)), "blinky.bin")
+
+def random_bytes(size, seed):
+    rng = random.Random(seed)
+    return bytes(rng.getrandbits(8) for i in range(size))
+
+def run_check(codec_check, stream, seed, options=()):
+    return subprocess.run([codec_check] + list(options) + [str(seed)], input=stream,
+                          stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+
+def decode(codec_check, stream, seed, options=()):
+    result = run_check(codec_check, stream, seed, options)
+    check(result.returncode == 0, "seed {}: {}".format(seed, result.stderr.decode().strip()))
+    return result.stdout
+
+def lzss_round_trip(codec_check, data):
+    stream = sbp_compress.compress(data)
+
+    for seed in SEEDS:
+        out = decode(codec_check, stream, seed)
+        check(len(out) == len(data), "seed {}: {} bytes decoded of {}".format(seed, len(out), len(data)))
+        check(out == data, "seed {}: decoded bytes differ".format(seed))
+
+    return len(stream)
+
+def delta_round_trip(codec_check, old, new):
+    # the patch as it is, then compressed the way boot_tool.py sends it
+    patch = sbp_delta.diff(old, new)
+    compressed = sbp_compress.compress(patch)
+    check(sbp_delta.apply(old, patch) == new, "host reference apply differs")
+
+    with tempfile.NamedTemporaryFile(suffix=".bin") as base:
+        base.write(old)
+        base.flush()
+
+        for stream, options in ((patch, ["-d", base.name, "-r"]),
+                                (compressed, ["-d", base.name])):
+            for seed in SEEDS:
+                out = decode(codec_check, stream, seed, options)
+                check(out == new, "{} seed {}: rebuilt image differs".format(" ".join(options[2:]) or "lzss", seed))
+
+    # the diff bytes of matched ranges are mostly zero, the compression
+    # makes the transfer small
+    return len(compressed)
+
+def old_image():
+    # firmware followed by data, the base the patches are made against
+    with open(BLINKY, "rb") as f:
+        return f.read() + random_bytes(6 * 1024, seed=10)
+
+def test_lzss_incompressible(codec_check):
+    # literals only, the stream is an eighth bigger than the data
+    data = random_bytes(8 * 1024, seed=9)
+    check(lzss_round_trip(codec_check, data) > len(data), "random data compressed")
+
+def test_lzss_zeros(codec_check):
+    # back references of the longest count all the way, each one copying
+    # bytes it produces itself
+    data = bytes(16 * 1024)
+    check(lzss_round_trip(codec_check, data) < len(data) // 10, "zeros not compressed")
+
+def test_lzss_beyond_window(codec_check):
+    # a block repeated at exactly the window distance, then again past it
+    # where the encoder must not reach back
+    block = random_bytes(1 << sbp_compress.LZSS_WINDOW_BITS, seed=1)
+    data = block + block + random_bytes(700, seed=2) + block + block[:100]
+    check(lzss_round_trip(codec_check, data) < len(data), "repeats not compressed")
+
+def test_lzss_image(codec_check):
+    # code and constants, then the padding of an image to its slot
+    with open(BLINKY, "rb") as f:
+        image = f.read()
+    lzss_round_trip(codec_check, image + bytes([0xFF]) * 5000)
+
+def test_delta_identical(codec_check):
+    old = old_image()
+    check(delta_round_trip(codec_check, old, old) < len(old) // 10, "identical image not matched")
+
+def test_delta_shifted(codec_check):
+    # an insertion moves everything behind it, a few bytes patched further on
+    old = old_image()
+    new = bytearray(old[:1000] + random_bytes(37, seed=11) + old[1000:])
+    for pos in (4000, 4001, len(new) - 1):
+        new[pos] ^= 0x5A
+    new = bytes(new)
+    check(delta_round_trip(codec_check, old, new) < len(new) // 4, "shifted image not matched")
+
+def test_delta_grown(codec_check):
+    # new code at the end, then a copy of the start of the old image
+    old = old_image()
+    new = old + random_bytes(3000, seed=12) + old[:2000]
+    delta_round_trip(codec_check, old, new)
+
+def test_delta_shrunk(codec_check):
+    # a range cut out of the middle and the tail dropped, the patch seeks
+    # forward over the old bytes
+    old = old_image()
+    new = old[:3000] + old[7000:len(old) - 1000]
+    delta_round_trip(codec_check, old, new)
+
+def test_delta_corrupted(codec_check):
+    # cut short or seeking outside the base, the target must refuse it
+    old = old_image()
+    patch = sbp_delta.diff(old, old[:2000] + random_bytes(100, seed=13) + old[2000:])
+
+    with tempfile.NamedTemporaryFile(suffix=".bin") as base:
+        base.write(old)
+        base.flush()
+
+        result = run_check(codec_check, patch[:len(patch) - 1], 1, ["-d", base.name, "-r"])
+        check(result.returncode == 1, "truncated patch accepted")
+
+        seek_away = bytearray(patch)
+        seek_away[8:12] = (len(old) + 1).to_bytes(4, byteorder='little', signed=True)
+        result = run_check(codec_check, bytes(seek_away), 1, ["-d", base.name, "-r"])
+        check(result.returncode == 1, "seek beyond the base accepted")
+
+TESTS = [
+    test_lzss_incompressible,
+    test_lzss_zeros,
+    test_lzss_beyond_window,
+    test_lzss_image,
+    test_delta_identical,
+    test_delta_shifted,
+    test_delta_grown,
+    test_delta_shrunk,
+    test_delta_corrupted,
+]
+
+def main():
+    parser = test_runner.parser("Round trips of the transfer encoders through the target decoders")
+    parser.add_argument("--check", default="build/host/codec_check", help="decoder harness (make codec-test)")
+    args = parser.parse_args()
+
+    test_runner.run("codec_test", TESTS, args.tests, lambda test: test(args.check))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,134 @@
+import re
+import sys
+import json
+import struct
+import argparse
+
+# Decoder of the binary log the bootloader writes to RTT up buffer 2, as saved
+# by JLinkRTTLogger -RTTChannel 2 or the simulator --rtt option. The format
+# strings are read from the log_fmt section of the ELF, see Libs/log.h
+
+LOG_FMT_SECTION = "log_fmt"
+LOG_RECORD_HEADER_SIZE = 3
+LOG_MAX_ARGS = 4
+
+LOG_LEVELS = {1: "E", 2: "W", 3: "I", 4: "D"}
+
+# SEGGER_RTT_printf conversions, the length modifiers don't matter
+LOG_CONVERSION = re.compile(r"%([-0]?\d*)[lh]*([dicuxXps%])")
+
+def read_elf_section(filename, name):
+    with open(filename, 'rb') as elffile:
+        elf = elffile.read()
+
+    if elf[:4] != b"\x7fELF":
+        print("read_elf_section: {} is not an ELF file".format(filename))
+        sys.exit(1)
+
+    # 32 bit target or 64 bit simulator, both little endian
+    if elf[4] == 1:
+        shoff, = struct.unpack_from("<I", elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x2E)
+        section = struct.Struct("<IIIIII")
+    else:
+        shoff, = struct.unpack_from("<Q", elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3A)
+        section = struct.Struct("<IIQQQQ")
+
+    headers = [section.unpack_from(elf, shoff + i * shentsize) for i in range(shnum)]
+    strtab = headers[shstrndx]
+
+    for sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size in headers:
+        end = elf.index(b"\0", strtab[4] + sh_name)
+        if elf[strtab[4] + sh_name:end].decode() == name:
+            return elf[sh_offset:sh_offset + sh_size]
+
+    print("read_elf_section: no {} section in {}".format(name, filename))
+    sys.exit(1)
+
+def make_dict(strings):
+    # every format string starts right after the terminator of the one before
+    formats = {}
+    start = 0
+    while start < len(strings):
+        end = strings.index(b"\0", start)
+        if end > start:
+            formats[start] = strings[start:end].decode(errors="replace")
+        start = end + 1
+    return formats
+
+def format_message(fmt, args):
+    args = list(args)
+
+    def convert(match):
+        flags, conv = match.groups()
+        if conv == '%':
+            return '%'
+        value = args.pop(0) if args else 0
+        if conv in "di":
+            value = value - (1 << 32) if value & 0x80000000 else value
+            return ("%" + flags + "d") % value
+        if conv == 'p':
+            return "%08x" % value
+        if conv in "sc":
+            # strings stay on the target, only their address is logged
+            return "<{:08x}>".format(value)
+        return ("%" + flags + conv) % value
+
+    return LOG_CONVERSION.sub(convert, fmt)
+
+def decode(data, formats):
+    pos = 0
+    while pos + LOG_RECORD_HEADER_SIZE <= len(data):
+        level = data[pos] >> 4
+        nargs = data[pos] & 0x0F
+        msgid = int.from_bytes(data[pos + 1:pos + 3], byteorder='little')
+        end = pos + LOG_RECORD_HEADER_SIZE + 4 * nargs
+
+        if nargs > LOG_MAX_ARGS or level not in LOG_LEVELS or end > len(data):
+            print("decode: bad record at {}, stopping".format(pos), file=sys.stderr)
+            return
+
+        args = struct.unpack_from("<{}I".format(nargs), data, pos + LOG_RECORD_HEADER_SIZE)
+        if msgid in formats:
+            text = format_message(formats[msgid], args)
+        else:
+            text = "unknown id {} {}".format(msgid, " ".join("{:08x}".format(a) for a in args))
+        print("[{}] {}".format(LOG_LEVELS[level], text))
+
+        pos = end
+
+def main():
+    parser = argparse.ArgumentParser(description="Expand the bootloader binary log")
+    parser.add_argument("elf", nargs="?", default=None,
+                        help="ELF of the bootloader (or the simulator) that wrote the log")
+    parser.add_argument("log", nargs="?", default=None, help="RTT channel 2 capture")
+    parser.add_argument("--dict", default=None, help="format strings saved with --make-dict, instead of the ELF")
+    parser.add_argument("--make-dict", metavar="DICT", default=None,
+                        help="save the format strings of the ELF as JSON and exit")
+    args = parser.parse_args()
+
+    if args.dict is not None:
+        # with a dictionary the only positional argument is the capture
+        args.log = args.log or args.elf
+        with open(args.dict) as dictfile:
+            formats = {int(msgid): fmt for msgid, fmt in json.load(dictfile).items()}
+    elif args.elf is not None:
+        formats = make_dict(read_elf_section(args.elf, LOG_FMT_SECTION))
+    else:
+        parser.error("an ELF or --dict is needed")
+
+    if args.make_dict is not None:
+        with open(args.make_dict, 'w') as dictfile:
+            json.dump(formats, dictfile, indent=1)
+        return
+
+    if args.log is None:
+        parser.error("no capture given")
+
+    with open(args.log, 'rb') as logfile:
+        decode(logfile.read(), formats)
+
+
+if __name__ == "__main__":
+    main()
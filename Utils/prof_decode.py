@@ -0,0 +1,90 @@
+import sys
+import json
+import struct
+import argparse
+from crccheck.crc import Crc32Mpeg2
+
+# Decoder of the profile dumps the bootloader writes to RTT up buffer 1,
+# as saved by JLinkRTTLogger -RTTChannel 1 or the simulator --rtt option
+
+PROF_DUMP_MAGIC = b"PRF1"
+PROF_DUMP_HEADER = struct.Struct("<4sIB3x")
+PROF_DUMP_REGION = struct.Struct("<IIIQ")
+
+# same order as prof_region_t in Libs/prof.h
+PROF_REGIONS = ["uart_rx", "packet_crc", "flash_program", "flash_erase",
+                "image_validate", "image_copy", "jump"]
+
+def parse_dumps(data):
+    dumps = []
+    start = data.find(PROF_DUMP_MAGIC)
+
+    while start != -1:
+        if len(data) - start < PROF_DUMP_HEADER.size:
+            break
+
+        magic, freq, regions = PROF_DUMP_HEADER.unpack_from(data, start)
+        end = start + PROF_DUMP_HEADER.size + regions * PROF_DUMP_REGION.size
+        if end + 4 > len(data):
+            print("parse_dumps: truncated dump at {}".format(start), file=sys.stderr)
+            break
+
+        crc = int.from_bytes(data[end:end + 4], byteorder='little')
+        if Crc32Mpeg2.calc(data[start:end]) != crc:
+            print("parse_dumps: crc failed at {}".format(start), file=sys.stderr)
+            start = data.find(PROF_DUMP_MAGIC, start + 1)
+            continue
+
+        stats = []
+        for i in range(regions):
+            count, low, high, total = PROF_DUMP_REGION.unpack_from(
+                data, start + PROF_DUMP_HEADER.size + i * PROF_DUMP_REGION.size)
+            name = PROF_REGIONS[i] if i < len(PROF_REGIONS) else "region{}".format(i)
+            stats.append({"region": name, "count": count,
+                          "min_us": low * 1e6 / freq,
+                          "avg_us": total * 1e6 / freq / count if count else 0.0,
+                          "max_us": high * 1e6 / freq,
+                          "total_ms": total * 1e3 / freq})
+        dumps.append({"freq": freq, "regions": stats})
+
+        start = data.find(PROF_DUMP_MAGIC, end + 4)
+
+    return dumps
+
+def print_dump(dump):
+    print("counter: {:.3f} MHz".format(dump["freq"] / 1e6))
+    print("{:<16}{:>8}{:>12}{:>12}{:>12}{:>12}".format(
+        "region", "count", "min us", "avg us", "max us", "total ms"))
+    for stats in dump["regions"]:
+        print("{:<16}{:>8}{:>12.2f}{:>12.2f}{:>12.2f}{:>12.3f}".format(
+            stats["region"], stats["count"], stats["min_us"], stats["avg_us"],
+            stats["max_us"], stats["total_ms"]))
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode the bootloader profile dumps")
+    parser.add_argument("dump", help="RTT channel 1 capture")
+    parser.add_argument("--all", action="store_true",
+                        help="print every dump of the capture, not only the last one")
+    parser.add_argument("--json", action="store_true", help="print the dumps as JSON")
+    args = parser.parse_args()
+
+    with open(args.dump, 'rb') as dumpfile:
+        dumps = parse_dumps(dumpfile.read())
+
+    if not dumps:
+        print("no profile dump found")
+        return sys.exit(1)
+
+    if not args.all:
+        dumps = dumps[-1:]
+
+    if args.json:
+        print(json.dumps(dumps, indent=2))
+        return
+
+    for dump in dumps:
+        print_dump(dump)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,180 @@
+import io
+import sys
+import csv
+import json
+import time
+import random
+import argparse
+import tempfile
+import itertools
+import contextlib
+
+import boot_tool
+import sbp_sim
+
+APP_FLASH_ADDR = 0x08020000
+# top of the application RAM, the handoff block follows (Libs/handoff.h)
+HANDOFF_ADDR = 0x2002FC00
+SIM_TIMEOUT = 600
+RESPONSE_TIMEOUT = 30.0
+
+FIELDS = ["image_size", "packet_size", "baud", "window", "flash_time",
+          "total_s", "transfer_s", "install_s", "bytes_per_s", "packets",
+          "rtt_mean_ms", "rtt_p50_ms", "rtt_p95_ms", "rtt_max_ms",
+          "link_s", "flash_s", "crc_bytes", "crc_host_s", "other_s",
+          "erase_ops", "program_ops"]
+
+def make_image(size, seed=1):
+    # random contents behind a vector table pointing into the appslot
+    rng = random.Random(seed)
+    image = bytearray(rng.getrandbits(8) for i in range(size))
+    image[0:4] = (HANDOFF_ADDR).to_bytes(4, byteorder='little')
+    image[4:8] = (APP_FLASH_ADDR + 0x101).to_bytes(4, byteorder='little')
+    return bytes(image)
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p))]
+
+def timed_request(ser, send, rtts):
+    start = time.monotonic()
+    send()
+    if not boot_tool.validate_response(ser, RESPONSE_TIMEOUT):
+        raise RuntimeError("request failed")
+    rtts.append(time.monotonic() - start)
+
+def send_stop_and_wait(ser, image, packet_size, rtts):
+    for offset in range(0, len(image), packet_size):
+        chunk = image[offset: offset + packet_size]
+        timed_request(ser, lambda: boot_tool.send_data_chunk(ser, chunk), rtts)
+
+def send_windowed(ser, image, packet_size, window, rtts):
+    chunks = [image[i: i + packet_size] for i in range(0, len(image), packet_size)]
+    sent_at = {}
+    base = 0
+    sent = 0
+
+    while base < len(chunks):
+        while sent < len(chunks) and sent < base + window:
+            boot_tool.send_window_data_packet(ser, chunks[sent], sent, sent * packet_size)
+            sent_at[sent] = time.monotonic()
+            sent += 1
+
+        ack = boot_tool.read_window_ack(ser, RESPONSE_TIMEOUT)
+        if ack is None:
+            raise RuntimeError("window ack timeout")
+
+        status, next_seq, bitmap = ack
+        now = time.monotonic()
+        for seq in range(base, next_seq):
+            rtts.append(now - sent_at[seq])
+        base = max(base, next_seq)
+
+        # the simulated link does not lose bytes, a nack is a real failure
+        if status != boot_tool.SBP_RESP_ACK:
+            raise RuntimeError("window nack at {}".format(next_seq))
+
+def run_case(sim_path, workdir, image, packet_size, baud, window, flash_time, used_flash):
+    sim = sbp_sim.Sim(sim_path, workdir, flash_time=flash_time, timeout=SIM_TIMEOUT)
+
+    # erased, or programmed all over so every sector the update touches
+    # needs an erase
+    sim.reset_flash(0x00 if used_flash else None)
+
+    with sim:
+        ser = sim.link
+        rtts = []
+
+        # the tool chatters on stdout, keep the report clean
+        with contextlib.redirect_stdout(io.StringIO()):
+            if baud != 115200 and not boot_tool.negotiate_baud(ser, baud):
+                raise RuntimeError("baud {} refused".format(baud))
+
+            start = time.monotonic()
+            timed_request(ser, lambda: boot_tool.send_start_packet(ser), rtts)
+            timed_request(ser, lambda: boot_tool.send_config_packet(ser, image, [1, 0, 0]), rtts)
+
+            data_rtts = []
+            if window > 1:
+                send_windowed(ser, image, packet_size, window, data_rtts)
+            else:
+                send_stop_and_wait(ser, image, packet_size, data_rtts)
+
+            timed_request(ser, lambda: boot_tool.send_stop_packet(ser), rtts)
+            transfer = time.monotonic() - start
+
+        # the update is done once the simulator jumps to the new image
+        counters = sim.wait_exit()
+        total = time.monotonic() - start
+
+    if not counters["jumped"]:
+        raise RuntimeError("image not booted")
+
+    link_s = counters["uart_rx_wire_s"] + counters["uart_tx_wire_s"]
+    return {
+        "image_size": len(image),
+        "packet_size": packet_size,
+        "baud": baud,
+        "window": window,
+        "flash_time": flash_time,
+        "total_s": round(total, 4),
+        "transfer_s": round(transfer, 4),
+        "install_s": round(total - transfer, 4),
+        "bytes_per_s": round(len(image) / total, 1),
+        "packets": len(data_rtts),
+        "rtt_mean_ms": round(1000 * sum(data_rtts) / len(data_rtts), 3),
+        "rtt_p50_ms": round(1000 * percentile(data_rtts, 0.50), 3),
+        "rtt_p95_ms": round(1000 * percentile(data_rtts, 0.95), 3),
+        "rtt_max_ms": round(1000 * max(data_rtts), 3),
+        "link_s": round(link_s, 4),
+        "flash_s": round(counters["flash_busy_s"], 4),
+        "crc_bytes": counters["crc_bytes"],
+        "crc_host_s": round(counters["crc_host_s"], 4),
+        # negative when the link and the flash programming overlap
+        "other_s": round(total - link_s - counters["flash_busy_s"] - counters["crc_host_s"], 4),
+        "erase_ops": counters["flash_erase_ops"],
+        "program_ops": counters["flash_program_ops"],
+    }
+
+def int_list(text):
+    return [int(x) for x in text.split(',')]
+
+def main():
+    parser = argparse.ArgumentParser(description="Update throughput benchmark against the host simulator")
+    parser.add_argument("--sim", default="build/host/boot_sim", help="host simulator (make host-sim)")
+    parser.add_argument("--sizes", type=int_list, default=[16384, 65536], help="image sizes")
+    parser.add_argument("--packet-sizes", type=int_list, default=[256, 1024],
+                        help="DATA payload sizes (max {})".format(boot_tool.SBP_DATA_MAX_SIZE))
+    parser.add_argument("--rates", type=int_list, default=[115200, 921600], help="link rates")
+    parser.add_argument("--windows", type=int_list, default=[1, 8], help="packets in flight, 1 is stop-and-wait")
+    parser.add_argument("--flash-time", type=float, default=1.0, help="scale of the F429 flash timings")
+    parser.add_argument("--used-flash", action="store_true",
+                        help="start from a programmed flash instead of an erased one")
+    parser.add_argument("--json", action="store_true", help="JSON instead of CSV")
+    parser.add_argument("--output", default=None, help="output file, stdout when omitted")
+    args = parser.parse_args()
+
+    results = []
+    with tempfile.TemporaryDirectory() as workdir:
+        for size, packet_size, baud, window in itertools.product(args.sizes, args.packet_sizes,
+                                                                  args.rates, args.windows):
+            if packet_size > boot_tool.SBP_DATA_MAX_SIZE or window > boot_tool.SBP_WINDOW_SIZE:
+                continue
+            print("sbp_bench: {} bytes, {} byte packets, {} baud, window {}".format(
+                  size, packet_size, baud, window), file=sys.stderr)
+            results.append(run_case(args.sim, workdir, make_image(size), packet_size, baud, window,
+                                    args.flash_time, args.used_flash))
+
+    out = open(args.output, "w", newline='') if args.output else sys.stdout
+    if args.json:
+        json.dump(results, out, indent=2)
+        out.write("\n")
+    else:
+        writer = csv.DictWriter(out, fieldnames=FIELDS)
+        writer.writeheader()
+        writer.writerows(results)
+    if args.output:
+        out.close()
+
+if __name__ == "__main__":
+    main()
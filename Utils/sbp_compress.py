@@ -0,0 +1,79 @@
+# LZSS encoder for the compressed transfer of the simple bootloader protocol.
+#
+# The bitstream is the heatshrink one, it must use the same window and
+# lookahead sizes as Libs/lzss.h:
+#  LITERAL  | 1 | BYTE (8)                                                  |
+#  BACKREF  | 0 | DISTANCE - 1 (WINDOW_BITS) | COUNT - 1 (LOOKAHEAD_BITS) |
+
+LZSS_WINDOW_BITS = 10
+LZSS_LOOKAHEAD_BITS = 5
+
+LZSS_MIN_MATCH = 3
+LZSS_MAX_CANDIDATES = 32
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.bits = 0
+        self.nbits = 0
+
+    def write(self, value, count):
+        self.bits = (self.bits << count) | value
+        self.nbits += count
+        while self.nbits >= 8:
+            self.nbits -= 8
+            self.out.append((self.bits >> self.nbits) & 0xFF)
+        self.bits &= (1 << self.nbits) - 1
+
+    def finish(self):
+        if self.nbits:
+            self.out.append((self.bits << (8 - self.nbits)) & 0xFF)
+        return bytes(self.out)
+
+
+def compress(data, window_bits=LZSS_WINDOW_BITS, lookahead_bits=LZSS_LOOKAHEAD_BITS):
+    window = 1 << window_bits
+    lookahead = 1 << lookahead_bits
+    writer = BitWriter()
+    chains = {}
+    size = len(data)
+    i = 0
+
+    def insert(pos):
+        if pos + LZSS_MIN_MATCH <= size:
+            chain = chains.setdefault(data[pos:pos + LZSS_MIN_MATCH], [])
+            chain.append(pos)
+            if len(chain) > 2 * LZSS_MAX_CANDIDATES:
+                del chain[:LZSS_MAX_CANDIDATES]
+
+    while i < size:
+        best_len = 0
+        best_dist = 0
+
+        for pos in reversed(chains.get(data[i:i + LZSS_MIN_MATCH], [])[-LZSS_MAX_CANDIDATES:]):
+            if i - pos > window:
+                break
+            length = 0
+            while length < lookahead and i + length < size and data[pos + length] == data[i + length]:
+                length += 1
+            if length > best_len:
+                best_len = length
+                best_dist = i - pos
+                if length == lookahead:
+                    break
+
+        if best_len >= LZSS_MIN_MATCH:
+            writer.write(0, 1)
+            writer.write(best_dist - 1, window_bits)
+            writer.write(best_len - 1, lookahead_bits)
+        else:
+            best_len = 1
+            writer.write(1, 1)
+            writer.write(data[i], 8)
+
+        for pos in range(i, i + best_len):
+            insert(pos)
+        i += best_len
+
+    return writer.finish()
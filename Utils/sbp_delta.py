@@ -0,0 +1,106 @@
+# Patch generator for the delta transfer of the simple bootloader protocol.
+#
+# The patch is a list of bsdiff style control records, each followed by its
+# payload, applied by Libs/delta.c against the installed image:
+#  | DIFF_LEN | EXTRA_LEN | SEEK | DIFF bytes | EXTRA bytes |
+#  |    4     |     4     |  4   |  DIFF_LEN  |  EXTRA_LEN  |
+# DIFF bytes are added (mod 256) to the old image bytes, EXTRA bytes are
+# copied as they are, then SEEK (signed) moves the position in the old image.
+
+DELTA_BLOCK = 8         # bytes hashed to find match candidates
+DELTA_MAX_CANDIDATES = 16
+
+
+def _index(old):
+    blocks = {}
+    for pos in range(0, len(old) - DELTA_BLOCK + 1):
+        chain = blocks.setdefault(old[pos:pos + DELTA_BLOCK], [])
+        if len(chain) < DELTA_MAX_CANDIDATES:
+            chain.append(pos)
+    return blocks
+
+
+def _extend(old, new, old_pos, new_pos):
+    # extend forward like bsdiff, accepting mismatches as long as more
+    # than half of the bytes since the start of the match are equal
+    best = 0
+    score = 0
+    length = 0
+    while old_pos + length < len(old) and new_pos + length < len(new):
+        if old[old_pos + length] == new[new_pos + length]:
+            score += 1
+        else:
+            score -= 1
+        length += 1
+        if score > 0 and old[old_pos + length - 1] == new[new_pos + length - 1]:
+            best = length
+        if score < -DELTA_BLOCK:
+            break
+    return best
+
+
+def _control(diff_len, extra_len, seek):
+    return (diff_len.to_bytes(4, byteorder='little') +
+            extra_len.to_bytes(4, byteorder='little') +
+            seek.to_bytes(4, byteorder='little', signed=True))
+
+
+def diff(old, new):
+    blocks = _index(old)
+    matches = []        # (new_pos, old_pos, length)
+    new_pos = 0
+
+    while new_pos + DELTA_BLOCK <= len(new):
+        best_len = 0
+        best_old = 0
+        for old_pos in blocks.get(new[new_pos:new_pos + DELTA_BLOCK], []):
+            length = _extend(old, new, old_pos, new_pos)
+            if length > best_len:
+                best_len = length
+                best_old = old_pos
+        if best_len >= DELTA_BLOCK:
+            matches.append((new_pos, best_old, best_len))
+            new_pos += best_len
+        else:
+            new_pos += 1
+
+    patch = bytearray()
+
+    # literal bytes before the first match, the seek lines the old
+    # position up for it
+    first_new, first_old = (matches[0][0], matches[0][1]) if matches else (len(new), 0)
+    if first_new > 0 or first_old > 0:
+        patch += _control(0, first_new, first_old)
+        patch += new[:first_new]
+
+    # every record is the diff of one match plus the literal bytes up to
+    # the next match
+    for i, (new_pos, old_pos, length) in enumerate(matches):
+        next_new = matches[i + 1][0] if i + 1 < len(matches) else len(new)
+        next_old = matches[i + 1][1] if i + 1 < len(matches) else old_pos + length
+        extra = new[new_pos + length:next_new]
+
+        patch += _control(length, len(extra), next_old - (old_pos + length))
+        patch += bytes((new[new_pos + k] - old[old_pos + k]) & 0xFF for k in range(length))
+        patch += extra
+
+    return bytes(patch)
+
+
+def apply(old, patch):
+    # host side reference of Libs/delta.c
+    new = bytearray()
+    old_pos = 0
+    pos = 0
+    while pos < len(patch):
+        diff_len = int.from_bytes(patch[pos:pos + 4], byteorder='little')
+        extra_len = int.from_bytes(patch[pos + 4:pos + 8], byteorder='little')
+        seek = int.from_bytes(patch[pos + 8:pos + 12], byteorder='little', signed=True)
+        pos += 12
+        new += bytes((old[old_pos + k] + patch[pos + k]) & 0xFF for k in range(diff_len))
+        pos += diff_len
+        old_pos += diff_len
+        new += patch[pos:pos + extra_len]
+        pos += extra_len
+        old_pos += seek
+    return bytes(new)
@@ -0,0 +1,95 @@
+import os
+import json
+import time
+import subprocess
+import serial
+
+import boot_tool
+
+# One run of the host simulator (make host-sim) for the scripts driving it,
+# sim_test.py and sbp_bench.py: the flash file, the pty link, the stats and
+# the log of the run are kept in a work directory, the flash between runs
+
+FLASH_BASE = 0x08000000
+SIM_FLASH_SIZE = 2 * 1024 * 1024
+SIM_START_TIMEOUT = 5.0
+# past the timeout of the run itself, the simulator is stuck
+SIM_EXIT_MARGIN = 5.0
+
+class SimError(RuntimeError):
+    pass
+
+class Sim:
+    # with button the bootloader stays in update mode on the pty link, without
+    # it the run is a plain reset that boots the installed image
+
+    def __init__(self, sim, workdir, button=True, flash_time=0, timeout=60):
+        self.sim = sim
+        self.flash = os.path.join(workdir, "flash.bin")
+        self.link_path = os.path.join(workdir, "tty")
+        self.stats_path = os.path.join(workdir, "stats.json")
+        self.log_path = os.path.join(workdir, "sim.log")
+        self.button = button
+        self.flash_time = flash_time
+        self.timeout = timeout
+        self.proc = None
+        self.link = None
+
+    def reset_flash(self, fill=None):
+        # erased flash, or programmed all over with the fill byte
+        if os.path.exists(self.flash):
+            os.remove(self.flash)
+        if fill is not None:
+            with open(self.flash, "wb") as f:
+                f.write(bytes([fill]) * SIM_FLASH_SIZE)
+
+    def __enter__(self):
+        for path in (self.link_path, self.stats_path):
+            if os.path.lexists(path):
+                os.remove(path)
+
+        args = [self.sim, "--flash", self.flash, "--flash-time", str(self.flash_time),
+                "--stats", self.stats_path, "--timeout", str(int(self.timeout))]
+        if self.button:
+            args += ["--button", "--link", self.link_path]
+
+        self.log = open(self.log_path, "w")
+        self.proc = subprocess.Popen(args, stderr=self.log)
+        if not self.button:
+            return self
+
+        deadline = time.monotonic() + SIM_START_TIMEOUT
+        while not os.path.exists(self.link_path):
+            if time.monotonic() > deadline or self.proc.poll() is not None:
+                self.__exit__(None, None, None)
+                raise SimError("simulator did not start")
+            time.sleep(0.01)
+
+        self.link = boot_tool.SbpLink(serial.Serial(self.link_path, baudrate=115200, timeout=0))
+        return self
+
+    def __exit__(self, exc_type, exc, tb):
+        if self.proc.poll() is None:
+            self.proc.kill()
+        self.proc.wait()
+        self.log.close()
+
+    def wait_exit(self):
+        # the run ends with the jump to the image or on its timeout, the
+        # counters of the run
+        try:
+            self.proc.wait(timeout=self.timeout + SIM_EXIT_MARGIN)
+        except subprocess.TimeoutExpired:
+            raise SimError("simulator did not exit")
+
+        with open(self.stats_path) as f:
+            return json.load(f)
+
+    def read_flash(self, addr, size):
+        with open(self.flash, "rb") as f:
+            f.seek(addr - FLASH_BASE)
+            return f.read(size)
+
+    def sim_log(self):
+        with open(self.log_path) as f:
+            return f.read()
@@ -0,0 +1,291 @@
+import os
+import io
+import shutil
+import time
+import tempfile
+import contextlib
+from crccheck.crc import Crc32Mpeg2
+
+import boot_tool
+import sbp_bench
+import sbp_delta
+import sbp_compress
+import sbp_sim
+from test_runner import check, TestFailed
+import test_runner
+
+# Update scenarios scripted against the host simulator, the bootloader on one
+# end of the pty and the test playing the host tool on the other
+
+APP_FLASH_ADDR = 0x08020000
+SIM_EXIT_TIMEOUT = 60.0
+SIM_BOOT_TIMEOUT = 10.0
+RESPONSE_TIMEOUT = 5.0
+
+# appslot sectors 5 and 6
+APP_SECTOR_SIZE = 128 * 1024
+
+class Sim(sbp_sim.Sim):
+    # one boot of the simulator in bootloader mode, the flash file is kept
+    # between boots of the same test
+
+    def __init__(self, sim, workdir):
+        super().__init__(sim, workdir, timeout=SIM_EXIT_TIMEOUT)
+
+    def request(self, packet, name):
+        self.link.write(packet)
+        check(boot_tool.read_response(self.link, RESPONSE_TIMEOUT) == boot_tool.SBP_RESP_ACK,
+              "{} not acknowledged".format(name))
+
+    def send_wdata(self, image, seq, packet_size=boot_tool.SBP_DATA_MAX_SIZE, corrupt=False, offset=None):
+        start = seq * packet_size
+        if offset is None:
+            offset = start
+        packet = bytearray(boot_tool.window_data_packet(image[start: start + packet_size], seq, offset))
+        if corrupt:
+            packet[-5] ^= 0xFF
+        self.link.write(bytes(packet))
+
+    def read_wack(self):
+        ack = boot_tool.read_window_ack(self.link, RESPONSE_TIMEOUT)
+        check(ack is not None, "no window ack")
+        return ack
+
+    def wdata(self, image, seq, **kwargs):
+        self.send_wdata(image, seq, **kwargs)
+        return self.read_wack()
+
+def expect_wack(ack, status, next_seq, bitmap):
+    check(ack == (status, next_seq, bitmap),
+          "window ack {}, expected {}".format(ack, (status, next_seq, bitmap)))
+
+def check_appslot(sim, image):
+    appslot = sim.read_flash(APP_FLASH_ADDR, len(image))
+    check(Crc32Mpeg2.calc(appslot) == Crc32Mpeg2.calc(image), "appslot crc mismatch")
+
+def normal_boot(sim_path, workdir):
+    # a reset without the button, the counters of the boot
+    with sbp_sim.Sim(sim_path, workdir, button=False, timeout=SIM_BOOT_TIMEOUT) as sim:
+        return sim.wait_exit()
+
+def install(sim_path, workdir, image):
+    # a whole update in stop-and-wait, the counters of the boot that did it
+    with Sim(sim_path, workdir) as sim:
+        sim.request(boot_tool.start_packet(), "START")
+        sim.request(boot_tool.config_packet(image, [1, 0, 0]), "CONF")
+        for offset in range(0, len(image), boot_tool.SBP_DATA_MAX_SIZE):
+            sim.request(boot_tool.data_packet(image[offset: offset + boot_tool.SBP_DATA_MAX_SIZE]),
+                        "DATA at {}".format(offset))
+        sim.request(boot_tool.stop_packet(), "STOP")
+        stats = sim.wait_exit()
+
+        check(stats["jumped"], "image not booted")
+        check_appslot(sim, image)
+    return stats
+
+def send_delta(sim, old, image):
+    # compressed patch of image against old, as boot_tool.py --delta sends it
+    payload = sbp_compress.compress(sbp_delta.diff(old, image))
+    flags = boot_tool.SBP_CONF_FLAG_DELTA | boot_tool.SBP_CONF_FLAG_COMPRESSED
+
+    sim.request(boot_tool.start_packet(), "START")
+    sim.request(boot_tool.config_packet(image, [1, 0, 1], flags, Crc32Mpeg2.calc(old)), "CONF")
+    for offset in range(0, len(payload), boot_tool.SBP_DATA_MAX_SIZE):
+        sim.request(boot_tool.data_packet(payload[offset: offset + boot_tool.SBP_DATA_MAX_SIZE]),
+                    "DATA at {}".format(offset))
+    sim.request(boot_tool.stop_packet(), "STOP")
+
+def change_sectors(image, sectors):
+    # one byte past the vector table of each given appslot sector
+    image = bytearray(image)
+    for sector in sectors:
+        image[sector * APP_SECTOR_SIZE + 0x1000] ^= 0xFF
+    return bytes(image)
+
+def test_window_recovery(sim_path, workdir):
+    # loss, reordering, corruption and duplicates of a windowed transfer,
+    # every ack checked against what the receive window must hold
+    image = sbp_bench.make_image(16 * boot_tool.SBP_DATA_MAX_SIZE, seed=6)
+    ACK = boot_tool.SBP_RESP_ACK
+    NACK = boot_tool.SBP_RESP_NACK
+
+    with Sim(sim_path, workdir) as sim:
+        sim.request(boot_tool.start_packet(), "START")
+        sim.request(boot_tool.config_packet(image, [1, 0, 0]), "CONF")
+
+        expect_wack(sim.wdata(image, 0), ACK, 1, 0)
+        expect_wack(sim.wdata(image, 1), ACK, 2, 0)
+
+        # 2 lost, 3 and 5 arrive ahead of it and are acked selectively
+        expect_wack(sim.wdata(image, 3), ACK, 2, 0b001)
+        expect_wack(sim.wdata(image, 5), ACK, 2, 0b101)
+
+        # 4 out of order fills the hole between the buffered packets
+        expect_wack(sim.wdata(image, 4), ACK, 2, 0b111)
+
+        # the retransmission releases everything buffered behind it
+        expect_wack(sim.wdata(image, 2), ACK, 6, 0)
+
+        # a duplicate of a delivered packet is only acknowledged
+        expect_wack(sim.wdata(image, 1), ACK, 6, 0)
+
+        # a corrupted packet is nacked, the window stays where it was
+        expect_wack(sim.wdata(image, 6, corrupt=True), NACK, 6, 0)
+        expect_wack(sim.wdata(image, 6), ACK, 7, 0)
+
+        # beyond the window, dropped without being buffered
+        expect_wack(sim.wdata(image, 7 + boot_tool.SBP_WINDOW_SIZE), ACK, 7, 0)
+
+        # a corrupted packet with more in flight behind it, sent back to
+        # back: only the corrupted one is lost, the others are buffered
+        sim.send_wdata(image, 7, corrupt=True)
+        for seq in (8, 9, 10):
+            sim.send_wdata(image, seq)
+        expect_wack(sim.read_wack(), NACK, 7, 0)
+        expect_wack(sim.read_wack(), ACK, 7, 0b001)
+        expect_wack(sim.read_wack(), ACK, 7, 0b011)
+        expect_wack(sim.read_wack(), ACK, 7, 0b111)
+        expect_wack(sim.wdata(image, 7), ACK, 11, 0)
+
+        # ahead of the window at an offset it can't have, refused rather
+        # than buffered and delivered nowhere
+        expect_wack(sim.wdata(image, 12, offset=13 * boot_tool.SBP_DATA_MAX_SIZE), NACK, 11, 0)
+
+        # the last packets reversed, the first of them releases the rest
+        for seq in (15, 14, 13, 12):
+            sim.wdata(image, seq)
+        expect_wack(sim.wdata(image, 11), ACK, 16, 0)
+
+        sim.request(boot_tool.stop_packet(), "STOP")
+        stats = sim.wait_exit()
+
+        check(stats["jumped"], "image not booted")
+        check_appslot(sim, image)
+
+def test_resume(sim_path, workdir):
+    # power lost halfway through a windowed download, the next boot reports
+    # how far it got and takes the rest from there without erasing the slot
+    image = sbp_bench.make_image(40 * boot_tool.SBP_DATA_MAX_SIZE, seed=20)
+    sent = 20
+
+    with Sim(sim_path, workdir) as sim:
+        sim.request(boot_tool.start_packet(), "START")
+        sim.request(boot_tool.config_packet(image, [1, 0, 0]), "CONF")
+        for seq in range(sent):
+            expect_wack(sim.wdata(image, seq), boot_tool.SBP_RESP_ACK, seq + 1, 0)
+
+        # the acked packets reach the flash and the progress record
+        time.sleep(0.5)
+        sim.proc.kill()
+
+    with Sim(sim_path, workdir) as sim:
+        sim.request(boot_tool.start_packet(), "START")
+        prog = boot_tool.query_progress(sim.link, boot_tool.RtoEstimator(sim.link), 2)
+        check(prog is not None, "no download to resume")
+
+        size, crc, offset = prog
+        check((size, crc) == (len(image), Crc32Mpeg2.calc(image)), "progress of another image")
+        check(0 < offset <= sent * boot_tool.SBP_DATA_MAX_SIZE and offset % boot_tool.SBP_DATA_MAX_SIZE == 0,
+              "resume offset {} after {} packets".format(offset, sent))
+
+        sim.request(boot_tool.config_packet(image, [1, 0, 0], boot_tool.SBP_CONF_FLAG_RESUME), "CONF")
+        rest = image[offset:]
+        for seq in range((len(rest) + boot_tool.SBP_DATA_MAX_SIZE - 1) // boot_tool.SBP_DATA_MAX_SIZE):
+            expect_wack(sim.wdata(rest, seq, offset=offset + seq * boot_tool.SBP_DATA_MAX_SIZE),
+                        boot_tool.SBP_RESP_ACK, seq + 1, 0)
+        sim.request(boot_tool.stop_packet(), "STOP")
+        stats = sim.wait_exit()
+
+        check(stats["jumped"], "image not booted")
+        check("resuming at {}".format(offset) in sim.sim_log(), "download not resumed")
+        check_appslot(sim, image)
+
+def test_copy_diff(sim_path, workdir):
+    # BOOT_COPY_DIFF, only the appslot sectors whose contents change are
+    # erased and programmed. Each update starts from the flash left by the
+    # first one, reinstalling the same image is the reference for everything
+    # besides the appslot copy (slot erase and program, config, progress)
+    image = sbp_bench.make_image(APP_SECTOR_SIZE + 72 * 1024, seed=13)
+    spans = [APP_SECTOR_SIZE, len(image) - APP_SECTOR_SIZE]
+    flash = os.path.join(workdir, "flash.bin")
+    installed = os.path.join(workdir, "installed.bin")
+
+    install(sim_path, workdir, image)
+    shutil.copyfile(flash, installed)
+
+    # the slot takes the image once, the appslot copy would be a second time
+    reference = install(sim_path, workdir, image)
+    check(reference["flash_program_bytes"] < 2 * len(image), "unchanged image copied to the appslot")
+
+    for sectors in ([1], [0], [0, 1]):
+        shutil.copyfile(installed, flash)
+        stats = install(sim_path, workdir, change_sectors(image, sectors))
+
+        erases = stats["flash_erase_ops"] - reference["flash_erase_ops"]
+        programmed = stats["flash_program_bytes"] - reference["flash_program_bytes"]
+        check(erases == len(sectors),
+              "sectors {} changed, {} more erases".format(sectors, erases))
+        check(programmed == sum(spans[sector] for sector in sectors),
+              "sectors {} changed, {} more bytes programmed".format(sectors, programmed))
+
+def test_delta_update(sim_path, workdir):
+    # a patch against the installed image rebuilds the new one
+    old = sbp_bench.make_image(20 * 1024, seed=10)
+    image = old[:5000] + bytes(300) + old[5000:18000] + sbp_bench.make_image(4000, seed=11)[8:]
+
+    install(sim_path, workdir, old)
+    with Sim(sim_path, workdir) as sim:
+        send_delta(sim, old, image)
+        stats = sim.wait_exit()
+
+        check(stats["jumped"], "image not booted")
+        check_appslot(sim, image)
+
+def test_delta_base_mismatch(sim_path, workdir):
+    # a patch made against another base than the installed image is
+    # dropped, the installed image stays as it is and still boots
+    old = sbp_bench.make_image(20 * 1024, seed=10)
+    other = change_sectors(old, [0])
+    image = old[:5000] + bytes(300) + old[5000:]
+
+    install(sim_path, workdir, old)
+    with Sim(sim_path, workdir) as sim:
+        send_delta(sim, other, image)
+
+        # the bootloader halts on the failed validation
+        deadline = time.monotonic() + RESPONSE_TIMEOUT
+        while "validation failed" not in sim.sim_log():
+            check(time.monotonic() < deadline and sim.proc.poll() is None, "patch validated")
+            time.sleep(0.05)
+
+        check("delta base mismatch" in sim.sim_log(), "base mismatch not reported")
+        check_appslot(sim, old)
+
+    check(normal_boot(sim_path, workdir)["jumped"], "installed image no longer boots")
+
+TESTS = [
+    test_window_recovery,
+    test_resume,
+    test_copy_diff,
+    test_delta_update,
+    test_delta_base_mismatch,
+]
+
+def main():
+    parser = test_runner.parser("Update scenarios against the host simulator")
+    parser.add_argument("--sim", default="build/host/boot_sim", help="host simulator (make host-sim)")
+    args = parser.parse_args()
+
+    def run(test):
+        with tempfile.TemporaryDirectory() as workdir:
+            # the tool chatters on stdout, keep the report clean
+            with contextlib.redirect_stdout(io.StringIO()):
+                try:
+                    test(args.sim, workdir)
+                except sbp_sim.SimError as e:
+                    raise TestFailed(e)
+
+    test_runner.run("sim_test", TESTS, args.tests, run)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,35 @@
+import sys
+import argparse
+
+# Runner of the scripted host tests (codec_test.py, sim_test.py): every test
+# is a function named test_<name>, a failed check raises TestFailed
+
+class TestFailed(Exception):
+    pass
+
+def check(condition, message):
+    if not condition:
+        raise TestFailed(message)
+
+def parser(description):
+    parser = argparse.ArgumentParser(description=description)
+    parser.add_argument("tests", nargs="*", help="tests to run, all when omitted")
+    return parser
+
+def run(label, tests, names, call):
+    # call(test) runs one test with the options of the script, exits with
+    # 1 once any of them failed
+    failed = 0
+    for test in tests:
+        name = test.__name__[len("test_"):]
+        if names and name not in names:
+            continue
+
+        try:
+            call(test)
+            print("{}: {} ok".format(label, name))
+        except TestFailed as e:
+            print("{}: {} FAILED: {}".format(label, name, e))
+            failed += 1
+
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,167 @@
+import sys
+import json
+import struct
+import argparse
+import serial
+from crccheck.crc import Crc32Mpeg2
+
+import boot_tool
+
+# Report of the boot timeline ring, from the dumps the bootloader writes to
+# RTT up buffer 3 (JLinkRTTLogger -RTTChannel 3 or the simulator --rtt
+# option) or read over the serial link with TQUERY
+
+TIMELINE_DUMP_MAGIC = b"TLN1"
+TIMELINE_EXPORT_HEADER = struct.Struct("<BB2x")
+
+# same order as timeline_phase_t in Libs/timeline.h
+TIMELINE_PHASES = ["main", "hal_init", "sysclk", "clock_profile", "peripherals",
+                   "boot_init", "button", "validate", "download", "install", "jump"]
+
+# RCC_CSR reset flags, bit 31 down
+RESET_FLAGS = ["lpwr", "wwdg", "iwdg", "sft", "por", "pin", "bor"]
+
+def parse_export(data):
+    boots, marks = TIMELINE_EXPORT_HEADER.unpack_from(data, 0)
+    record = struct.Struct("<IIB3x{}B{}I".format(marks, marks))
+    records = []
+
+    if len(data) < TIMELINE_EXPORT_HEADER.size + boots * record.size:
+        raise ValueError("truncated timeline, {} boots of {} marks".format(boots, marks))
+
+    for i in range(boots):
+        fields = record.unpack_from(data, TIMELINE_EXPORT_HEADER.size + i * record.size)
+        seq, reset_flags, count = fields[:3]
+        phases = fields[3:3 + marks][:count]
+        times = fields[3 + marks:][:count]
+        records.append({"seq": seq, "reset_flags": reset_flags,
+                        "marks": [{"phase": phase_name(p), "us": t} for p, t in zip(phases, times)]})
+
+    return records, TIMELINE_EXPORT_HEADER.size + boots * record.size
+
+def parse_dumps(data):
+    records = {}
+    start = data.find(TIMELINE_DUMP_MAGIC)
+
+    while start != -1:
+        try:
+            ring, size = parse_export(data[start + 4:])
+        except (ValueError, struct.error):
+            print("parse_dumps: truncated dump at {}".format(start), file=sys.stderr)
+            break
+
+        end = start + 4 + size
+        crc = int.from_bytes(data[end:end + 4], byteorder='little')
+        if end + 4 > len(data) or Crc32Mpeg2.calc(data[start:end]) != crc:
+            print("parse_dumps: crc failed at {}".format(start), file=sys.stderr)
+            start = data.find(TIMELINE_DUMP_MAGIC, start + 1)
+            continue
+
+        # every dump repeats the boots still in the ring
+        for record in ring:
+            records[json.dumps(record, sort_keys=True)] = record
+
+        start = data.find(TIMELINE_DUMP_MAGIC, end + 4)
+
+    return list(records.values())
+
+def read_target(port, baud, count):
+    link = boot_tool.SbpLink(serial.Serial(port, baudrate=baud, timeout=0))
+    rto = boot_tool.RtoEstimator(link)
+
+    data = boot_tool.query_timeline(link, rto, 3, count)
+    if data is None:
+        return []
+    return parse_export(data)[0]
+
+def phase_name(phase):
+    return TIMELINE_PHASES[phase] if phase < len(TIMELINE_PHASES) else "phase{}".format(phase)
+
+def reset_name(reset_flags):
+    names = [name for i, name in enumerate(RESET_FLAGS) if reset_flags & (1 << (31 - i))]
+    return ",".join(names) if names else "-"
+
+def phase_durations(records):
+    # a phase lasts from the previous marker to its own
+    durations = {}
+
+    for record in records:
+        marks = record["marks"]
+        for prev, mark in zip(marks, marks[1:]):
+            durations.setdefault(mark["phase"], []).append(mark["us"] - prev["us"])
+
+    return {name: durations[name] for name in TIMELINE_PHASES + sorted(durations) if name in durations}
+
+def histogram(values):
+    # power of two buckets of microseconds
+    buckets = {}
+
+    for value in values:
+        bucket = max(value, 1).bit_length() - 1
+        buckets[bucket] = buckets.get(bucket, 0) + 1
+
+    return [{"from_us": (1 << b) if b else 0, "to_us": 2 << b, "count": buckets[b]} for b in sorted(buckets)]
+
+def report(records):
+    phases = []
+
+    for name, values in phase_durations(records).items():
+        phases.append({"phase": name, "count": len(values),
+                       "min_us": min(values),
+                       "avg_us": sum(values) / len(values),
+                       "max_us": max(values),
+                       "histogram": histogram(values)})
+
+    return {"boots": records, "phases": phases}
+
+def print_report(result, width):
+    print("{:>6}  {:<16}{:>12}  {}".format("seq", "reset", "total ms", "last phase"))
+    for record in result["boots"]:
+        marks = record["marks"]
+        print("{:>6}  {:<16}{:>12.3f}  {}".format(
+            record["seq"], reset_name(record["reset_flags"]),
+            marks[-1]["us"] / 1e3 if marks else 0.0, marks[-1]["phase"] if marks else "-"))
+
+    for stats in result["phases"]:
+        print()
+        print("{}: {} boots, min {} us, avg {:.0f} us, max {} us".format(
+            stats["phase"], stats["count"], stats["min_us"], stats["avg_us"], stats["max_us"]))
+        peak = max(bucket["count"] for bucket in stats["histogram"])
+        for bucket in stats["histogram"]:
+            bar = "#" * max(1, bucket["count"] * width // peak)
+            print("  {:>9} - {:<9} {:>4} {}".format(
+                bucket["from_us"], bucket["to_us"], bucket["count"], bar))
+
+def main():
+    parser = argparse.ArgumentParser(description="Report the bootloader boot timeline")
+    parser.add_argument("dump", nargs="?", help="RTT channel 3 capture")
+    parser.add_argument("--port", default=None,
+                        help="read the ring over the serial link instead, the target in bootloader mode")
+    parser.add_argument("--baud", type=int, default=115200, help="baud rate of the bootloader")
+    parser.add_argument("--count", type=int, default=0, help="newest boots to read, 0 for all")
+    parser.add_argument("--width", type=int, default=40, help="columns of the longest histogram bar")
+    parser.add_argument("--json", action="store_true", help="print the report as JSON")
+    args = parser.parse_args()
+
+    if args.port is not None:
+        records = read_target(args.port, args.baud, args.count)
+    elif args.dump is not None:
+        with open(args.dump, 'rb') as dumpfile:
+            records = parse_dumps(dumpfile.read())
+    else:
+        parser.error("a capture or --port is needed")
+
+    if not records:
+        print("no boot timeline found")
+        return sys.exit(1)
+
+    result = report(records)
+    if args.json:
+        print(json.dumps(result, indent=2))
+        return
+
+    print_report(result, args.width)
+
+
+if __name__ == "__main__":
+    main()